@@ -0,0 +1,837 @@
+/*
+ * Benchmarks icsmap, with each of its table engines and in compact mode,
+ * against a reference open addressing table (ref_map.c) and against maps generated by
+ * ICSMAP_DEFINE for each key size.
+ *
+ * For every combination of implementation, key size, map size and load
+ * pattern a fresh map is filled and the following are measured:
+ *
+ *	put      inserting size keys into an empty map
+ *	churn    removing the oldest key and inserting a new one, size times
+ *	         (churn pattern only, run before the lookups so they see the
+ *	         tombstones churn leaves behind)
+ *	get_hit  size lookups of keys in the map
+ *	get_miss size lookups of keys not in the map
+ *	iterate  visiting every entry once
+ *	remove   removing every key
+ *
+ * Patterns decide which keys are used and in what order they are looked up:
+ *
+ *	seq      keys are consecutive integers, looked up in order
+ *	uniform  keys are scrambled integers, looked up uniformly at random
+ *	zipf     as uniform, but lookups follow a zipfian distribution (0.99)
+ *	churn    as uniform, with the churn phase above
+ *
+ * Every sample-th operation is timed on its own to get latency percentiles;
+ * the cost of reading the clock is measured up front and subtracted. Results
+ * are written as JSON. The workload only depends on --seed so runs can be
+ * reproduced and compared.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "../icsmap.h"
+#include "../icsmap_gen.h"
+#include "ref_map.h"
+
+#define MAX_LIST 16
+
+// the operations every implementation provides
+typedef struct bench_impl {
+	const char *name;
+	void *(*init)(uint32_t keysize, uint32_t valsize);
+	int (*put)(void *map, const void *key, const void *val);
+	int (*get)(void *map, const void *key, void *out);
+	int (*remove)(void *map, const void *key);
+	void (*foreach)(void *map, foreach_fn fn, void *data);
+	void (*deinit)(void *map);
+} bench_impl;
+
+typedef struct bench_opts {
+	uint64_t sizes[MAX_LIST];
+	uint32_t nsizes;
+	uint64_t keysizes[MAX_LIST];
+	uint32_t nkeysizes;
+	const char *patterns[MAX_LIST];
+	uint32_t npatterns;
+	const char *impls[MAX_LIST];
+	uint32_t nimpls;
+	uint64_t seed;
+	uint32_t sample;    // time every sample-th operation on its own
+	const char *out;    // file to write the results to, NULL for stdout
+} bench_opts;
+
+// the keys and access order of a single run
+typedef struct workload {
+	uint32_t keysize;
+	uint64_t size;
+	uint8_t *keys;      // size keys which get inserted
+	uint8_t *misses;    // size keys which never are
+	uint64_t *order;    // size indexes into keys, the lookup order
+	uint64_t next_id;   // id of the next fresh key churn inserts
+	int scramble;       // whether key ids are scrambled
+} workload;
+
+// the measurements of a single operation
+typedef struct result {
+	uint64_t ops;
+	double seconds;
+	uint64_t *samples;  // latencies of the individually timed operations
+	uint64_t nsamples;
+} result;
+
+static uint64_t timer_overhead;
+
+/** Begin implementations */
+
+static void *
+ics_init_engine(uint32_t keysize, uint32_t valsize, icsmap_engine engine, uint32_t flags)
+{
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = keysize,
+		.valsize = valsize,
+		.get_key = NULL,
+		.flags = flags,
+		.engine = engine
+	};
+	return icsmap_init(&map, &cfg) == ICS_OK ? map : NULL;
+}
+
+static void *
+ics_init(uint32_t keysize, uint32_t valsize)
+{
+	return ics_init_engine(keysize, valsize, ICSMAP_LINEAR, 0);
+}
+
+static void *
+ics_cuckoo_init(uint32_t keysize, uint32_t valsize)
+{
+	return ics_init_engine(keysize, valsize, ICSMAP_CUCKOO, 0);
+}
+
+static void *
+ics_hopscotch_init(uint32_t keysize, uint32_t valsize)
+{
+	return ics_init_engine(keysize, valsize, ICSMAP_HOPSCOTCH, 0);
+}
+
+static void *
+ics_compact_init(uint32_t keysize, uint32_t valsize)
+{
+	return ics_init_engine(keysize, valsize, ICSMAP_LINEAR, ICSMAP_COMPACT);
+}
+
+static int
+ics_put(void *map, const void *key, const void *val)
+{
+	return icsmap_put(map, key, val) == ICS_OK ? 0 : -1;
+}
+
+static int
+ics_get(void *map, const void *key, void *out)
+{
+	return icsmap_get(map, key, out) == ICS_OK ? 0 : -1;
+}
+
+static int
+ics_remove(void *map, const void *key)
+{
+	return icsmap_remove(map, key) == ICS_OK ? 0 : -1;
+}
+
+static void
+ics_foreach(void *map, foreach_fn fn, void *data)
+{
+	icsmap_foreach(map, fn, data);
+}
+
+static void
+ics_deinit(void *map)
+{
+	icsmap_deinit(map);
+}
+
+static void *
+ref_init(uint32_t keysize, uint32_t valsize)
+{
+	ref_map *map = malloc(sizeof(ref_map));
+	if (map != NULL && ref_map_init(map, keysize, valsize) != 0) {
+		free(map);
+		return NULL;
+	}
+	return map;
+}
+
+static int
+ref_put(void *map, const void *key, const void *val)
+{
+	return ref_map_put(map, key, val);
+}
+
+static int
+ref_get(void *map, const void *key, void *out)
+{
+	return ref_map_get(map, key, out);
+}
+
+static int
+ref_remove(void *map, const void *key)
+{
+	return ref_map_remove(map, key);
+}
+
+static void
+ref_foreach(void *map, foreach_fn fn, void *data)
+{
+	ref_map_foreach(map, fn, data);
+}
+
+static void
+ref_deinit(void *map)
+{
+	ref_map_deinit(map);
+	free(map);
+}
+
+static const bench_impl impls[] = {
+	{ "icsmap", ics_init, ics_put, ics_get, ics_remove, ics_foreach, ics_deinit },
+	{ "cuckoo", ics_cuckoo_init, ics_put, ics_get, ics_remove, ics_foreach, ics_deinit },
+	{ "hopscotch", ics_hopscotch_init, ics_put, ics_get, ics_remove, ics_foreach, ics_deinit },
+	{ "compact", ics_compact_init, ics_put, ics_get, ics_remove, ics_foreach, ics_deinit },
+	{ "ref", ref_init, ref_put, ref_get, ref_remove, ref_foreach, ref_deinit },
+};
+
+// generated maps need the key type up front, so there is one per key size
+#define GEN_IMPL(n)                                                            \
+typedef struct gen_key##n { uint8_t bytes[n]; } gen_key##n;                    \
+ICSMAP_DEFINE(gen##n, gen_key##n, uint64_t, ICSMAP_HASH_BYTES, ICSMAP_EQ_BYTES) \
+                                                                               \
+static void *                                                                  \
+gen##n##_new(uint32_t keysize, uint32_t valsize)                               \
+{                                                                              \
+	gen##n *map = malloc(sizeof(gen##n));                                      \
+	if (map != NULL && gen##n##_init(map) != ICS_OK) {                         \
+		free(map);                                                             \
+		return NULL;                                                           \
+	}                                                                          \
+	return map;                                                                \
+}                                                                              \
+                                                                               \
+static int                                                                     \
+gen##n##_bench_put(void *map, const void *key, const void *val)                \
+{                                                                              \
+	return gen##n##_put(map, *(const gen_key##n *)key, *(const uint64_t *)val) \
+		== ICS_OK ? 0 : -1;                                                    \
+}                                                                              \
+                                                                               \
+static int                                                                     \
+gen##n##_bench_get(void *map, const void *key, void *out)                      \
+{                                                                              \
+	return gen##n##_get(map, *(const gen_key##n *)key, out) == ICS_OK ? 0 : -1;\
+}                                                                              \
+                                                                               \
+static int                                                                     \
+gen##n##_bench_remove(void *map, const void *key)                              \
+{                                                                              \
+	return gen##n##_remove(map, *(const gen_key##n *)key) == ICS_OK ? 0 : -1;  \
+}                                                                              \
+                                                                               \
+static void                                                                    \
+gen##n##_bench_foreach(void *map, foreach_fn fn, void *data)                   \
+{                                                                              \
+	gen##n *m = map;                                                           \
+	uint32_t i;                                                                \
+	for (i = 0; i < m->capacity; ++i) {                                        \
+		if (m->slots[i].state == ICSMAP_GEN_FULL) {                            \
+			fn(&m->slots[i].key, &m->slots[i].val, data);                      \
+		}                                                                      \
+	}                                                                          \
+}                                                                              \
+                                                                               \
+static void                                                                    \
+gen##n##_free(void *map)                                                       \
+{                                                                              \
+	gen##n##_deinit(map);                                                      \
+	free(map);                                                                 \
+}
+
+GEN_IMPL(4)
+GEN_IMPL(8)
+GEN_IMPL(16)
+GEN_IMPL(64)
+
+static const bench_impl gen_impls[] = {
+	{ "gen", gen4_new, gen4_bench_put, gen4_bench_get, gen4_bench_remove, gen4_bench_foreach, gen4_free },
+	{ "gen", gen8_new, gen8_bench_put, gen8_bench_get, gen8_bench_remove, gen8_bench_foreach, gen8_free },
+	{ "gen", gen16_new, gen16_bench_put, gen16_bench_get, gen16_bench_remove, gen16_bench_foreach, gen16_free },
+	{ "gen", gen64_new, gen64_bench_put, gen64_bench_get, gen64_bench_remove, gen64_bench_foreach, gen64_free },
+};
+
+/** End implementations */
+
+static inline uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// the cheapest of many back to back clock reads
+static uint64_t
+measure_timer_overhead(void)
+{
+	uint64_t best = UINT64_MAX;
+	int i;
+	for (i = 0; i < 10000; ++i) {
+		uint64_t start = now_ns();
+		uint64_t elapsed = now_ns() - start;
+		best = elapsed < best ? elapsed : best;
+	}
+	return best;
+}
+
+static inline uint64_t
+splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+// bijective, so distinct ids stay distinct keys
+static inline uint64_t
+scramble64(uint64_t x)
+{
+	x ^= x >> 31;
+	x *= 0x7fb5d329728ea185ull;
+	x ^= x >> 27;
+	x *= 0x81dadef4bc2dd44dull;
+	x ^= x >> 33;
+	return x;
+}
+
+static inline uint32_t
+scramble32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// writes the key with the given id. Bytes past the first 8 are derived from
+// the id too so comparisons have to look at the whole key.
+static void
+make_key(const workload *w, uint64_t id, uint8_t *key)
+{
+	uint32_t i;
+	if (w->keysize == 4) {
+		uint32_t k = w->scramble ? scramble32((uint32_t)id) : (uint32_t)id;
+		memcpy(key, &k, 4);
+		return;
+	}
+	uint64_t k = w->scramble ? scramble64(id) : id;
+	memcpy(key, &k, 8);
+	for (i = 8; i < w->keysize; ++i) {
+		key[i] = (uint8_t)(k >> (i % 8 * 8)) ^ (uint8_t)i;
+	}
+}
+
+static double
+zeta(uint64_t n, double theta)
+{
+	double sum = 0;
+	uint64_t i;
+	for (i = 1; i <= n; ++i) {
+		sum += 1.0 / pow((double)i, theta);
+	}
+	return sum;
+}
+
+// fills order with zipfian ranks (Gray et al.) scattered over the keys so the
+// hot keys are not also neighbours in the table
+static void
+zipf_order(uint64_t *order, uint64_t n, uint64_t *rng)
+{
+	const double theta = 0.99;
+	double zetan = zeta(n, theta);
+	double zeta2 = zeta(2, theta);
+	double alpha = 1.0 / (1.0 - theta);
+	double eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+	uint64_t i;
+	for (i = 0; i < n; ++i) {
+		double u = (splitmix64(rng) >> 11) * (1.0 / 9007199254740992.0);
+		double uz = u * zetan;
+		uint64_t rank;
+		if (uz < 1.0) {
+			rank = 0;
+		} else if (uz < 1.0 + pow(0.5, theta)) {
+			rank = 1;
+		} else {
+			rank = (uint64_t)(n * pow(eta * u - eta + 1, alpha));
+		}
+		rank = rank >= n ? n - 1 : rank;
+		order[i] = (rank * 0x9e3779b97f4a7c15ull) % n;
+	}
+}
+
+static int
+workload_init(workload *w, uint32_t keysize, uint64_t size, const char *pattern, uint64_t seed)
+{
+	uint64_t i, rng = seed;
+	w->keysize = keysize;
+	w->size = size;
+	w->scramble = strcmp(pattern, "seq") != 0;
+	w->next_id = 2 * size;
+	w->keys = malloc(size * keysize);
+	w->misses = malloc(size * keysize);
+	w->order = malloc(size * sizeof(uint64_t));
+	if (w->keys == NULL || w->misses == NULL || w->order == NULL) {
+		return -1;
+	}
+	for (i = 0; i < size; ++i) {
+		make_key(w, i, w->keys + i * keysize);
+		make_key(w, size + i, w->misses + i * keysize);
+	}
+	if (strcmp(pattern, "seq") == 0) {
+		for (i = 0; i < size; ++i) {
+			w->order[i] = i;
+		}
+	} else if (strcmp(pattern, "zipf") == 0) {
+		zipf_order(w->order, size, &rng);
+	} else {
+		for (i = 0; i < size; ++i) {
+			w->order[i] = splitmix64(&rng) % size;
+		}
+	}
+	return 0;
+}
+
+static void
+workload_deinit(workload *w)
+{
+	free(w->keys);
+	free(w->misses);
+	free(w->order);
+}
+
+static int
+result_init(result *r, uint64_t ops, uint32_t sample)
+{
+	r->ops = ops;
+	r->seconds = 0;
+	r->nsamples = 0;
+	r->samples = malloc((ops / sample + 1) * sizeof(uint64_t));
+	return r->samples != NULL ? 0 : -1;
+}
+
+static inline void
+result_sample(result *r, uint64_t elapsed)
+{
+	r->samples[r->nsamples++] = elapsed > timer_overhead ? elapsed - timer_overhead : 0;
+}
+
+static void
+result_finish(result *r, uint64_t start)
+{
+	uint64_t elapsed = now_ns() - start;
+	// take out the clock reads of the individually timed ops
+	uint64_t overhead = r->nsamples * timer_overhead;
+	r->seconds = (elapsed > overhead ? elapsed - overhead : 0) / 1e9;
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t
+percentile(const result *r, double p)
+{
+	if (r->nsamples == 0) {
+		return 0;
+	}
+	uint64_t index = (uint64_t)(p * (r->nsamples - 1) + 0.5);
+	return r->samples[index];
+}
+
+static void
+result_print(FILE *out, int *first, const char *impl, const workload *w, const char *pattern,
+	const char *op, result *r)
+{
+	qsort(r->samples, r->nsamples, sizeof(uint64_t), cmp_u64);
+	fprintf(out, "%s\n    {\"impl\": \"%s\", \"keysize\": %u, \"size\": %llu, \"pattern\": \"%s\", "
+		"\"op\": \"%s\", \"ops\": %llu, \"seconds\": %.6f, \"mops\": %.3f, "
+		"\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+		*first ? "" : ",", impl, w->keysize, (unsigned long long)w->size, pattern, op,
+		(unsigned long long)r->ops, r->seconds, r->seconds > 0 ? r->ops / r->seconds / 1e6 : 0,
+		(unsigned long long)percentile(r, 0.5), (unsigned long long)percentile(r, 0.9),
+		(unsigned long long)percentile(r, 0.99), (unsigned long long)percentile(r, 0.999),
+		(unsigned long long)percentile(r, 1.0));
+	fflush(out);
+	*first = 0;
+	free(r->samples);
+	r->samples = NULL;
+}
+
+static void
+count_entry(const void *key, const void *val, void *data)
+{
+	// values need not be aligned, icsmap packs them right after the key
+	uint64_t v;
+	(void)key;
+	memcpy(&v, val, sizeof(v));
+	*(uint64_t *)data += v;
+}
+
+// runs every operation against one implementation and workload
+static int
+run(FILE *out, int *first, const bench_impl *impl, workload *w, const char *pattern, uint32_t sample)
+{
+	uint64_t i, start, t, val, sum = 0;
+	uint32_t ks = w->keysize;
+	uint8_t fresh[64];
+	int rc;
+	result r = {.samples = NULL};
+	void *map = impl->init(ks, sizeof(uint64_t));
+	if (map == NULL) {
+		return -1;
+	}
+
+	if (result_init(&r, w->size, sample) != 0) {
+		goto fail;
+	}
+	start = now_ns();
+	for (i = 0; i < w->size; ++i) {
+		val = i;
+		if (i % sample == 0) {
+			t = now_ns();
+			rc = impl->put(map, w->keys + i * ks, &val);
+			result_sample(&r, now_ns() - t);
+		} else {
+			rc = impl->put(map, w->keys + i * ks, &val);
+		}
+		if (rc != 0) {
+			goto fail;
+		}
+	}
+	result_finish(&r, start);
+	result_print(out, first, impl->name, w, pattern, "put", &r);
+
+	if (strcmp(pattern, "churn") == 0) {
+		// keys[i] is always the key with value i, the oldest gets replaced
+		if (result_init(&r, w->size, sample) != 0) {
+			goto fail;
+		}
+		start = now_ns();
+		for (i = 0; i < w->size; ++i) {
+			uint8_t *victim = w->keys + i * ks;
+			make_key(w, w->next_id++, fresh);
+			val = i;
+			if (i % sample == 0) {
+				t = now_ns();
+				impl->remove(map, victim);
+				rc = impl->put(map, fresh, &val);
+				result_sample(&r, now_ns() - t);
+			} else {
+				impl->remove(map, victim);
+				rc = impl->put(map, fresh, &val);
+			}
+			if (rc != 0) {
+				goto fail;
+			}
+			memcpy(victim, fresh, ks);
+		}
+		result_finish(&r, start);
+		result_print(out, first, impl->name, w, pattern, "churn", &r);
+	}
+
+	if (result_init(&r, w->size, sample) != 0) {
+		goto fail;
+	}
+	start = now_ns();
+	for (i = 0; i < w->size; ++i) {
+		const uint8_t *key = w->keys + w->order[i] * ks;
+		if (i % sample == 0) {
+			t = now_ns();
+			rc = impl->get(map, key, &val);
+			result_sample(&r, now_ns() - t);
+		} else {
+			rc = impl->get(map, key, &val);
+		}
+		if (rc != 0) {
+			fprintf(stderr, "%s: key %llu missing\n", impl->name, (unsigned long long)w->order[i]);
+			goto fail;
+		}
+		sum += val;
+	}
+	result_finish(&r, start);
+	result_print(out, first, impl->name, w, pattern, "get_hit", &r);
+
+	if (result_init(&r, w->size, sample) != 0) {
+		goto fail;
+	}
+	start = now_ns();
+	for (i = 0; i < w->size; ++i) {
+		const uint8_t *key = w->misses + i * ks;
+		if (i % sample == 0) {
+			t = now_ns();
+			rc = impl->get(map, key, &val);
+			result_sample(&r, now_ns() - t);
+		} else {
+			rc = impl->get(map, key, &val);
+		}
+		if (rc == 0) {
+			fprintf(stderr, "%s: unexpected hit\n", impl->name);
+			goto fail;
+		}
+	}
+	result_finish(&r, start);
+	result_print(out, first, impl->name, w, pattern, "get_miss", &r);
+
+	// a single pass, timed as a whole
+	if (result_init(&r, w->size, sample) != 0) {
+		goto fail;
+	}
+	start = now_ns();
+	impl->foreach(map, count_entry, &sum);
+	result_finish(&r, start);
+	result_print(out, first, impl->name, w, pattern, "iterate", &r);
+
+	if (result_init(&r, w->size, sample) != 0) {
+		goto fail;
+	}
+	start = now_ns();
+	for (i = 0; i < w->size; ++i) {
+		if (i % sample == 0) {
+			t = now_ns();
+			rc = impl->remove(map, w->keys + i * ks);
+			result_sample(&r, now_ns() - t);
+		} else {
+			rc = impl->remove(map, w->keys + i * ks);
+		}
+		if (rc != 0) {
+			goto fail;
+		}
+	}
+	result_finish(&r, start);
+	result_print(out, first, impl->name, w, pattern, "remove", &r);
+
+	impl->deinit(map);
+	// keeps the lookups from being optimized out
+	return sum == 42 ? 1 : 0;
+
+fail:
+	free(r.samples);
+	impl->deinit(map);
+	return -1;
+}
+
+// parses a comma separated list of numbers, which may end in K or M
+static int
+parse_sizes(char *arg, uint64_t *list, uint32_t *count)
+{
+	char *tok, *end;
+	for (*count = 0, tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (*count == MAX_LIST) {
+			return -1;
+		}
+		uint64_t n = strtoull(tok, &end, 10);
+		if (*end == 'K' || *end == 'k') {
+			n *= 1000;
+			end++;
+		} else if (*end == 'M' || *end == 'm') {
+			n *= 1000000;
+			end++;
+		}
+		if (*end != '\0' || n == 0) {
+			return -1;
+		}
+		list[(*count)++] = n;
+	}
+	return 0;
+}
+
+static int
+parse_names(char *arg, const char **list, uint32_t *count)
+{
+	char *tok;
+	for (*count = 0, tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (*count == MAX_LIST) {
+			return -1;
+		}
+		list[(*count)++] = tok;
+	}
+	return 0;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  --sizes LIST     map sizes, K and M suffixes allowed (default 1K,10K,100K,1M)\n"
+		"  --keys LIST      key sizes out of 4,8,16,64 (default 4,8,16,64)\n"
+		"  --patterns LIST  out of seq,uniform,zipf,churn (default all)\n"
+		"  --impls LIST     out of icsmap,cuckoo,hopscotch,compact,ref,gen (default all)\n"
+		"  --seed N         workload seed (default 1)\n"
+		"  --sample N       time every Nth operation on its own (default 64)\n"
+		"  --out FILE       write the JSON results to FILE instead of stdout\n",
+		prog);
+}
+
+static int
+parse_opts(int argc, char **argv, bench_opts *opts)
+{
+	static char sizes[] = "1K,10K,100K,1M";
+	static char keys[] = "4,8,16,64";
+	static char patterns[] = "seq,uniform,zipf,churn";
+	static char names[] = "icsmap,cuckoo,hopscotch,compact,ref,gen";
+	int i;
+	parse_sizes(sizes, opts->sizes, &opts->nsizes);
+	parse_sizes(keys, opts->keysizes, &opts->nkeysizes);
+	parse_names(patterns, opts->patterns, &opts->npatterns);
+	parse_names(names, opts->impls, &opts->nimpls);
+	opts->seed = 1;
+	opts->sample = 64;
+	opts->out = NULL;
+
+	for (i = 1; i < argc; ++i) {
+		const char *opt = argv[i];
+		char *arg = i + 1 < argc ? argv[i + 1] : NULL;
+		int status = 0;
+		if (arg == NULL) {
+			return -1;
+		} else if (strcmp(opt, "--sizes") == 0) {
+			status = parse_sizes(arg, opts->sizes, &opts->nsizes);
+		} else if (strcmp(opt, "--keys") == 0) {
+			status = parse_sizes(arg, opts->keysizes, &opts->nkeysizes);
+		} else if (strcmp(opt, "--patterns") == 0) {
+			status = parse_names(arg, opts->patterns, &opts->npatterns);
+		} else if (strcmp(opt, "--impls") == 0) {
+			status = parse_names(arg, opts->impls, &opts->nimpls);
+		} else if (strcmp(opt, "--seed") == 0) {
+			opts->seed = strtoull(arg, NULL, 10);
+		} else if (strcmp(opt, "--sample") == 0) {
+			opts->sample = (uint32_t)strtoul(arg, NULL, 10);
+			status = opts->sample == 0 ? -1 : 0;
+		} else if (strcmp(opt, "--out") == 0) {
+			opts->out = arg;
+		} else {
+			return -1;
+		}
+		if (status != 0) {
+			return -1;
+		}
+		i++;
+	}
+
+	for (i = 0; i < (int)opts->nkeysizes; ++i) {
+		uint64_t ks = opts->keysizes[i];
+		if (ks != 4 && ks != 8 && ks != 16 && ks != 64) {
+			return -1;
+		}
+	}
+	for (i = 0; i < (int)opts->npatterns; ++i) {
+		const char *p = opts->patterns[i];
+		if (strcmp(p, "seq") && strcmp(p, "uniform") && strcmp(p, "zipf") && strcmp(p, "churn")) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static const bench_impl *
+find_impl(const char *name, uint32_t keysize)
+{
+	uint32_t i;
+	if (strcmp(name, "gen") == 0) {
+		switch (keysize) {
+		case 4: return &gen_impls[0];
+		case 8: return &gen_impls[1];
+		case 16: return &gen_impls[2];
+		default: return &gen_impls[3];
+		}
+	}
+	for (i = 0; i < sizeof(impls) / sizeof(impls[0]); ++i) {
+		if (strcmp(impls[i].name, name) == 0) {
+			return &impls[i];
+		}
+	}
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	bench_opts opts;
+	uint32_t s, k, p, m;
+	int first = 1;
+	if (parse_opts(argc, argv, &opts) != 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	for (m = 0; m < opts.nimpls; ++m) {
+		if (find_impl(opts.impls[m], 4) == NULL) {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	FILE *out = opts.out != NULL ? fopen(opts.out, "w") : stdout;
+	if (out == NULL) {
+		perror(opts.out);
+		return 1;
+	}
+	timer_overhead = measure_timer_overhead();
+	fprintf(out, "{\n  \"seed\": %llu,\n  \"sample\": %u,\n  \"timer_overhead_ns\": %llu,\n  \"results\": [",
+		(unsigned long long)opts.seed, opts.sample, (unsigned long long)timer_overhead);
+
+	for (s = 0; s < opts.nsizes; ++s) {
+		for (k = 0; k < opts.nkeysizes; ++k) {
+			for (p = 0; p < opts.npatterns; ++p) {
+				workload w;
+				if (workload_init(&w, (uint32_t)opts.keysizes[k], opts.sizes[s], opts.patterns[p], opts.seed) != 0) {
+					fprintf(stderr, "out of memory for %llu keys\n", (unsigned long long)opts.sizes[s]);
+					return 1;
+				}
+				// every implementation sees exactly the same keys and order
+				uint8_t *pristine = malloc(w.size * w.keysize);
+				if (pristine == NULL) {
+					fprintf(stderr, "out of memory for %llu keys\n", (unsigned long long)opts.sizes[s]);
+					workload_deinit(&w);
+					return 1;
+				}
+				memcpy(pristine, w.keys, w.size * w.keysize);
+				for (m = 0; m < opts.nimpls; ++m) {
+					memcpy(w.keys, pristine, w.size * w.keysize);
+					w.next_id = 2 * w.size;
+					if (run(out, &first, find_impl(opts.impls[m], w.keysize), &w, opts.patterns[p], opts.sample) < 0) {
+						fprintf(stderr, "%s failed\n", opts.impls[m]);
+						free(pristine);
+						workload_deinit(&w);
+						return 1;
+					}
+				}
+				free(pristine);
+				workload_deinit(&w);
+			}
+		}
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+	if (out != stdout) {
+		fclose(out);
+	}
+	return 0;
+}
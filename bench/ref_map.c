@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ref_map.h"
+
+#define REF_INITIAL_CAPACITY 16
+
+#define CTRL_EMPTY   0
+#define CTRL_DELETED 1
+#define CTRL_FULL    0x80
+
+// FNV-1a with a final avalanche so the low bits used for the index are good
+static uint64_t
+ref_hash(const void *key, uint32_t len)
+{
+	const uint8_t *bytes = key;
+	uint64_t h = 0xcbf29ce484222325ull;
+	uint32_t i;
+	for (i = 0; i < len; ++i) {
+		h = (h ^ bytes[i]) * 0x100000001b3ull;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	return h;
+}
+
+static inline uint8_t
+ref_tag(uint64_t hash)
+{
+	return CTRL_FULL | (hash >> 57);
+}
+
+static inline uint8_t *
+ref_slot(const ref_map *map, uint64_t index)
+{
+	return map->slots + index * map->slotsize;
+}
+
+static int
+ref_alloc(ref_map *map, uint64_t capacity)
+{
+	map->ctrl = calloc(capacity, 1);
+	map->slots = malloc(capacity * map->slotsize);
+	if (map->ctrl == NULL || map->slots == NULL) {
+		free(map->ctrl);
+		free(map->slots);
+		return -1;
+	}
+	map->mask = capacity - 1;
+	map->size = map->used = 0;
+	return 0;
+}
+
+int
+ref_map_init(ref_map *map, uint32_t keysize, uint32_t valsize)
+{
+	map->keysize = keysize;
+	map->valsize = valsize;
+	map->slotsize = keysize + valsize;
+	return ref_alloc(map, REF_INITIAL_CAPACITY);
+}
+
+// index of the key, or of the empty slot ending its probe
+static uint64_t
+ref_find(const ref_map *map, const void *key, uint64_t hash, int *found)
+{
+	uint64_t i = hash & map->mask;
+	uint8_t tag = ref_tag(hash);
+	while (map->ctrl[i] != CTRL_EMPTY) {
+		if (map->ctrl[i] == tag && memcmp(ref_slot(map, i), key, map->keysize) == 0) {
+			*found = 1;
+			return i;
+		}
+		i = (i + 1) & map->mask;
+	}
+	*found = 0;
+	return i;
+}
+
+static int
+ref_grow(ref_map *map)
+{
+	ref_map old = *map;
+	// only grow if the table is mostly live entries, otherwise just drop
+	// the tombstones
+	uint64_t capacity = old.size * 2 >= old.mask + 1 ? (old.mask + 1) * 2 : old.mask + 1;
+	if (ref_alloc(map, capacity) != 0) {
+		*map = old;
+		return -1;
+	}
+	uint64_t i;
+	for (i = 0; i <= old.mask; ++i) {
+		if (old.ctrl[i] & CTRL_FULL) {
+			uint64_t j = ref_hash(ref_slot(&old, i), old.keysize) & map->mask;
+			while (map->ctrl[j] != CTRL_EMPTY) {
+				j = (j + 1) & map->mask;
+			}
+			map->ctrl[j] = old.ctrl[i];
+			memcpy(ref_slot(map, j), ref_slot(&old, i), map->slotsize);
+		}
+	}
+	map->size = map->used = old.size;
+	free(old.ctrl);
+	free(old.slots);
+	return 0;
+}
+
+int
+ref_map_put(ref_map *map, const void *key, const void *val)
+{
+	if ((map->used + 1) * 8 > (map->mask + 1) * 7 && ref_grow(map) != 0) {
+		return -1;
+	}
+	int found;
+	uint64_t hash = ref_hash(key, map->keysize);
+	uint64_t i = ref_find(map, key, hash, &found);
+	if (!found) {
+		map->ctrl[i] = ref_tag(hash);
+		memcpy(ref_slot(map, i), key, map->keysize);
+		map->size++;
+		map->used++;
+	}
+	memcpy(ref_slot(map, i) + map->keysize, val, map->valsize);
+	return 0;
+}
+
+int
+ref_map_get(const ref_map *map, const void *key, void *out)
+{
+	int found;
+	uint64_t i = ref_find(map, key, ref_hash(key, map->keysize), &found);
+	if (!found) {
+		return -1;
+	}
+	memcpy(out, ref_slot(map, i) + map->keysize, map->valsize);
+	return 0;
+}
+
+int
+ref_map_remove(ref_map *map, const void *key)
+{
+	int found;
+	uint64_t i = ref_find(map, key, ref_hash(key, map->keysize), &found);
+	if (!found) {
+		return -1;
+	}
+	map->ctrl[i] = CTRL_DELETED;
+	map->size--;
+	return 0;
+}
+
+void
+ref_map_foreach(const ref_map *map, ref_foreach_fn fn, void *data)
+{
+	uint64_t i;
+	for (i = 0; i <= map->mask; ++i) {
+		if (map->ctrl[i] & CTRL_FULL) {
+			fn(ref_slot(map, i), ref_slot(map, i) + map->keysize, data);
+		}
+	}
+}
+
+void
+ref_map_deinit(ref_map *map)
+{
+	free(map->ctrl);
+	free(map->slots);
+}
@@ -0,0 +1,33 @@
+#include <stdint.h>
+
+#ifndef REF_MAP
+#define REF_MAP
+
+/*
+ * A plain open addressing table used as the baseline in the benchmarks. Keys
+ * and values of a fixed size are stored inline in a power of two sized array
+ * next to a byte of control information per slot, probed linearly, and
+ * resized once 7/8 of the slots are used. It is deliberately the textbook
+ * design so icsmap numbers have something obvious to be compared against.
+ */
+typedef struct ref_map {
+	uint32_t keysize;
+	uint32_t valsize;
+	uint32_t slotsize;  // keysize + valsize
+	uint64_t mask;      // capacity - 1
+	uint64_t size;      // live entries
+	uint64_t used;      // live entries plus tombstones
+	uint8_t *ctrl;      // per slot: 0 empty, 1 deleted, otherwise 0x80 | 7 hash bits
+	uint8_t *slots;     // keysize + valsize bytes per slot
+} ref_map;
+
+typedef void (*ref_foreach_fn) (const void *key, const void *val, void *data);
+
+int ref_map_init(ref_map *map, uint32_t keysize, uint32_t valsize);
+int ref_map_put(ref_map *map, const void *key, const void *val);
+int ref_map_get(const ref_map *map, const void *key, void *out);
+int ref_map_remove(ref_map *map, const void *key);
+void ref_map_foreach(const ref_map *map, ref_foreach_fn fn, void *data);
+void ref_map_deinit(ref_map *map);
+
+#endif // REF_MAP
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// Every block handed out is preceded by a header recording its size, so free
+// can check the map hands back the same size it asked for.
+typedef struct tracker {
+	uint64_t live_bytes;
+	uint64_t live_blocks;
+	uint64_t allocs;
+	uint64_t reallocs;
+	int fail_after;     // makes alloc fail after this many more calls, or -1
+} tracker;
+
+#define HEADER 16
+
+void *
+track_alloc(uint64_t size, void *ctx)
+{
+	tracker *t = ctx;
+	if (t->fail_after == 0) {
+		return NULL;
+	} else if (t->fail_after > 0) {
+		t->fail_after--;
+	}
+	uint8_t *block = malloc(HEADER + size);
+	if (block == NULL) {
+		return NULL;
+	}
+	memcpy(block, &size, sizeof(size));
+	t->live_bytes += size;
+	t->live_blocks++;
+	t->allocs++;
+	return block + HEADER;
+}
+
+void
+track_free(void *ptr, uint64_t size, void *ctx)
+{
+	tracker *t = ctx;
+	if (ptr == NULL) {
+		return;
+	}
+	uint8_t *block = (uint8_t *)ptr - HEADER;
+	uint64_t recorded;
+	memcpy(&recorded, block, sizeof(recorded));
+	// the map must free with the size it allocated with
+	assert(recorded == size);
+	t->live_bytes -= size;
+	t->live_blocks--;
+	free(block);
+}
+
+void *
+track_realloc(void *ptr, uint64_t old_size, uint64_t new_size, void *ctx)
+{
+	tracker *t = ctx;
+	uint8_t *block = (uint8_t *)ptr - HEADER;
+	uint64_t recorded;
+	memcpy(&recorded, block, sizeof(recorded));
+	assert(recorded == old_size);
+	block = realloc(block, HEADER + new_size);
+	if (block == NULL) {
+		return NULL;
+	}
+	memcpy(block, &new_size, sizeof(new_size));
+	t->live_bytes += new_size - old_size;
+	t->reallocs++;
+	return block + HEADER;
+}
+
+int main() {
+	// All of a map's memory can come from our own allocator. icsmap tells free
+	// how big each block is, so an arena or pool needs no bookkeeping of its
+	// own. Here we just keep count.
+	tracker t = {.fail_after = -1};
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.get_key = NULL,
+		.flags = ICSMAP_VAR_VALS | ICSMAP_TTL,
+		.allocator = {
+			.alloc = track_alloc,
+			.free = track_free,
+			.realloc = track_realloc,
+			.ctx = &t
+		}
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	assert(t.allocs > 0);
+
+	char val[64] = {0};
+	int i;
+	for (i = 0; i < 1000; ++i) {
+		status = icsmap_put_var(map, &i, val, i % 16);
+		assert(status == ICS_OK);
+	}
+	// growing values goes through realloc
+	for (i = 0; i < 1000; i += 10) {
+		status = icsmap_put_var(map, &i, val, 64);
+		assert(status == ICS_OK);
+	}
+	assert(t.reallocs > 0);
+	for (i = 0; i < 1000; i += 2) {
+		status = icsmap_remove(map, &i);
+		assert(status == ICS_OK);
+	}
+
+	// what the map reports taking up is exactly what it holds from us
+	icsmap_statistics stats;
+	icsmap_stats(map, &stats);
+	log("the map holds %llu bytes in %llu blocks after %llu allocations",
+		(unsigned long long)t.live_bytes, (unsigned long long)t.live_blocks,
+		(unsigned long long)t.allocs);
+	assert(stats.bytes == t.live_bytes);
+
+	// clones and frozen copies use the same allocator
+	icsmap_handle clone;
+	status = icsmap_clone(map, &clone);
+	assert(status == ICS_OK);
+	icsmap_deinit(map);
+	assert(t.live_bytes > 0);
+	icsmap_deinit(clone);
+	assert(t.live_bytes == 0 && t.live_blocks == 0);
+
+	// running out of memory is reported, and leaves the map usable
+	cfg.flags = 0;
+	cfg.valsize = sizeof(int);
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	t.fail_after = 20;
+	for (i = 0; i < 1000; ++i) {
+		status = icsmap_put(map, &i, &i);
+		if (status != ICS_OK) {
+			break;
+		}
+	}
+	assert(status == ICS_NO_MEMORY);
+	log("ran out of memory after %d puts", i);
+	t.fail_after = -1;
+	int j, out;
+	for (j = 0; j < i; ++j) {
+		status = icsmap_get(map, &j, &out);
+		assert(status == ICS_OK && out == j);
+	}
+	status = icsmap_put(map, &i, &i);
+	assert(status == ICS_OK);
+	icsmap_frozen_handle frozen;
+	status = icsmap_freeze(map, &frozen);
+	assert(status == ICS_OK);
+	icsmap_deinit(map);
+	assert(t.live_blocks > 0);
+	icsmap_frozen_deinit(frozen);
+	assert(t.live_bytes == 0 && t.live_blocks == 0);
+
+	// alloc and free come as a pair
+	cfg.allocator.free = NULL;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_INVALID);
+	return 0;
+}
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// a clock we move by hand, like ex_ttl.c
+static uint64_t now = 1000;
+
+uint64_t
+fake_clock(void)
+{
+	return now;
+}
+
+void
+count_evicted(const void *key, const void *val, void *data)
+{
+	(void)val;
+	int *evicted = data;
+	evicted[0]++;
+	evicted[1] = *(const int *)key;
+}
+
+// records the keys foreach visits, in order
+typedef struct visits {
+	int keys[100000];
+	int count;
+} visits;
+
+void
+record(const void *key, const void *val, void *data)
+{
+	(void)val;
+	visits *v = data;
+	v->keys[v->count++] = *(const int *)key;
+}
+
+int main() {
+	// icsmap_clone copies a map table and all, so nothing is hashed again and
+	// every entry keeps its slot.
+	icsmap_handle map, clone;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	int i, val;
+	for (i = 0; i < 100000; ++i) {
+		status = icsmap_put(map, &i, &i);
+		assert(status == ICS_OK);
+	}
+	for (i = 0; i < 100000; i += 3) {
+		status = icsmap_remove(map, &i);
+		assert(status == ICS_OK);
+	}
+	// some lookups, so the original has counters for the clone not to copy
+	for (i = 0; i < 1000; ++i) {
+		status = icsmap_get(map, &i, &val);
+		assert(status == (i % 3 ? ICS_OK : ICS_NOT_FOUND));
+	}
+	status = icsmap_clone(map, &clone);
+	assert(status == ICS_OK);
+	assert(icsmap_count(clone) == icsmap_count(map));
+	// same slots means the same iteration order
+	static visits a, b;
+	icsmap_foreach(map, record, &a);
+	icsmap_foreach(clone, record, &b);
+	assert(a.count == b.count && memcmp(a.keys, b.keys, a.count * sizeof(int)) == 0);
+	// the counters start over
+	icsmap_statistics stats;
+	icsmap_stats(clone, &stats);
+	assert(stats.hits == 0 && stats.misses == 0);
+
+	// the two are independent from here on
+	i = 1;
+	val = -1;
+	status = icsmap_put(clone, &i, &val);
+	assert(status == ICS_OK);
+	status = icsmap_get(map, &i, &val);
+	assert(status == ICS_OK && val == 1);
+	i = 2;
+	status = icsmap_remove(map, &i);
+	assert(status == ICS_OK);
+	status = icsmap_contains(clone, &i);
+	assert(status == ICS_EXISTS);
+	icsmap_deinit(map);
+	status = icsmap_get(clone, &i, &val);
+	assert(status == ICS_OK && val == 2);
+	icsmap_deinit(clone);
+
+	// A ttl map carries its expiries over. Entries put without a ttl never
+	// expire in the clone either, and ones which expired before the clone are
+	// gone from it too.
+	int evicted[2] = {0};
+	cfg.flags = ICSMAP_TTL;
+	cfg.clock = fake_clock;
+	cfg.evict = count_evicted;
+	cfg.evict_data = evicted;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	for (i = 0; i < 300; ++i) {
+		uint64_t ttl = i < 100 ? 0 : i < 200 ? 50 : 500;
+		status = icsmap_put_ttl(map, &i, &i, ttl);
+		assert(status == ICS_OK);
+	}
+	now += 100;
+	status = icsmap_clone(map, &clone);
+	assert(status == ICS_OK);
+	uint32_t reclaimed = icsmap_expire(clone, now, 1000);
+	assert(reclaimed == 100 && evicted[0] == 100);
+	for (i = 0; i < 300; ++i) {
+		status = icsmap_contains(clone, &i);
+		assert(status == (i >= 100 && i < 200 ? ICS_NOT_FOUND : ICS_EXISTS));
+	}
+	// later on, the rest expire in the clone on time and the ones without a
+	// ttl stay
+	now += 400;
+	reclaimed = icsmap_expire(clone, now, 1000);
+	log("the clone reclaimed %u more expired entries, %u left", reclaimed, icsmap_count(clone));
+	assert(reclaimed == 100 && evicted[0] == 200);
+	assert(icsmap_count(clone) == 100);
+	for (i = 0; i < 300; ++i) {
+		status = icsmap_contains(clone, &i);
+		assert(status == (i < 100 ? ICS_EXISTS : ICS_NOT_FOUND));
+	}
+	// reclaiming them in the clone left the original alone
+	assert(icsmap_count(map) == 300);
+	icsmap_deinit(clone);
+	icsmap_deinit(map);
+
+	// An LRU cache keeps its order of use, so the clone evicts the same key
+	// the original would have.
+	cfg.flags = 0;
+	cfg.clock = NULL;
+	cfg.max_entries = 10;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	for (i = 0; i < 10; ++i) {
+		status = icsmap_put(map, &i, &i);
+		assert(status == ICS_OK);
+	}
+	// 0 was used last, which leaves 1 as the least recently used
+	i = 0;
+	status = icsmap_get(map, &i, &val);
+	assert(status == ICS_OK);
+	status = icsmap_clone(map, &clone);
+	assert(status == ICS_OK);
+	evicted[0] = 0;
+	i = 10;
+	status = icsmap_put(clone, &i, &i);
+	assert(status == ICS_OK);
+	assert(evicted[0] == 1 && evicted[1] == 1);
+	i = 11;
+	status = icsmap_put(clone, &i, &i);
+	assert(status == ICS_OK);
+	assert(evicted[0] == 2 && evicted[1] == 2);
+	i = 0;
+	status = icsmap_contains(clone, &i);
+	assert(status == ICS_EXISTS);
+	// and the original still has all ten
+	assert(icsmap_count(map) == 10);
+	icsmap_deinit(clone);
+	icsmap_deinit(map);
+	return 0;
+}
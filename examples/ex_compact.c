@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// records the keys foreach visits, in order
+typedef struct visits {
+	int keys[20000];
+	int count;
+} visits;
+
+void
+record(const void *key, const void *val, void *data)
+{
+	(void)val;
+	visits *v = data;
+	v->keys[v->count++] = *(const int *)key;
+}
+
+// the order a key goes in, scrambled so it is nothing like hash order
+static int
+nth_key(int i)
+{
+	return (i * 7919) % 100003;
+}
+
+// fills a map, removes some keys, and returns how many bytes it takes up
+static uint64_t
+fill(icsmap_handle map)
+{
+	int i;
+	ics_status status;
+	for (i = 0; i < 10000; ++i) {
+		int key = nth_key(i);
+		status = icsmap_put(map, &key, &i);
+		assert(status == ICS_OK);
+	}
+	icsmap_statistics stats;
+	icsmap_stats(map, &stats);
+	return stats.bytes;
+}
+
+int main() {
+	// ICSMAP_COMPACT keeps entries in one dense array in the order they were
+	// first put, and makes the table an index into it. Iteration walks the
+	// array, so keys come out in insertion order, however often the table grew.
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL,
+		.flags = ICSMAP_COMPACT
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	uint64_t compact_bytes = fill(map);
+	static visits v;
+	int i;
+	icsmap_foreach(map, record, &v);
+	assert(v.count == 10000);
+	for (i = 0; i < 10000; ++i) {
+		assert(v.keys[i] == nth_key(i));
+	}
+
+	// overwriting a value keeps the key where it was, removing a key drops it
+	// from the order, and putting it back puts it at the end
+	int key = nth_key(0), val = -1;
+	status = icsmap_put(map, &key, &val);
+	assert(status == ICS_OK);
+	for (i = 1; i < 10000; i += 2) {
+		key = nth_key(i);
+		status = icsmap_remove(map, &key);
+		assert(status == ICS_OK);
+	}
+	key = nth_key(1);
+	status = icsmap_put(map, &key, &val);
+	assert(status == ICS_OK);
+	// enough new keys to resize, which squeezes the holes out of the array
+	for (i = 10000; i < 20000; ++i) {
+		key = nth_key(i);
+		status = icsmap_put(map, &key, &i);
+		assert(status == ICS_OK);
+	}
+	v.count = 0;
+	icsmap_foreach(map, record, &v);
+	assert(v.count == 5000 + 1 + 10000);
+	for (i = 0; i < 5000; ++i) {
+		assert(v.keys[i] == nth_key(2 * i));
+	}
+	assert(v.keys[5000] == nth_key(1));
+	for (i = 0; i < 10000; ++i) {
+		assert(v.keys[5001 + i] == nth_key(10000 + i));
+	}
+	key = nth_key(0);
+	status = icsmap_get(map, &key, &val);
+	assert(status == ICS_OK && val == -1);
+	icsmap_deinit(map);
+
+	// the index takes a fraction of the room of the usual table
+	cfg.flags = 0;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	uint64_t plain_bytes = fill(map);
+	icsmap_deinit(map);
+	log("10000 entries: %llu bytes compact, %llu bytes otherwise",
+		(unsigned long long)compact_bytes, (unsigned long long)plain_bytes);
+	assert(compact_bytes < plain_bytes);
+
+	// only the linear engine keeps an index
+	cfg.flags = ICSMAP_COMPACT;
+	cfg.engine = ICSMAP_CUCKOO;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_INVALID);
+	return 0;
+}
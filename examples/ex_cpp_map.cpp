@@ -0,0 +1,121 @@
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "icsmap.hpp"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// counts how many are alive, so we can tell the map destroys everything it
+// builds. Copies throw once armed, and moves are not noexcept so rehashing
+// has to copy.
+struct fragile {
+	static int live;
+	static int copies_left;
+	int value;
+
+	explicit fragile(int v) : value(v) { live++; }
+	fragile(const fragile &other) : value(other.value)
+	{
+		if (copies_left == 0) {
+			throw std::runtime_error("copy failed");
+		}
+		copies_left--;
+		live++;
+	}
+	fragile(fragile &&other) : value(other.value) { live++; }
+	fragile &operator=(const fragile &) = default;
+	~fragile() { live--; }
+};
+
+int fragile::live = 0;
+int fragile::copies_left = -1;
+
+int main() {
+	// ics::map stores keys and values in the table itself and builds them in
+	// place, so it works with types memcpy would break, like std::string or
+	// std::unique_ptr.
+	ics::map<std::string, int, ics::string_hash, std::equal_to<>> counts;
+	const char *words[] = {"apple", "pear", "apple", "plum", "apple", "pear"};
+	for (const char *w : words) {
+		counts[w] += 1;
+	}
+	assert(counts.size() == 3);
+	// with a transparent hash and eq, lookups take a string_view or a C
+	// string without building a std::string
+	assert(counts.find(std::string_view("apple"))->second == 3);
+	assert(counts.at("pear") == 2);
+	assert(counts.contains("plum") && !counts.contains("fig"));
+	bool threw = false;
+	try {
+		counts.at("fig");
+	} catch (const std::out_of_range &) {
+		threw = true;
+	}
+	assert(threw);
+	log("apple shows up %d times", counts.at("apple"));
+
+	// move only values move in and out, and erase during iteration hands back
+	// the next element
+	ics::map<int, std::unique_ptr<int>> owners;
+	for (int i = 0; i < 100; ++i) {
+		owners.try_emplace(i, std::make_unique<int>(i * i));
+	}
+	for (auto it = owners.begin(); it != owners.end();) {
+		it = it->first % 2 != 0 ? owners.erase(it) : std::next(it);
+	}
+	assert(owners.size() == 50 && *owners.at(8) == 64);
+	ics::map<int, std::unique_ptr<int>> moved(std::move(owners));
+	assert(moved.size() == 50 && owners.empty());
+	owners.try_emplace(1, std::make_unique<int>(1));
+	assert(owners.size() == 1);
+
+	// copies are independent of the original
+	auto copy = counts;
+	copy["apple"] = 10;
+	assert(counts.at("apple") == 3 && copy.at("apple") == 10);
+
+	// If copying an element throws while the table grows, the map is left as
+	// it was before the insert: same elements, same values, nothing leaked.
+	{
+		ics::map<int, fragile> map;
+		int i = 0;
+		size_t capacity = map.capacity();
+		// fill up to just before the next rehash
+		while (true) {
+			map.try_emplace(i, i);
+			if (map.capacity() != capacity) {
+				capacity = map.capacity();
+				break;
+			}
+			i++;
+		}
+		for (i++; (map.size() + 1) * 100 / capacity <= 33; ++i) {
+			map.try_emplace(i, i);
+		}
+		size_t size = map.size();
+		fragile::copies_left = 5;
+		threw = false;
+		try {
+			map.try_emplace(i, i);
+		} catch (const std::runtime_error &) {
+			threw = true;
+		}
+		fragile::copies_left = -1;
+		assert(threw);
+		assert(map.size() == size && map.capacity() == capacity);
+		assert(fragile::live == (int)size);
+		for (int k = 0; k < (int)size; ++k) {
+			assert(map.at(k).value == k);
+		}
+		log("a throwing copy during a rehash left all %zu elements in place", size);
+
+		// and the map carries on as normal afterwards
+		map.try_emplace(i, i);
+		assert(map.size() == size + 1 && map.capacity() > capacity);
+	}
+	assert(fragile::live == 0);
+	return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// adds up the values handed to it, to check every frozen entry is visited
+void
+sum_vals(const void *key, const void *val, void *data)
+{
+	(void)key;
+	*(long *)data += *(const int *)val;
+}
+
+int main() {
+	// Some maps are built once and then only ever read, say a table of error
+	// codes loaded at startup. For those, icsmap can freeze the map into a
+	// read-only copy where every key has a slot of its own, so a lookup looks
+	// at exactly one slot and there are no empty slots wasting memory.
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+
+	// squares of the first thousand numbers
+	int i, val;
+	long expected = 0;
+	for (i = 0; i < 1000; ++i) {
+		val = i * i;
+		expected += val;
+		status = icsmap_put(map, &i, &val);
+		if (status != ICS_OK) {
+			log("Could not insert into map: %s", ics_status_str(status));
+			return 2;
+		}
+	}
+
+	// freezing copies the map, so the original can be changed or thrown away
+	// without affecting the frozen one
+	icsmap_frozen_handle frozen;
+	status = icsmap_freeze(map, &frozen);
+	if (status != ICS_OK) {
+		log("Could not freeze map: %s", ics_status_str(status));
+		return 2;
+	}
+	icsmap_deinit(map);
+	assert(icsmap_frozen_count(frozen) == 1000);
+
+	// every key we put in is there with its value...
+	for (i = 0; i < 1000; ++i) {
+		val = -1;
+		status = icsmap_frozen_get(frozen, &i, &val);
+		assert(status == ICS_OK && val == i * i);
+	}
+	// ...and keys we never put in are not
+	for (i = 1000; i < 2000; ++i) {
+		status = icsmap_frozen_contains(frozen, &i);
+		assert(status == ICS_NOT_FOUND);
+	}
+	i = 12;
+	icsmap_frozen_get(frozen, &i, &val);
+	log("12 squared is %d, found with a single probe", val);
+
+	long sum = 0;
+	icsmap_frozen_foreach(frozen, sum_vals, &sum);
+	assert(sum == expected);
+	icsmap_frozen_deinit(frozen);
+
+	// An empty map freezes too, into a map where nothing is found
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	status = icsmap_freeze(map, &frozen);
+	assert(status == ICS_OK);
+	assert(icsmap_frozen_count(frozen) == 0);
+	i = 0;
+	status = icsmap_frozen_get(frozen, &i, &val);
+	assert(status == ICS_NOT_FOUND);
+	icsmap_frozen_deinit(frozen);
+	icsmap_deinit(map);
+
+	// Frozen keys and values are packed at a fixed size, so maps whose keys or
+	// values vary in length cannot be frozen
+	icsmap_cfg owned_cfg = {
+		.valsize = sizeof(int),
+		.flags = ICSMAP_OWNED_KEYS
+	};
+	status = icsmap_init(&map, &owned_cfg);
+	assert(status == ICS_OK);
+	status = icsmap_freeze(map, &frozen);
+	assert(status == ICS_INVALID);
+	log("Freezing a map with owned keys: %s", ics_status_str(status));
+	icsmap_deinit(map);
+	return 0;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap_gen.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// icsmap_gen.h writes a whole map for one key and value type. This one maps
+// ints to doubles using the byte hash that comes with it.
+ICSMAP_DEFINE(score_map, int, double, ICSMAP_HASH_BYTES, ICSMAP_EQ_BYTES)
+
+// Hash and eq can be anything. This hash sends every key below 100 to the
+// same slot, which lets us see how the map deals with long probes.
+#define CLASH_HASH(k) ((uint32_t)(*(k) / 100))
+#define INT_EQ(a, b) (*(a) == *(b))
+ICSMAP_DEFINE(clash_map, int, int, CLASH_HASH, INT_EQ)
+
+// adds up the values, to check foreach visits each exactly once
+static void
+sum_scores(const int *key, double *val, void *data)
+{
+	(void)key;
+	*(double *)data += *val;
+}
+
+int main() {
+	score_map scores;
+	ics_status status = score_map_init(&scores);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+
+	// the functions take keys and values by value, no pointers needed
+	int i;
+	for (i = 0; i < 1000; ++i) {
+		status = score_map_put(&scores, i, i / 2.0);
+		assert(status == ICS_OK);
+	}
+	assert(score_map_count(&scores) == 1000);
+
+	// putting an existing key overwrites it, find points straight at the value
+	status = score_map_put(&scores, 10, 99.5);
+	assert(status == ICS_OK && score_map_count(&scores) == 1000);
+	double *score = score_map_find(&scores, 10);
+	assert(score != NULL && *score == 99.5);
+	*score = 7.25;
+	double out;
+	status = score_map_get(&scores, 10, &out);
+	assert(status == ICS_OK && out == 7.25);
+
+	// removed keys are gone until they are put back
+	for (i = 0; i < 1000; i += 2) {
+		status = score_map_remove(&scores, i);
+		assert(status == ICS_OK);
+	}
+	status = score_map_remove(&scores, 0);
+	assert(status == ICS_NOT_FOUND);
+	status = score_map_contains(&scores, 4);
+	assert(status == ICS_NOT_FOUND);
+	status = score_map_put(&scores, 4, 1.5);
+	assert(status == ICS_OK);
+	status = score_map_get(&scores, 4, &out);
+	assert(status == ICS_OK && out == 1.5);
+	assert(score_map_count(&scores) == 501);
+
+	double sum = 0, expected = 1.5;
+	for (i = 1; i < 1000; i += 2) {
+		expected += i / 2.0;
+	}
+	score_map_foreach(&scores, sum_scores, &sum);
+	assert(sum == expected);
+	log("%u scores adding up to %.1f", score_map_count(&scores), sum);
+	score_map_deinit(&scores);
+
+	// a deinit'd map is empty and can be used again
+	status = score_map_contains(&scores, 4);
+	assert(status == ICS_NOT_FOUND && score_map_count(&scores) == 0);
+	status = score_map_put(&scores, 4, 2.0);
+	assert(status == ICS_OK && score_map_count(&scores) == 1);
+	score_map_deinit(&scores);
+
+	// Removes leave tombstones, which a later put reuses. In a chain of keys
+	// sharing a home slot, a put has to look past the tombstone though: the
+	// key may already sit further along, and must not end up in there twice.
+	clash_map clash;
+	status = clash_map_init(&clash);
+	assert(status == ICS_OK);
+	for (i = 1; i <= 3; ++i) {
+		status = clash_map_put(&clash, i, i);
+		assert(status == ICS_OK);
+	}
+	status = clash_map_remove(&clash, 1);
+	assert(status == ICS_OK && clash.tombstones == 1);
+
+	// 3 sits past the tombstone, so this is an update and the tombstone stays
+	status = clash_map_put(&clash, 3, 30);
+	assert(status == ICS_OK && clash.size == 2 && clash.tombstones == 1);
+	status = clash_map_remove(&clash, 3);
+	assert(status == ICS_OK);
+	status = clash_map_contains(&clash, 3);
+	assert(status == ICS_NOT_FOUND);
+
+	// a new key takes the first tombstone on its way
+	status = clash_map_put(&clash, 4, 4);
+	assert(status == ICS_OK && clash.size == 2 && clash.tombstones == 1);
+	int val;
+	status = clash_map_get(&clash, 4, &val);
+	assert(status == ICS_OK && val == 4);
+	status = clash_map_get(&clash, 2, &val);
+	assert(status == ICS_OK && val == 2);
+
+	// churning through many keys keeps tombstones from piling up
+	for (i = 5; i < 5000; ++i) {
+		status = clash_map_put(&clash, i, i);
+		assert(status == ICS_OK);
+		status = clash_map_remove(&clash, i - 1);
+		assert(status == ICS_OK);
+	}
+	assert(clash.tombstones * 100 / clash.capacity <= ICSMAP_GEN_LOAD_FACTOR);
+	status = clash_map_get(&clash, 4999, &val);
+	assert(status == ICS_OK && val == 4999);
+	log("after churning, %u keys and %u tombstones in %u slots",
+		clash.size, clash.tombstones, clash.capacity);
+	clash_map_deinit(&clash);
+	return 0;
+}
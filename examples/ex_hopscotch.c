@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// runs the default hash for 8 byte keys backwards, like ex_seeded_hash.c
+static uint64_t
+unmix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0x9cb4b2f8129337dbULL;
+	x ^= x >> 33;
+	x *= 0x4f74430c22a54005ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+// the i'th key whose hash under the default hash is target
+static uint64_t
+colliding_key(uint32_t i, uint32_t target)
+{
+	uint64_t mixed = (uint64_t)(i + 1) << 32 | ((i + 1) ^ target);
+	return unmix64(mixed);
+}
+
+int main() {
+	// A hopscotch table keeps every key within 32 slots of its home slot, so
+	// a lookup compares a handful of keys sitting next to each other.
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(uint64_t),
+		.valsize = sizeof(uint32_t),
+		.get_key = NULL,
+		.engine = ICSMAP_HOPSCOTCH
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	uint64_t key;
+	uint32_t i, val;
+	for (i = 0; i < 100000; ++i) {
+		key = (uint64_t)i * 7919;
+		status = icsmap_put(map, &key, &i);
+		assert(status == ICS_OK);
+	}
+	for (i = 0; i < 100000; i += 2) {
+		key = (uint64_t)i * 7919;
+		status = icsmap_remove(map, &key);
+		assert(status == ICS_OK);
+	}
+	for (i = 0; i < 100000; ++i) {
+		key = (uint64_t)i * 7919;
+		status = icsmap_get(map, &key, &val);
+		assert(i % 2 ? status == ICS_OK && val == i : status == ICS_NOT_FOUND);
+	}
+	icsmap_statistics stats;
+	icsmap_stats(map, &stats);
+	log("%u keys, lookups compare at most %u keys", stats.count, stats.max_hit_probe);
+	assert(stats.count == 50000);
+	assert(stats.max_hit_probe <= 32);
+	icsmap_deinit(map);
+
+	// Keys with the same hash have the same home slot at every table size,
+	// and only 32 of them fit in its neighbourhood. The 33rd put fails
+	// instead of growing the table until memory runs out.
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	for (i = 0; i < 100; ++i) {
+		key = colliding_key(i, 0xdecafbad);
+		status = icsmap_put(map, &key, &i);
+		if (status != ICS_OK) {
+			break;
+		}
+	}
+	log("%u keys sharing a hash fit, the next one got %s", i, ics_status_str(status));
+	assert(status == ICS_FAILURE);
+	assert(i == 32);
+	icsmap_stats(map, &stats);
+	assert(stats.count == 32);
+	assert(stats.capacity < 1024);
+	for (i = 0; i < 32; ++i) {
+		key = colliding_key(i, 0xdecafbad);
+		status = icsmap_get(map, &key, &val);
+		assert(status == ICS_OK && val == i);
+	}
+	// the failed key is not in the map, and other keys still go in
+	key = colliding_key(32, 0xdecafbad);
+	status = icsmap_contains(map, &key);
+	assert(status == ICS_NOT_FOUND);
+	key = 12345;
+	status = icsmap_put(map, &key, &i);
+	assert(status == ICS_OK);
+	icsmap_deinit(map);
+
+	// under a seeded hash the same keys are as good as random
+	cfg.flags = ICSMAP_SEEDED_HASH;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	for (i = 0; i < 2000; ++i) {
+		key = colliding_key(i, 0xdecafbad);
+		status = icsmap_put(map, &key, &i);
+		assert(status == ICS_OK);
+	}
+	icsmap_stats(map, &stats);
+	assert(stats.count == 2000);
+	icsmap_deinit(map);
+	return 0;
+}
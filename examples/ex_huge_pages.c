@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// keeps count of the bytes the map holds from us
+void *
+count_alloc(uint64_t size, void *ctx)
+{
+	*(uint64_t *)ctx += size;
+	return malloc(size);
+}
+
+void
+count_free(void *ptr, uint64_t size, void *ctx)
+{
+	if (ptr != NULL) {
+		*(uint64_t *)ctx -= size;
+	}
+	free(ptr);
+}
+
+// fills a map with enough keys for its table to outgrow a 2MB huge page,
+// checks they all read back, and returns how many bytes the map takes up
+static uint64_t
+fill(icsmap_cfg *cfg)
+{
+	icsmap_handle map;
+	ics_status status = icsmap_init(&map, cfg);
+	assert(status == ICS_OK);
+	int i, val;
+	for (i = 0; i < 100000; ++i) {
+		status = icsmap_put(map, &i, &i);
+		assert(status == ICS_OK);
+	}
+	for (i = 0; i < 100000; ++i) {
+		status = icsmap_get(map, &i, &val);
+		assert(status == ICS_OK && val == i);
+	}
+	for (i = 0; i < 100000; i += 2) {
+		status = icsmap_remove(map, &i);
+		assert(status == ICS_OK);
+	}
+	icsmap_statistics stats;
+	icsmap_stats(map, &stats);
+	assert(stats.count == 50000);
+	icsmap_deinit(map);
+	return stats.bytes;
+}
+
+int main() {
+	// A big table probed at random misses the TLB on nearly every lookup.
+	// ICSMAP_HUGE_PAGES asks for the table to be backed by 2MB pages once it is
+	// that big, and a NUMA policy says which nodes its pages go on. Both are
+	// hints: where the system says no, the map works the same, just without
+	// them.
+	uint64_t held = 0;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL,
+		.flags = ICSMAP_HUGE_PAGES,
+		.allocator = {
+			.alloc = count_alloc,
+			.free = count_free,
+			.ctx = &held
+		}
+	};
+	uint64_t bytes = fill(&cfg);
+	assert(held == 0);
+	log("with huge pages the map took %llu bytes", (unsigned long long)bytes);
+
+	// spread over node 0, which every machine has, so this works anywhere
+	cfg.flags = 0;
+	cfg.numa_policy = ICSMAP_NUMA_INTERLEAVE;
+	cfg.numa_nodes = 1;
+	fill(&cfg);
+	assert(held == 0);
+	cfg.numa_policy = ICSMAP_NUMA_BIND;
+	cfg.flags = ICSMAP_HUGE_PAGES;
+	fill(&cfg);
+	assert(held == 0);
+
+	// a policy needs nodes to apply to, and has to be one we know
+	icsmap_handle map;
+	cfg.numa_nodes = 0;
+	ics_status status = icsmap_init(&map, &cfg);
+	assert(status == ICS_INVALID);
+	cfg.numa_nodes = 1;
+	cfg.numa_policy = ICSMAP_NUMA_INTERLEAVE + 1;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_INVALID);
+
+	// Large tables are mapped straight from the system rather than coming out
+	// of the allocator. Small maps never reach that size, and the entries are
+	// always allocated one at a time, so the allocator still sees those.
+	cfg.numa_policy = ICSMAP_NUMA_DEFAULT;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	int i;
+	for (i = 0; i < 100000; ++i) {
+		status = icsmap_put(map, &i, &i);
+		assert(status == ICS_OK);
+	}
+	icsmap_statistics stats;
+	icsmap_stats(map, &stats);
+#ifdef __linux__
+	assert(held < stats.bytes);
+#endif
+	assert(held > 0);
+	log("%llu of its %llu bytes came from the allocator",
+		(unsigned long long)held, (unsigned long long)stats.bytes);
+	icsmap_deinit(map);
+	assert(held == 0);
+	return 0;
+}
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// puts n keys, then looks up those and n * 3 more which were never put, and
+// returns how many of the lookups came back wrong
+static uint32_t
+wrong_answers(uint32_t n, uint32_t flags)
+{
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(uint32_t),
+		.valsize = sizeof(uint32_t),
+		.get_key = NULL,
+		.flags = flags,
+		.seed = 0x5eed
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	uint32_t i, val, wrong = 0;
+	for (i = 0; i < n; ++i) {
+		uint32_t key = i * 2;
+		status = icsmap_put(map, &key, &i);
+		assert(status == ICS_OK);
+	}
+	wrong += icsmap_count(map) != n;
+	for (i = 0; i < n; ++i) {
+		uint32_t key = i * 2;
+		status = icsmap_get(map, &key, &val);
+		wrong += status != ICS_OK || val != i;
+	}
+	for (i = 0; i < n * 3; ++i) {
+		uint32_t key = i * 2 + 1;
+		status = icsmap_contains(map, &key);
+		wrong += status != ICS_NOT_FOUND;
+	}
+	icsmap_deinit(map);
+	return wrong;
+}
+
+int main() {
+	// 4 and 8 byte keys are hashed with a single integer mix. For 4 byte keys
+	// that mix is one to one, so two different keys never share a hash and a
+	// lookup which finds its hash has found its key, without reading the entry.
+	uint32_t wrong = wrong_answers(300000, 0);
+	assert(wrong == 0);
+
+	// With ICSMAP_SEEDED_HASH keys go through a keyed hash instead, and among
+	// this many keys a few are bound to share a 32 bit hash. Keys are then
+	// compared for real, so none of them overwrites another and no absent key
+	// is mistaken for one which shares its hash.
+	wrong = wrong_answers(300000, ICSMAP_SEEDED_HASH);
+	log("300000 keys with a seeded hash, %u wrong answers", wrong);
+	assert(wrong == 0);
+
+	// ICSMAP_INT_KEYS only asks for what the map would do anyway, and fails
+	// when the keys cannot be treated as integers
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = 3,
+		.valsize = 0,
+		.get_key = NULL,
+		.flags = ICSMAP_INT_KEYS
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	assert(status == ICS_INVALID);
+	cfg.keysize = sizeof(uint32_t);
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	icsmap_deinit(map);
+	return 0;
+}
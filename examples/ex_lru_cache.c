@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// records which keys were evicted, in order
+typedef struct evictions {
+	int keys[16];
+	int count;
+} evictions;
+
+void
+on_evict(const void *key, const void *val, void *data)
+{
+	evictions *ev = data;
+	ev->keys[ev->count++] = *(const int *)key;
+	log("evicted %d -> %d", *(const int *)key, *(const int *)val);
+}
+
+int main() {
+	// A map can double as a cache. Give it a limit and, once it is full,
+	// putting a new key first evicts whichever entry was used least recently.
+	evictions ev = {.count = 0};
+	icsmap_handle cache;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL,
+		.max_entries = 3,
+		.evict = on_evict,
+		.evict_data = &ev
+	};
+	ics_status status = icsmap_init(&cache, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+
+	int key, val;
+	for (key = 1; key <= 3; ++key) {
+		val = key * 10;
+		status = icsmap_put(cache, &key, &val);
+		assert(status == ICS_OK);
+	}
+	assert(icsmap_count(cache) == 3 && ev.count == 0);
+
+	// using 1 makes 2 the least recently used entry. icsmap_contains does not
+	// count as a use, so checking for 2 does not save it.
+	key = 1;
+	status = icsmap_get(cache, &key, &val);
+	assert(status == ICS_OK && val == 10);
+	key = 2;
+	status = icsmap_contains(cache, &key);
+	assert(status == ICS_EXISTS);
+
+	key = 4;
+	val = 40;
+	status = icsmap_put(cache, &key, &val);
+	assert(status == ICS_OK);
+	assert(ev.count == 1 && ev.keys[0] == 2);
+	assert(icsmap_count(cache) == 3);
+	key = 2;
+	status = icsmap_contains(cache, &key);
+	assert(status == ICS_NOT_FOUND);
+
+	// overwriting a key counts as a use too, so 3 is next to go after 1 is
+	// updated
+	key = 3;
+	val = 33;
+	status = icsmap_put(cache, &key, &val);
+	assert(status == ICS_OK);
+	key = 5;
+	val = 50;
+	status = icsmap_put(cache, &key, &val);
+	assert(status == ICS_OK);
+	assert(ev.count == 2 && ev.keys[1] == 1);
+
+	// an update never evicts anything, the map is not growing
+	key = 4;
+	val = 44;
+	status = icsmap_put(cache, &key, &val);
+	assert(status == ICS_OK && ev.count == 2);
+
+	// removing a key makes room without an eviction, and the callback is not
+	// called for it
+	key = 3;
+	status = icsmap_remove(cache, &key);
+	assert(status == ICS_OK);
+	key = 6;
+	val = 60;
+	status = icsmap_put(cache, &key, &val);
+	assert(status == ICS_OK && ev.count == 2 && icsmap_count(cache) == 3);
+	icsmap_deinit(cache);
+
+	// Limits can also be set in bytes, counting everything the entries take
+	// up. A cache that small only has room for a handful of entries, and it
+	// never goes over however many we put in.
+	ev.count = 0;
+	cfg.max_entries = 0;
+	cfg.max_bytes = 256;
+	cfg.evict = NULL;
+	status = icsmap_init(&cache, &cfg);
+	assert(status == ICS_OK);
+	for (key = 0; key < 1000; ++key) {
+		status = icsmap_put(cache, &key, &key);
+		assert(status == ICS_OK);
+	}
+	icsmap_statistics stats;
+	icsmap_stats(cache, &stats);
+	log("a 256 byte cache holds %u entries", stats.count);
+	assert(stats.count > 0 && stats.count < 1000);
+	// the most recent key is always kept
+	key = 999;
+	status = icsmap_get(cache, &key, &val);
+	assert(status == ICS_OK && val == 999);
+	key = 0;
+	status = icsmap_contains(cache, &key);
+	assert(status == ICS_NOT_FOUND);
+	icsmap_deinit(cache);
+	return 0;
+}
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// a clock we move by hand, like ex_ttl.c
+static uint64_t now = 1000;
+
+uint64_t
+fake_clock(void)
+{
+	return now;
+}
+
+// Adds src's count onto dst's. Values come straight out of the entries, right
+// after a 4 byte key here, so they are read and written with memcpy rather
+// than through a uint64_t pointer.
+void
+add_counts(const void *key, void *dst_val, const void *src_val, void *ctx)
+{
+	(void)key;
+	uint64_t a, b;
+	memcpy(&a, dst_val, sizeof(a));
+	memcpy(&b, src_val, sizeof(b));
+	a += b;
+	memcpy(dst_val, &a, sizeof(a));
+	(*(int *)ctx)++;
+}
+
+static uint64_t
+count_of(icsmap_handle map, int key)
+{
+	uint64_t count = 0;
+	ics_status status = icsmap_get(map, &key, &count);
+	assert(status == ICS_OK || status == ICS_NOT_FOUND);
+	return count;
+}
+
+// remembers the last key a cache evicted
+void
+last_evicted(const void *key, const void *val, void *data)
+{
+	(void)val;
+	*(int *)data = *(const int *)key;
+}
+
+// merges key 1 into a cache holding 1, 2 and 3, in that order, then puts a
+// fourth key and returns which key made room for it
+static int
+evicted_after_merge(icsmap_combine_fn combine)
+{
+	int evicted = 0, combined = 0;
+	icsmap_handle cache, src;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(uint64_t),
+		.get_key = NULL,
+		.max_entries = 3,
+		.evict = last_evicted,
+		.evict_data = &evicted
+	};
+	ics_status status = icsmap_init(&cache, &cfg);
+	assert(status == ICS_OK);
+	cfg.max_entries = 0;
+	status = icsmap_init(&src, &cfg);
+	assert(status == ICS_OK);
+	uint64_t one = 1;
+	int key;
+	for (key = 1; key <= 3; ++key) {
+		status = icsmap_put(cache, &key, &one);
+		assert(status == ICS_OK);
+	}
+	key = 1;
+	status = icsmap_put(src, &key, &one);
+	assert(status == ICS_OK);
+	status = icsmap_merge(cache, src, combine, &combined);
+	assert(status == ICS_OK);
+	key = 4;
+	status = icsmap_put(cache, &key, &one);
+	assert(status == ICS_OK);
+	assert(icsmap_count(cache) == 3);
+	icsmap_deinit(src);
+	icsmap_deinit(cache);
+	return evicted;
+}
+
+// counts up key % 1000 for every key in [from, to)
+static void
+tally(icsmap_handle map, int from, int to)
+{
+	int i;
+	for (i = from; i < to; ++i) {
+		int key = i % 1000;
+		uint64_t count = count_of(map, key) + 1;
+		ics_status status = icsmap_put(map, &key, &count);
+		assert(status == ICS_OK);
+	}
+}
+
+int main() {
+	// Two workers each count what they saw in a map of their own, and the
+	// results are merged at the end. Keys both saw go through combine.
+	icsmap_handle a, b;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(uint64_t),
+		.get_key = NULL
+	};
+	ics_status status = icsmap_init(&a, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	status = icsmap_init(&b, &cfg);
+	assert(status == ICS_OK);
+	tally(a, 0, 5000);      // keys 0 to 999, 5 times each
+	tally(b, 500, 2000);    // keys 500 to 999 twice, the rest once
+	int combined = 0;
+	status = icsmap_merge(a, b, add_counts, &combined);
+	assert(status == ICS_OK);
+	assert(combined == 1000);
+	assert(icsmap_count(a) == 1000 && icsmap_count(b) == 1000);
+	int i;
+	for (i = 0; i < 1000; ++i) {
+		assert(count_of(a, i) == (i < 500 ? 6 : 7));
+	}
+	// src is left as it was
+	assert(count_of(b, 0) == 1 && count_of(b, 999) == 2);
+
+	// without combine, src's value simply wins
+	icsmap_handle c;
+	status = icsmap_init(&c, &cfg);
+	assert(status == ICS_OK);
+	tally(c, 990, 1010);
+	status = icsmap_merge(c, b, NULL, NULL);
+	assert(status == ICS_OK);
+	assert(icsmap_count(c) == 1000 && count_of(c, 995) == 2 && count_of(c, 5) == 1);
+	icsmap_deinit(c);
+
+	// The same merge split into shards, one dst per shard, as threads would
+	// run it. Every key lands in exactly one shard.
+	enum { SHARDS = 4 };
+	icsmap_handle shards[SHARDS];
+	uint32_t shard, total = 0;
+	for (shard = 0; shard < SHARDS; ++shard) {
+		status = icsmap_init(&shards[shard], &cfg);
+		assert(status == ICS_OK);
+		status = icsmap_merge_shard(shards[shard], a, shard, SHARDS, add_counts, &combined);
+		assert(status == ICS_OK);
+		status = icsmap_merge_shard(shards[shard], b, shard, SHARDS, add_counts, &combined);
+		assert(status == ICS_OK);
+		total += icsmap_count(shards[shard]);
+	}
+	assert(total == 1000);
+	for (i = 0; i < 1000; ++i) {
+		shard = icsmap_shard(a, &i, SHARDS);
+		assert(count_of(shards[shard], i) == count_of(a, i) + count_of(b, i));
+	}
+	log("1000 keys merged over %d shards", SHARDS);
+	for (shard = 0; shard < SHARDS; ++shard) {
+		icsmap_deinit(shards[shard]);
+	}
+
+	// maps have to agree on the shape of their entries, and a shard has to be
+	// one of the nshards
+	status = icsmap_merge_shard(a, b, SHARDS, SHARDS, NULL, NULL);
+	assert(status == ICS_INVALID);
+	status = icsmap_merge_shard(a, b, 0, 0, NULL, NULL);
+	assert(status == ICS_INVALID);
+	status = icsmap_merge(a, a, NULL, NULL);
+	assert(status == ICS_INVALID);
+	icsmap_cfg other = cfg;
+	other.keysize = sizeof(uint64_t);
+	status = icsmap_init(&c, &other);
+	assert(status == ICS_OK);
+	status = icsmap_merge(a, c, NULL, NULL);
+	assert(status == ICS_INVALID);
+	icsmap_deinit(c);
+	other = cfg;
+	other.valsize = sizeof(int);
+	status = icsmap_init(&c, &other);
+	assert(status == ICS_OK);
+	status = icsmap_merge(c, a, NULL, NULL);
+	assert(status == ICS_INVALID);
+	icsmap_deinit(c);
+	other = cfg;
+	other.flags = ICSMAP_VAR_VALS;
+	status = icsmap_init(&c, &other);
+	assert(status == ICS_OK);
+	status = icsmap_merge(a, c, NULL, NULL);
+	assert(status == ICS_INVALID);
+	icsmap_deinit(c);
+	other = cfg;
+	other.flags = ICSMAP_MULTI;
+	status = icsmap_init(&c, &other);
+	assert(status == ICS_OK);
+	status = icsmap_merge(c, a, NULL, NULL);
+	assert(status == ICS_INVALID);
+	icsmap_deinit(c);
+	icsmap_deinit(a);
+	icsmap_deinit(b);
+
+	// Merging into a cache counts as using the keys it updates, whether
+	// combine resolves them or src's value replaces dst's, so key 1 outlives
+	// key 2 either way
+	int evicted = evicted_after_merge(add_counts);
+	assert(evicted == 2);
+	evicted = evicted_after_merge(NULL);
+	assert(evicted == 2);
+
+	// With ttl maps, expired entries count as absent on both sides: one
+	// expired in dst is replaced by src's value rather than combined with it,
+	// and one expired in src is not merged at all. Expiries come along.
+	cfg.flags = ICSMAP_TTL;
+	cfg.clock = fake_clock;
+	status = icsmap_init(&a, &cfg);
+	assert(status == ICS_OK);
+	status = icsmap_init(&b, &cfg);
+	assert(status == ICS_OK);
+	uint64_t five = 5, seven = 7;
+	int key = 1;
+	status = icsmap_put_ttl(a, &key, &five, 10);
+	assert(status == ICS_OK);
+	key = 2;
+	status = icsmap_put(a, &key, &five);
+	assert(status == ICS_OK);
+	for (key = 1; key <= 4; ++key) {
+		uint64_t ttl = key == 3 ? 10 : key == 4 ? 100 : 0;
+		status = icsmap_put_ttl(b, &key, &seven, ttl);
+		assert(status == ICS_OK);
+	}
+	now += 20;
+	combined = 0;
+	status = icsmap_merge(a, b, add_counts, &combined);
+	assert(status == ICS_OK);
+	assert(combined == 1);
+	assert(count_of(a, 1) == 7);
+	assert(count_of(a, 2) == 12);
+	key = 3;
+	status = icsmap_contains(a, &key);
+	assert(status == ICS_NOT_FOUND);
+	assert(count_of(a, 4) == 7);
+	now += 100;
+	key = 4;
+	status = icsmap_contains(a, &key);
+	assert(status == ICS_NOT_FOUND);
+	assert(count_of(a, 1) == 7 && count_of(a, 2) == 12);
+	icsmap_deinit(a);
+	icsmap_deinit(b);
+	return 0;
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// counts the key/value pairs foreach visits
+void
+count_pairs(const void *key, const void *val, void *data)
+{
+	(void)key;
+	(void)val;
+	(*(int *)data)++;
+}
+
+int main() {
+	// ICSMAP_MULTI lets a key hold any number of values. Say we index the
+	// positions each letter shows up at in a sentence.
+	icsmap_handle index;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(char),
+		.valsize = sizeof(int),
+		.get_key = NULL,
+		.flags = ICSMAP_MULTI
+	};
+	ics_status status = icsmap_init(&index, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	const char *text = "the quick brown fox jumps over the lazy dog, then the fox eats";
+	int pos;
+	for (pos = 0; text[pos] != '\0'; ++pos) {
+		status = icsmap_add(index, &text[pos], &pos);
+		assert(status == ICS_OK);
+	}
+	assert(icsmap_value_count(index) == (uint64_t)pos);
+
+	// a cursor walks a key's values in the order they were added
+	char key = 'e';
+	icsmap_cursor cursor;
+	status = icsmap_get_all(index, &key, &cursor);
+	assert(status == ICS_OK);
+	const int *at;
+	int last = -1, count = 0;
+	printf("'e' is at");
+	while ((at = icsmap_cursor_next(&cursor)) != NULL) {
+		printf(" %d", *at);
+		assert(text[*at] == 'e' && *at > last);
+		last = *at;
+		count++;
+	}
+	printf("\n");
+	assert(count == 6);
+
+	// icsmap_get returns the first value
+	int first;
+	status = icsmap_get(index, &key, &first);
+	assert(status == ICS_OK && first == 2);
+
+	// spaces have more values than fit inline in the entry, they still come
+	// back in order
+	key = ' ';
+	status = icsmap_get_all(index, &key, &cursor);
+	assert(status == ICS_OK && cursor.count == 12);
+	last = -1;
+	while ((at = icsmap_cursor_next(&cursor)) != NULL) {
+		assert(text[*at] == ' ' && *at > last);
+		last = *at;
+	}
+
+	// remove_one drops a single value, and the key goes with its last one
+	key = 'q';
+	int where = 4;
+	status = icsmap_remove_one(index, &key, &where);
+	assert(status == ICS_OK);
+	status = icsmap_contains(index, &key);
+	assert(status == ICS_NOT_FOUND);
+	key = 'h';
+	where = 0;
+	status = icsmap_remove_one(index, &key, &where);
+	assert(status == ICS_NOT_FOUND);
+	where = 1;
+	status = icsmap_remove_one(index, &key, &where);
+	assert(status == ICS_OK);
+	status = icsmap_get(index, &key, &first);
+	assert(status == ICS_OK && first == 32);
+
+	// put replaces every value of the key with the one given
+	key = 'o';
+	where = 0;
+	status = icsmap_put(index, &key, &where);
+	assert(status == ICS_OK);
+	status = icsmap_get_all(index, &key, &cursor);
+	assert(status == ICS_OK && cursor.count == 1);
+
+	// foreach visits every key/value pair, not just every key
+	int pairs = 0;
+	icsmap_foreach(index, count_pairs, &pairs);
+	assert((uint64_t)pairs == icsmap_value_count(index));
+	assert(icsmap_count(index) < icsmap_value_count(index));
+	log("%u characters, %d positions", icsmap_count(index), pairs);
+	icsmap_deinit(index);
+
+	// the multimap calls do not work on plain maps
+	cfg.flags = 0;
+	status = icsmap_init(&index, &cfg);
+	assert(status == ICS_OK);
+	status = icsmap_add(index, &key, &where);
+	assert(status == ICS_INVALID);
+	status = icsmap_get_all(index, &key, &cursor);
+	assert(status == ICS_INVALID);
+	icsmap_deinit(index);
+	return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// a key made of a pointer and a length, like the name struct in
+// ex_struct_keys.c. The bytes need not be NUL terminated.
+typedef struct slice {
+	const char *bytes;
+	uint32_t len;
+} slice;
+
+const void *
+slice_key(const void *icsmap_key, uint32_t *size)
+{
+	const slice *s = icsmap_key;
+	*size = s->len;
+	return s->bytes;
+}
+
+// adds up the lengths of the keys, which the map hands over NUL terminated
+void
+sum_lengths(const void *key, const void *val, void *data)
+{
+	(void)val;
+	*(size_t *)data += strlen(key);
+}
+
+int main() {
+	// ex_struct_keys.c showed ICSMAP_OWNED_KEYS storing a copy of string keys.
+	// Here we make sure of what that buys us: the map never looks at our key
+	// memory again once the put returns.
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.valsize = sizeof(int),
+		.get_key = NULL,
+		.flags = ICSMAP_OWNED_KEYS
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+
+	// put keys from a buffer we keep overwriting, of every length up to 40
+	char buf[64];
+	int i, val;
+	size_t total = 0;
+	for (i = 0; i < 40; ++i) {
+		memset(buf, 'a' + i % 26, i + 1);
+		buf[i + 1] = '\0';
+		total += i + 1;
+		val = i;
+		status = icsmap_put(map, buf, &val);
+		assert(status == ICS_OK);
+	}
+	memset(buf, 0, sizeof(buf));
+	assert(icsmap_count(map) == 40);
+
+	// the same strings from fresh memory find their values
+	for (i = 0; i < 40; ++i) {
+		memset(buf, 'a' + i % 26, i + 1);
+		buf[i + 1] = '\0';
+		status = icsmap_get(map, buf, &val);
+		assert(status == ICS_OK && val == i);
+	}
+
+	// keys the map hands back point at its own NUL terminated copies, and
+	// icsmap_all gives out one pointer per key
+	size_t seen = 0;
+	icsmap_foreach(map, sum_lengths, &seen);
+	assert(seen == total);
+	const void *keys[40];
+	int vals[40];
+	icsmap_all(map, keys, vals);
+	for (i = 0; i < 40; ++i) {
+		assert(strlen(keys[i]) == (size_t)vals[i] + 1);
+	}
+
+	// removed keys are gone and can be put back
+	status = icsmap_remove(map, "ccc");
+	assert(status == ICS_OK);
+	status = icsmap_contains(map, "ccc");
+	assert(status == ICS_NOT_FOUND);
+	val = 99;
+	status = icsmap_put(map, "ccc", &val);
+	assert(status == ICS_OK);
+	status = icsmap_get(map, "ccc", &val);
+	assert(status == ICS_OK && val == 99);
+	icsmap_deinit(map);
+
+	// With a get_key, the key bytes come from wherever it points. Two slices
+	// over different memory holding the same bytes are the same key, and the
+	// map owns a copy of those bytes rather than of the slice.
+	cfg.get_key = slice_key;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	char *line = malloc(32);
+	memcpy(line, "GET /index.html HTTP/1.1", 25);
+	slice method = {.bytes = line, .len = 3};
+	slice path = {.bytes = line + 4, .len = 11};
+	val = 1;
+	status = icsmap_put(map, &method, &val);
+	assert(status == ICS_OK);
+	val = 2;
+	status = icsmap_put(map, &path, &val);
+	assert(status == ICS_OK);
+	free(line);
+
+	slice lookup = {.bytes = "/index.html", .len = 11};
+	status = icsmap_get(map, &lookup, &val);
+	assert(status == ICS_OK && val == 2);
+	lookup.bytes = "GETTING";
+	lookup.len = 3;
+	status = icsmap_get(map, &lookup, &val);
+	assert(status == ICS_OK && val == 1);
+	log("found the request method and path after freeing the request line");
+	icsmap_deinit(map);
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+/*
+ * The default hash is fast, but it is no secret. 8 byte keys are hashed by
+ * mixing them with the murmur3 finalizer and folding the halves together, so
+ * anyone can run that backwards and pick keys which all hash the same.
+ */
+static uint64_t
+unmix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0x9cb4b2f8129337dbULL;
+	x ^= x >> 33;
+	x *= 0x4f74430c22a54005ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+// the i'th key whose hash under the default hash is target
+static uint64_t
+colliding_key(uint32_t i, uint32_t target)
+{
+	uint64_t mixed = (uint64_t)(i + 1) << 32 | ((i + 1) ^ target);
+	return unmix64(mixed);
+}
+
+// puts n colliding keys into a map with the given flags, and returns the
+// longest probe a lookup of one of them took
+static uint32_t
+flood(uint32_t n, uint32_t flags, uint64_t seed)
+{
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(uint64_t),
+		.valsize = sizeof(uint32_t),
+		.get_key = NULL,
+		.flags = flags,
+		.seed = seed
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	uint32_t i, val;
+	for (i = 0; i < n; ++i) {
+		uint64_t key = colliding_key(i, 0xdecafbad);
+		status = icsmap_put(map, &key, &i);
+		assert(status == ICS_OK);
+	}
+	for (i = 0; i < n; ++i) {
+		uint64_t key = colliding_key(i, 0xdecafbad);
+		status = icsmap_get(map, &key, &val);
+		assert(status == ICS_OK && val == i);
+	}
+	icsmap_statistics stats;
+	icsmap_stats(map, &stats);
+	icsmap_deinit(map);
+	return stats.max_hit_probe;
+}
+
+// records the order foreach visits keys in
+typedef struct visit_order {
+	uint64_t keys[64];
+	uint32_t count;
+} visit_order;
+
+void
+record(const void *key, const void *val, void *data)
+{
+	(void)val;
+	visit_order *order = data;
+	order->keys[order->count++] = *(const uint64_t *)key;
+}
+
+static void
+order_with_seed(uint64_t seed, visit_order *order)
+{
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(uint64_t),
+		.valsize = 0,
+		.get_key = NULL,
+		.flags = ICSMAP_SEEDED_HASH,
+		.seed = seed
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	uint64_t key;
+	for (key = 0; key < 64; ++key) {
+		status = icsmap_insert(map, &key);
+		assert(status == ICS_OK);
+	}
+	order->count = 0;
+	icsmap_foreach(map, record, order);
+	assert(order->count == 64);
+	icsmap_deinit(map);
+}
+
+int main() {
+	// 2000 keys picked to collide pile up in one long cluster, and finding
+	// the last one means walking past all of the others.
+	uint32_t plain = flood(2000, 0, 0);
+	log("2000 colliding keys: lookups probe up to %u slots", plain);
+	assert(plain >= 1000);
+
+	// Hashed with a secret seed, the same keys are as good as random. An
+	// attacker would need the seed to pick keys that collide.
+	uint32_t seeded = flood(2000, ICSMAP_SEEDED_HASH, 0);
+	log("with ICSMAP_SEEDED_HASH: up to %u slots", seeded);
+	assert(seeded < 32);
+
+	// The seed is random unless fixed in the config. A fixed seed gives the
+	// same layout on every run, which makes tests reproducible.
+	visit_order a, b;
+	order_with_seed(1234, &a);
+	order_with_seed(1234, &b);
+	uint32_t i, differ = 0;
+	for (i = 0; i < 64; ++i) {
+		assert(a.keys[i] == b.keys[i]);
+	}
+	order_with_seed(5678, &b);
+	for (i = 0; i < 64; ++i) {
+		differ += a.keys[i] != b.keys[i];
+	}
+	assert(differ > 0);
+	return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// fills a set with every multiple of step below limit
+static icsmap_handle
+multiples(int step, int limit)
+{
+	icsmap_handle set;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = 0,
+		.get_key = NULL
+	};
+	if (icsmap_init(&set, &cfg) != ICS_OK) {
+		return NULL;
+	}
+	int i;
+	for (i = 0; i < limit; i += step) {
+		if (icsmap_insert(set, &i) != ICS_OK) {
+			icsmap_deinit(set);
+			return NULL;
+		}
+	}
+	return set;
+}
+
+int main() {
+	// A map with a valsize of 0 is a set: it only stores keys. icsmap_insert
+	// tells us whether a key is new, which makes removing duplicates easy.
+	icsmap_handle seen;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(char),
+		.valsize = 0,
+		.get_key = NULL
+	};
+	ics_status status = icsmap_init(&seen, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init set: %s", ics_status_str(status));
+		return 2;
+	}
+	const char *text = "mississippi";
+	char unique[16];
+	int pos, n = 0;
+	for (pos = 0; text[pos] != '\0'; ++pos) {
+		status = icsmap_insert(seen, &text[pos]);
+		if (status == ICS_OK) {
+			unique[n++] = text[pos];
+		} else {
+			assert(status == ICS_EXISTS);
+		}
+	}
+	unique[n] = '\0';
+	log("the letters of %s are %s", text, unique);
+	assert(n == 4 && icsmap_count(seen) == 4);
+	icsmap_deinit(seen);
+
+	// Sets can be combined into new ones
+	icsmap_handle twos = multiples(2, 30), threes = multiples(3, 30);
+	icsmap_handle both, either, only_twos;
+	if (twos == NULL || threes == NULL) {
+		log("Could not build sets");
+		return 2;
+	}
+	status = icsmap_intersect(twos, threes, &both);
+	assert(status == ICS_OK);
+	status = icsmap_union(twos, threes, &either);
+	assert(status == ICS_OK);
+	status = icsmap_difference(twos, threes, &only_twos);
+	assert(status == ICS_OK);
+
+	// 0, 6, 12, 18 and 24 are in both, 15 twos plus 10 threes less those 5
+	// are in either, and the other 10 twos are only in twos
+	assert(icsmap_count(both) == 5);
+	assert(icsmap_count(either) == 20);
+	assert(icsmap_count(only_twos) == 10);
+	int i;
+	for (i = 0; i < 30; ++i) {
+		ics_status in_both = icsmap_contains(both, &i);
+		ics_status in_either = icsmap_contains(either, &i);
+		ics_status in_only_twos = icsmap_contains(only_twos, &i);
+		assert((in_both == ICS_EXISTS) == (i % 6 == 0));
+		assert((in_either == ICS_EXISTS) == (i % 2 == 0 || i % 3 == 0));
+		assert((in_only_twos == ICS_EXISTS) == (i % 2 == 0 && i % 3 != 0));
+	}
+	log("%u numbers below 30 are multiples of 2 and 3, %u of 2 or 3",
+		icsmap_count(both), icsmap_count(either));
+	icsmap_deinit(both);
+	icsmap_deinit(either);
+	icsmap_deinit(only_twos);
+
+	// only sets of the same kind of key can be combined, and only sets: maps
+	// with values do not take icsmap_insert either
+	icsmap_handle map;
+	icsmap_cfg map_cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL
+	};
+	status = icsmap_init(&map, &map_cfg);
+	assert(status == ICS_OK);
+	status = icsmap_union(twos, map, &either);
+	assert(status == ICS_INVALID);
+	status = icsmap_insert(map, &i);
+	assert(status == ICS_INVALID);
+	icsmap_deinit(map);
+
+	icsmap_deinit(twos);
+	icsmap_deinit(threes);
+	return 0;
+}
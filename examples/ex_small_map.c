@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// counts the allocations a map makes and the bytes it holds
+typedef struct counter {
+	uint32_t allocs;
+	uint64_t held;
+} counter;
+
+void *
+count_alloc(uint64_t size, void *ctx)
+{
+	counter *c = ctx;
+	c->allocs++;
+	c->held += size;
+	return malloc(size);
+}
+
+void
+count_free(void *ptr, uint64_t size, void *ctx)
+{
+	counter *c = ctx;
+	if (ptr != NULL) {
+		c->held -= size;
+	}
+	free(ptr);
+}
+
+// records the keys foreach visits, in order
+typedef struct visits {
+	int keys[16];
+	int count;
+} visits;
+
+void
+record(const void *key, const void *val, void *data)
+{
+	(void)val;
+	visits *v = data;
+	v->keys[v->count++] = *(const int *)key;
+}
+
+int main() {
+	// Most maps in a program hold a handful of entries. Up to 8 of them live
+	// in the same allocation as the map itself, so a map that stays small
+	// costs one allocation however it is used.
+	counter c = {0};
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL,
+		.allocator = {
+			.alloc = count_alloc,
+			.free = count_free,
+			.ctx = &c
+		}
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	int i, val;
+	int order[8] = {50, 3, 77, 12, 9, 61, 28, 40};
+	for (i = 0; i < 8; ++i) {
+		status = icsmap_put(map, &order[i], &i);
+		assert(status == ICS_OK);
+	}
+	// removing and putting again reuses the room
+	status = icsmap_remove(map, &order[2]);
+	assert(status == ICS_OK);
+	status = icsmap_put(map, &order[2], &i);
+	assert(status == ICS_OK);
+	for (i = 0; i < 8; ++i) {
+		status = icsmap_get(map, &order[i], &val);
+		assert(status == ICS_OK && val == (i == 2 ? 8 : i));
+	}
+	i = 100;
+	status = icsmap_contains(map, &i);
+	assert(status == ICS_NOT_FOUND);
+	log("8 entries took %u allocation", c.allocs);
+	assert(c.allocs == 1);
+
+	// while small, iteration is in insertion order, and a key put back after
+	// a remove counts as new
+	visits v = {{0}};
+	icsmap_foreach(map, record, &v);
+	assert(v.count == 8);
+	int expect[8] = {50, 3, 12, 9, 61, 28, 40, 77};
+	for (i = 0; i < 8; ++i) {
+		assert(v.keys[i] == expect[i]);
+	}
+
+	// the 9th entry moves the map to a real table, and everything in it
+	// carries over
+	for (i = 0; i < 1000; ++i) {
+		int key = 1000 + i;
+		status = icsmap_put(map, &key, &i);
+		assert(status == ICS_OK);
+	}
+	assert(c.allocs > 1);
+	assert(icsmap_count(map) == 1008);
+	for (i = 0; i < 8; ++i) {
+		status = icsmap_get(map, &order[i], &val);
+		assert(status == ICS_OK && val == (i == 2 ? 8 : i));
+	}
+	for (i = 0; i < 1000; ++i) {
+		int key = 1000 + i;
+		status = icsmap_get(map, &key, &val);
+		assert(status == ICS_OK && val == i);
+	}
+	icsmap_deinit(map);
+	assert(c.held == 0);
+
+	// every engine starts out small the same way
+	uint32_t engine;
+	for (engine = ICSMAP_LINEAR; engine <= ICSMAP_HOPSCOTCH; ++engine) {
+		cfg.engine = engine;
+		c.allocs = 0;
+		status = icsmap_init(&map, &cfg);
+		assert(status == ICS_OK);
+		for (i = 0; i < 8; ++i) {
+			status = icsmap_put(map, &i, &i);
+			assert(status == ICS_OK);
+		}
+		assert(c.allocs == 1);
+		for (i = 8; i < 100; ++i) {
+			status = icsmap_put(map, &i, &i);
+			assert(status == ICS_OK);
+		}
+		for (i = 0; i < 100; ++i) {
+			status = icsmap_get(map, &i, &val);
+			assert(status == ICS_OK && val == i);
+		}
+		icsmap_deinit(map);
+		assert(c.held == 0);
+	}
+	return 0;
+}
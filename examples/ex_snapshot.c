@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+#define N 100000
+
+// what a reader makes of a snapshot
+typedef struct report {
+	icsmap_snapshot_handle snap;
+	uint32_t count;
+	uint32_t seen;
+	uint64_t key_sum;
+	uint64_t val_sum;
+	ics_status status;
+} report;
+
+void
+tally(const void *key, const void *val, void *data)
+{
+	report *r = data;
+	r->seen++;
+	r->key_sum += *(const int *)key;
+	r->val_sum += *(const int *)val;
+}
+
+void *
+reader(void *arg)
+{
+	report *r = arg;
+	r->count = icsmap_snapshot_count(r->snap);
+	r->status = icsmap_snapshot_foreach(r->snap, tally, r);
+	return NULL;
+}
+
+int main() {
+	// A snapshot is a read-only view of the map as it was when taken. Taking
+	// one copies nothing, and it can be read on another thread while the map
+	// carries on being written to.
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	int i;
+	uint64_t sum = 0;
+	for (i = 0; i < N; ++i) {
+		status = icsmap_put(map, &i, &i);
+		assert(status == ICS_OK);
+		sum += i;
+	}
+	report before = {0};
+	status = icsmap_snapshot(map, &before.snap);
+	assert(status == ICS_OK);
+
+	// a report runs off the snapshot while every value is updated, half the
+	// keys removed and as many new ones put, enough to grow the table
+	pthread_t thread;
+	int rc = pthread_create(&thread, NULL, reader, &before);
+	assert(rc == 0);
+	int val = 1;
+	for (i = 0; i < N; ++i) {
+		status = icsmap_put(map, &i, &val);
+		assert(status == ICS_OK);
+	}
+	for (i = 0; i < N; i += 2) {
+		status = icsmap_remove(map, &i);
+		assert(status == ICS_OK);
+	}
+	for (i = N; i < 2 * N; ++i) {
+		status = icsmap_put(map, &i, &val);
+		assert(status == ICS_OK);
+	}
+	rc = pthread_join(thread, NULL);
+	assert(rc == 0);
+
+	// the reader saw the map exactly as it was, none of the writes
+	log("the snapshot held %u keys and the reader saw %u", before.count, before.seen);
+	assert(before.status == ICS_OK);
+	assert(before.count == N && before.seen == N);
+	assert(before.key_sum == sum && before.val_sum == sum);
+
+	// and it keeps seeing the same after the writers are done
+	before.seen = 0;
+	before.key_sum = before.val_sum = 0;
+	status = icsmap_snapshot_foreach(before.snap, tally, &before);
+	assert(status == ICS_OK);
+	assert(before.seen == N && before.key_sum == sum && before.val_sum == sum);
+
+	// a new snapshot sees the map as it is now
+	report after = {0};
+	status = icsmap_snapshot(map, &after.snap);
+	assert(status == ICS_OK);
+	reader(&after);
+	assert(after.status == ICS_OK);
+	assert(after.count == N + N / 2 && after.seen == N + N / 2);
+	assert(after.val_sum == N + N / 2);
+	// the live map is unaffected by either snapshot
+	status = icsmap_get(map, &i, &val);
+	assert(status == ICS_NOT_FOUND);
+	i = 1;
+	status = icsmap_get(map, &i, &val);
+	assert(status == ICS_OK && val == 1);
+
+	// snapshots are released before the map
+	icsmap_snapshot_release(before.snap);
+	icsmap_snapshot_release(after.snap);
+	icsmap_deinit(map);
+
+	// entries that live outside the table cannot be snapshotted
+	cfg.flags = ICSMAP_MULTI;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	icsmap_snapshot_handle snap;
+	status = icsmap_snapshot(map, &snap);
+	assert(status == ICS_INVALID);
+	icsmap_deinit(map);
+	return 0;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// records the keys visited, in order
+typedef struct visits {
+	uint64_t keys[10000];
+	int vals[10000];
+	int count;
+} visits;
+
+void
+record(const void *key, const void *val, void *data)
+{
+	visits *v = data;
+	memcpy(&v->keys[v->count], key, sizeof(uint64_t));
+	memcpy(&v->vals[v->count], val, sizeof(int));
+	v->count++;
+}
+
+// a fixed size name, ordered like strcmp
+typedef struct name {
+	char text[12];
+} name;
+
+int
+cmp_names(const void *a, const void *b)
+{
+	return strncmp(a, b, sizeof(name));
+}
+
+void
+record_name(const void *key, const void *val, void *data)
+{
+	(void)val;
+	name *out = data;
+	while (out->text[0] != '\0') {
+		out++;
+	}
+	memcpy(out, key, sizeof(name));
+}
+
+int main() {
+	// icsmap_sorted_iter visits keys in order without copying them out and
+	// sorting them. Integer keys need no comparator at all.
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(uint64_t),
+		.valsize = sizeof(int),
+		.get_key = NULL
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	int i;
+	for (i = 0; i < 10000; ++i) {
+		uint64_t key = ((uint64_t)i * 2654435761u) % 1000003;
+		status = icsmap_put(map, &key, &i);
+		assert(status == ICS_OK);
+	}
+	static visits v;
+	status = icsmap_sorted_iter(map, NULL, record, &v);
+	assert(status == ICS_OK && v.count == 10000);
+	for (i = 1; i < v.count; ++i) {
+		assert(v.keys[i - 1] < v.keys[i]);
+	}
+
+	// icsmap_range visits the keys from lo to hi, both included
+	uint64_t lo = 250000, hi = 500000;
+	v.count = 0;
+	status = icsmap_range(map, NULL, &lo, &hi, record, &v);
+	assert(status == ICS_OK);
+	int in_range = v.count;
+	for (i = 0; i < v.count; ++i) {
+		assert(v.keys[i] >= lo && v.keys[i] <= hi);
+		assert(i == 0 || v.keys[i - 1] < v.keys[i]);
+	}
+	log("%d of 10000 keys lie from %llu to %llu", in_range,
+		(unsigned long long)lo, (unsigned long long)hi);
+	assert(in_range > 2000 && in_range < 3000);
+	// a NULL end leaves that side open
+	v.count = 0;
+	status = icsmap_range(map, NULL, NULL, &lo, record, &v);
+	assert(status == ICS_OK);
+	int below = v.count;
+	v.count = 0;
+	status = icsmap_range(map, NULL, &lo, NULL, record, &v);
+	assert(status == ICS_OK);
+	// lo is counted on both sides if it is a key
+	status = icsmap_contains(map, &lo);
+	assert(below + v.count == 10000 + (status == ICS_OK));
+
+	// The order is kept until the map changes. A put or remove afterwards
+	// shows up in the next ordered scan.
+	// The first key put was 0. Its new value, a new largest key and a key
+	// removed from the middle all show up.
+	uint64_t first = 0, last = 2000000, gone = v.keys[0];
+	int val = -1;
+	status = icsmap_put(map, &first, &val);
+	assert(status == ICS_OK);
+	status = icsmap_put(map, &last, &val);
+	assert(status == ICS_OK);
+	status = icsmap_remove(map, &gone);
+	assert(status == ICS_OK);
+	v.count = 0;
+	status = icsmap_sorted_iter(map, NULL, record, &v);
+	assert(status == ICS_OK && v.count == 10000);
+	assert(v.keys[0] == first && v.vals[0] == -1 && v.keys[9999] == last);
+	for (i = 1; i < v.count; ++i) {
+		assert(v.keys[i - 1] < v.keys[i] && v.keys[i] != gone);
+	}
+	icsmap_deinit(map);
+
+	// a 12 byte name is no integer, so it needs a comparator
+	cfg.keysize = sizeof(name);
+	cfg.valsize = 0;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	const char *words[] = {"pear", "apple", "fig", "plum", "kiwi", "date"};
+	for (i = 0; i < 6; ++i) {
+		name n = {{0}};
+		strncpy(n.text, words[i], sizeof(n.text));
+		status = icsmap_insert(map, &n);
+		assert(status == ICS_OK);
+	}
+	name sorted[7] = {{{0}}};
+	status = icsmap_sorted_iter(map, NULL, record_name, sorted);
+	assert(status == ICS_INVALID);
+	status = icsmap_sorted_iter(map, cmp_names, record_name, sorted);
+	assert(status == ICS_OK);
+	assert(strcmp(sorted[0].text, "apple") == 0 && strcmp(sorted[5].text, "plum") == 0);
+	name from = {"d"}, to = {"kiwi"};
+	memset(sorted, 0, sizeof(sorted));
+	status = icsmap_range(map, cmp_names, &from, &to, record_name, sorted);
+	assert(status == ICS_OK);
+	assert(strcmp(sorted[0].text, "date") == 0 && strcmp(sorted[1].text, "fig") == 0 &&
+		strcmp(sorted[2].text, "kiwi") == 0 && sorted[3].text[0] == '\0');
+	log("from d to kiwi: %s %s %s", sorted[0].text, sorted[1].text, sorted[2].text);
+	icsmap_deinit(map);
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+int main() {
+	// icsmap_stats reports how a map is doing: how full it is, how far lookups
+	// had to probe, how much memory it takes. Handy to export as metrics.
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	icsmap_statistics stats;
+	icsmap_stats(map, &stats);
+	assert(stats.count == 0 && stats.hits == 0 && stats.misses == 0);
+	uint64_t empty_bytes = stats.bytes;
+
+	int i, val;
+	for (i = 0; i < 1000; ++i) {
+		status = icsmap_put(map, &i, &i);
+		assert(status == ICS_OK);
+	}
+	// 1000 lookups which hit and 500 which miss
+	for (i = 0; i < 1500; ++i) {
+		status = icsmap_get(map, &i, &val);
+		assert(status == (i < 1000 ? ICS_OK : ICS_NOT_FOUND));
+	}
+	icsmap_stats(map, &stats);
+	log("%u entries in %u slots after %u resizes, taking %llu bytes",
+		stats.count, stats.capacity, stats.resizes, (unsigned long long)stats.bytes);
+	log("hits probe %.2f slots on average, %u at most", stats.avg_hit_probe, stats.max_hit_probe);
+	log("misses probe %.2f slots on average, %u at most", stats.avg_miss_probe, stats.max_miss_probe);
+	assert(stats.count == 1000 && stats.capacity >= 1000);
+	assert(stats.hits == 1000 && stats.misses == 500);
+	assert(stats.avg_hit_probe >= 1 && stats.max_hit_probe >= stats.avg_hit_probe);
+	assert(stats.resizes > 0 && stats.bytes > empty_bytes);
+	// plain icsmap_stats leaves the scan fields alone
+	assert(stats.max_cluster == 0 && stats.scan_max_hit_probe == 0);
+
+	// removing keys leaves tombstones behind in the default engine
+	for (i = 0; i < 100; ++i) {
+		status = icsmap_remove(map, &i);
+		assert(status == ICS_OK);
+	}
+	icsmap_stats(map, &stats);
+	assert(stats.count == 900 && stats.tombstones == 100);
+
+	// icsmap_stats_scan walks the table to work out the probe lengths every
+	// key would see right now, and how the slots cluster together
+	icsmap_stats_scan(map, &stats);
+	log("a scan finds clusters up to %u slots and hit probes up to %u",
+		stats.max_cluster, stats.scan_max_hit_probe);
+	assert(stats.scan_avg_hit_probe >= 1 && stats.scan_max_hit_probe >= 1);
+	assert(stats.scan_avg_miss_probe >= 1 && stats.max_cluster > 0);
+	uint32_t b, clusters = 0;
+	for (b = 0; b < ICSMAP_STATS_BUCKETS; ++b) {
+		clusters += stats.clusters[b];
+	}
+	assert(clusters > 0);
+	// the counters gathered by lookups come along too. Removes look their
+	// keys up first, so they count as 100 more hits.
+	assert(stats.hits == 1100 && stats.misses == 500);
+	icsmap_deinit(map);
+	return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// a key which lives somewhere else, found through get_key like in
+// ex_struct_keys.c
+typedef struct name {
+	char text[16];
+} name;
+
+static uint64_t get_key_calls;
+
+const void *
+name_key(const void *icsmap_key, uint32_t *size)
+{
+	const name *const *n = icsmap_key;
+	get_key_calls++;
+	*size = strlen((*n)->text);
+	return (*n)->text;
+}
+
+int main() {
+	// icsmap keeps the full hash of every key next to its slot. Growing the
+	// table moves entries by their stored hash without looking at a single
+	// key, and a lookup only compares keys whose hash matches. That matters
+	// most when getting at a key is expensive, here a call through get_key
+	// and a pointer into memory the map knows nothing about.
+	enum { N = 50000 };
+	name *names = malloc(N * sizeof(name));
+	int i;
+	for (i = 0; i < N; ++i) {
+		snprintf(names[i].text, sizeof(names[i].text), "user%d", i);
+	}
+
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(name *),
+		.valsize = sizeof(int),
+		.get_key = name_key
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+	for (i = 0; i < N; ++i) {
+		name *key = &names[i];
+		status = icsmap_put(map, &key, &i);
+		assert(status == ICS_OK);
+	}
+	icsmap_statistics stats;
+	icsmap_stats(map, &stats);
+	// every put looks at its own key once. The table grew many times along
+	// the way, and not one of those rehashes went back to the keys. Only the
+	// odd key with the same 32 bit hash as another gets compared to it.
+	log("%d puts with %u resizes called get_key %llu times",
+		N, stats.resizes, (unsigned long long)get_key_calls);
+	assert(stats.resizes >= 10);
+	assert(get_key_calls >= N && get_key_calls < N + N / 100);
+
+	// a miss looks at nothing but the key being searched for, however many
+	// slots it probes
+	name missing[1000];
+	get_key_calls = 0;
+	for (i = 0; i < 1000; ++i) {
+		name *key = &missing[i];
+		snprintf(missing[i].text, sizeof(missing[i].text), "guest%d", i);
+		status = icsmap_contains(map, &key);
+		assert(status == ICS_NOT_FOUND);
+	}
+	assert(get_key_calls < 1000 + 10);
+
+	// and a hit compares the one key it finds
+	get_key_calls = 0;
+	for (i = 0; i < 1000; ++i) {
+		name copy = names[i];
+		name *key = &copy;
+		int val;
+		status = icsmap_get(map, &key, &val);
+		assert(status == ICS_OK && val == i);
+	}
+	assert(get_key_calls < 2 * 1000 + 10);
+
+	icsmap_deinit(map);
+	free(names);
+	return 0;
+}
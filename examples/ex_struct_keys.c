@@ -115,6 +115,46 @@ int main() {
 
 	free(name1);
 	free(name2);
+	icsmap_deinit(map);
+
+	// There is a catch with the approach above. The map only stores the name
+	// struct, so the bytes "Brian" still live in memory we allocated. We had
+	// to keep name1 alive for as long as the key was in the map, and every
+	// lookup reads through the pointer into our memory.
+	//
+	// If we set the ICSMAP_OWNED_KEYS flag, icsmap copies the key bytes into
+	// memory it owns instead. keysize does not matter anymore, and since we
+	// don't supply a get_key, keys are plain NUL terminated strings.
+	icsmap_cfg owned_cfg = {
+		.valsize = sizeof(int),
+		.get_key = NULL,
+		.flags = ICSMAP_OWNED_KEYS
+	};
+	status = icsmap_init(&map, &owned_cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+
+	char *temporary = malloc(sizeof(char) * 6);
+	memcpy(temporary, "ics53", 6);
+	val = 53;
+	status = icsmap_put(map, temporary, &val);
+	if (status != ICS_OK) {
+		log("Could not insert into map");
+		return 2;
+	}
+	// the map has its own copy, so we are free to get rid of ours
+	free(temporary);
+
+	val = 0;
+	status = icsmap_get(map, "ics53", &val);
+	if (status != ICS_OK) {
+		log("Could not retrieve value: %s", ics_status_str(status));
+		return 2;
+	}
+	log("Retrieved the value from an owned key: %d", val);
+
 	icsmap_deinit(map);
 	return 0;
 }
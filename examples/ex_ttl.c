@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// a clock we move by hand, so the example does not have to sleep
+static uint64_t now = 1000;
+
+uint64_t
+fake_clock(void)
+{
+	return now;
+}
+
+void
+count_expired(const void *key, const void *val, void *data)
+{
+	(void)key;
+	(void)val;
+	(*(int *)data)++;
+}
+
+int main() {
+	// With ICSMAP_TTL, entries can be given a time to live. Once it is up the
+	// entry is gone as far as lookups are concerned. By default time is in
+	// seconds from a monotonic clock, here we supply our own.
+	int expired = 0;
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.valsize = sizeof(int),
+		.get_key = NULL,
+		.flags = ICSMAP_TTL,
+		.clock = fake_clock,
+		.evict = count_expired,
+		.evict_data = &expired
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+
+	// a session which lives for 30 ticks, one for 300 and one which plain
+	// icsmap_put stores without an expiry at all
+	int key = 1, val = 100;
+	status = icsmap_put_ttl(map, &key, &val, 30);
+	assert(status == ICS_OK);
+	key = 2;
+	status = icsmap_put_ttl(map, &key, &val, 300);
+	assert(status == ICS_OK);
+	key = 3;
+	status = icsmap_put(map, &key, &val);
+	assert(status == ICS_OK);
+
+	now += 29;
+	key = 1;
+	status = icsmap_get(map, &key, &val);
+	assert(status == ICS_OK);
+
+	// one tick later the first session is gone, even though nothing has
+	// reclaimed it yet
+	now += 1;
+	status = icsmap_get(map, &key, &val);
+	assert(status == ICS_NOT_FOUND);
+	status = icsmap_contains(map, &key);
+	assert(status == ICS_NOT_FOUND);
+
+	// putting a key again gives it a fresh ttl
+	key = 2;
+	status = icsmap_put_ttl(map, &key, &val, 1000);
+	assert(status == ICS_OK);
+	now += 500;
+	status = icsmap_contains(map, &key);
+	assert(status == ICS_EXISTS);
+
+	// icsmap_expire reclaims whatever expired by the given time, calling the
+	// evict callback for each. The first session was already reclaimed along
+	// the way by the other calls, and the entry which never expires stays.
+	for (key = 10; key < 20; ++key) {
+		status = icsmap_put_ttl(map, &key, &val, 5);
+		assert(status == ICS_OK);
+	}
+	now += 10;
+	uint32_t reclaimed = icsmap_expire(map, now, 4);
+	assert(reclaimed == 4);
+	reclaimed += icsmap_expire(map, now, 100);
+	assert(reclaimed == 10);
+	log("reclaimed %u expired entries, the evict callback saw %d", reclaimed, expired);
+	assert(expired == 11 && icsmap_count(map) == 2);
+	key = 3;
+	status = icsmap_contains(map, &key);
+	assert(status == ICS_EXISTS);
+	icsmap_deinit(map);
+
+	// maps created without ICSMAP_TTL do not take a ttl
+	cfg.flags = 0;
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	status = icsmap_put_ttl(map, &key, &val, 10);
+	assert(status == ICS_INVALID);
+	icsmap_deinit(map);
+	return 0;
+}
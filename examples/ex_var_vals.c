@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "icsmap.h"
+
+#define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
+
+// adds up the value lengths, which foreach hands over as icsmap_blobs
+void
+sum_lengths(const void *key, const void *val, void *data)
+{
+	(void)key;
+	*(uint32_t *)data += ((const icsmap_blob *)val)->len;
+}
+
+int main() {
+	// With ICSMAP_VAR_VALS each value can have a length of its own. The bytes
+	// are stored inside the entry, so there is no pointer to chase and nothing
+	// for us to free.
+	icsmap_handle map;
+	icsmap_cfg cfg = {
+		.keysize = sizeof(int),
+		.get_key = NULL,
+		.flags = ICSMAP_VAR_VALS
+	};
+	ics_status status = icsmap_init(&map, &cfg);
+	if (status != ICS_OK) {
+		log("Could not init map: %s", ics_status_str(status));
+		return 2;
+	}
+
+	// key i holds i copies of the letter 'a' + i % 26
+	char buf[256];
+	int i;
+	uint32_t total = 0;
+	for (i = 0; i < 200; ++i) {
+		memset(buf, 'a' + i % 26, i);
+		total += i;
+		status = icsmap_put_var(map, &i, buf, i);
+		assert(status == ICS_OK);
+	}
+
+	// icsmap_get_var points right into the map instead of copying out
+	const void *val;
+	uint32_t len;
+	for (i = 0; i < 200; ++i) {
+		status = icsmap_get_var(map, &i, &val, &len);
+		assert(status == ICS_OK && len == (uint32_t)i);
+		memset(buf, 'a' + i % 26, i);
+		assert(memcmp(val, buf, len) == 0);
+	}
+
+	// a value can grow or shrink, and the new one replaces the old entirely
+	i = 3;
+	const char *longer = "a value much longer than the three bytes it replaces";
+	status = icsmap_put_var(map, &i, longer, strlen(longer) + 1);
+	assert(status == ICS_OK);
+	status = icsmap_get_var(map, &i, &val, &len);
+	assert(status == ICS_OK && len == strlen(longer) + 1);
+	log("key 3 now holds \"%s\"", (const char *)val);
+	total += len - 3;
+
+	i = 150;
+	status = icsmap_put_var(map, &i, "x", 1);
+	assert(status == ICS_OK);
+	status = icsmap_get_var(map, &i, &val, &len);
+	assert(status == ICS_OK && len == 1 && *(const char *)val == 'x');
+	total -= 149;
+
+	// an empty value is still a value
+	i = 7;
+	status = icsmap_put_var(map, &i, NULL, 0);
+	assert(status == ICS_OK);
+	status = icsmap_get_var(map, &i, &val, &len);
+	assert(status == ICS_OK && len == 0);
+	total -= 7;
+
+	uint32_t seen = 0;
+	icsmap_foreach(map, sum_lengths, &seen);
+	assert(seen == total);
+
+	// the fixed size calls do not apply to these maps
+	int out;
+	status = icsmap_get(map, &i, &out);
+	assert(status == ICS_INVALID);
+	status = icsmap_put(map, &i, &out);
+	assert(status == ICS_INVALID);
+	i = 1000;
+	status = icsmap_get_var(map, &i, &val, &len);
+	assert(status == ICS_NOT_FOUND);
+	icsmap_deinit(map);
+
+	// and the other way around
+	cfg.flags = 0;
+	cfg.valsize = sizeof(int);
+	status = icsmap_init(&map, &cfg);
+	assert(status == ICS_OK);
+	status = icsmap_put_var(map, &i, "abc", 3);
+	assert(status == ICS_INVALID);
+	icsmap_deinit(map);
+	return 0;
+}
@@ -1,9 +1,19 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "icsmap.h"
 
+// debug logging, compiled in with -DICS_DEBUG
+#ifdef ICS_DEBUG
 #define log(fmt, ...) (printf(fmt "\n", ##__VA_ARGS__))
 
 #define printkey(k) (printf("Key: %p, ", (*((char **)k)) ))
@@ -17,17 +27,53 @@
 
 #define logval(v, fmt, ...) \
 	printval(v); log(" " fmt, ##__VA_ARGS__);
+#else
+#define log(fmt, ...) ((void)0)
+#define logentry(m, e, fmt, ...) ((void)0)
+#define logkey(k, fmt, ...) ((void)0)
+#define logval(v, fmt, ...) ((void)0)
+#endif
 
 typedef uint8_t *map_entry;  // map entry is just a byte array composed of two halves
 typedef uint8_t *map_key;    // map key is the first half of the byte array
 typedef uint8_t *map_val;    // map val is the second half of the byte array
 
-// size th map is initially created with
-#define INITIAL_SIZE 13
-
 // percentage the map needs to be filled to before triggering a resize
 #define LOAD_FACTOR  33
 
+// with a keyed hash at this load factor, an insert probing further than this
+// is all but impossible by chance. Seeded maps take it as a sign of a crafted
+// key set and move to a new seed.
+#define HASH_FLOOD_PROBE 64
+
+// the cuckoo engine's table is buckets of CUCKOO_WAYS slots followed by a
+// stash of CUCKOO_STASH slots for keys no displacement path could be found for
+#define CUCKOO_WAYS 4
+#define CUCKOO_STASH 4
+#define CUCKOO_LOAD_FACTOR 90
+// how many slots an insert's breadth first search may visit
+#define CUCKOO_MAX_SEARCH 256
+
+// how many times the cuckoo or hopscotch engine grows the table to find room
+// for a single key. Past that, or while the table is less than half way to
+// its load factor, the trouble is too many keys sharing a hash, not size.
+#define ENGINE_MAX_GROWS 2
+
+// the hopscotch engine keeps every key within HOP_RANGE slots of its home
+// slot, one bit per slot of the home slot's neighbourhood bitmap
+#define HOP_RANGE 32
+#define HOP_LOAD_FACTOR 90
+// how far an insert looks for an empty slot to bring into the neighbourhood
+#define HOP_MAX_SEARCH 1024
+
+// every map starts out small: a dense array of this many slots, searched by
+// comparing all of their hashes at once, and room for as many entries, all in
+// the same allocation as the map itself. At most 32, the size of pool_free.
+#define SMALL_CAPACITY 8
+
+// number of slots a snapshot copies at a time when the map writes to them
+#define SNAP_CHUNK 512
+
 static const map_entry tombstone = (map_entry)0xffffffff;
 
 typedef enum ics_bool {
@@ -35,18 +81,222 @@ typedef enum ics_bool {
 	true = 1
 } ics_bool;
 
+/*
+ * In cache mode every entry starts with an lru_link, threading all entries
+ * into a recency list. The head is the most recently used entry and the tail
+ * is the next one to be evicted.
+ */
+typedef struct lru_link {
+	map_entry prev;     // more recently used neighbour
+	map_entry next;     // less recently used neighbour
+} lru_link;
+
+/*
+ * In ttl mode every entry has a ttl_link after the lru_link (if any). Entries
+ * with an expiry are threaded into one of the timer wheel's slot lists.
+ */
+typedef struct ttl_link {
+	map_entry prev;     // previous entry in the same wheel slot
+	map_entry next;     // next entry in the same wheel slot
+	uint64_t expires;   // clock time the entry expires at, or 0 if never
+	uint32_t slot;      // wheel slot the entry is linked into, level * WHEEL_SLOTS + slot
+} ttl_link;
+
+// the timer wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots. A slot at level
+// l covers WHEEL_SLOTS^l ticks, so the wheel spans WHEEL_SLOTS^WHEEL_LEVELS ticks.
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN   ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+// how many expired entries each map operation reclaims on the side
+#define TTL_OP_BUDGET 4
+
+typedef struct timer_wheel {
+	uint64_t now;       // next tick to process
+	ics_bool cascaded;  // whether the higher levels were cascaded for now yet
+	uint32_t count;     // number of entries in the wheel
+	uint64_t occupied[WHEEL_LEVELS];  // bitmap of non-empty slots per level
+	map_entry slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} timer_wheel;
+
+/*
+ * With ICSMAP_OWNED_KEYS the key part of an entry is an owned_key record. The
+ * bytes themselves live in the map's key arena, NUL terminated, and the full
+ * hash is kept so an entry can be found again without rehashing its bytes.
+ */
+typedef struct owned_key {
+	uint32_t hash;      // full hash of the key bytes
+	uint32_t len;       // number of key bytes, not counting the terminator
+	uint8_t *bytes;     // the key bytes, in the key arena
+} owned_key;
+
+/*
+ * With ICSMAP_VAR_VALS the value part of an entry is a var_val header followed
+ * by cap bytes of inline storage, len of which hold the value. The entry is
+ * grown with realloc when a bigger value is stored.
+ */
+typedef struct var_val {
+	uint32_t len;       // bytes of the value in use
+	uint32_t cap;       // bytes of inline storage after the header
+} var_val;
+
+/*
+ * With ICSMAP_MULTI the value part of an entry is a multi_vals header followed
+ * by room for a few values inline. Once a key has more values than fit inline
+ * they all move to a growable spill chunk, so a key's values are always
+ * contiguous.
+ */
+typedef struct multi_vals {
+	uint32_t count;     // number of values stored for the key
+	uint32_t cap;       // number of values the spill chunk has room for
+	uint8_t *spill;     // the values once they outgrow the inline space, or NULL
+} multi_vals;
+
+// bytes of inline space for the values of a key in a multimap
+#define MULTI_INLINE_BYTES 32
+
+// size of each chunk the key arena hands out space from
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct arena_chunk {
+	struct arena_chunk *next;
+	uint64_t size;      // bytes available in data
+	uint64_t used;      // bytes handed out from data
+	uint8_t data[];
+} arena_chunk;
+
+// a bump allocator. Freed space is only reclaimed when the arena is compacted.
+typedef struct key_arena {
+	arena_chunk *head;  // chunk currently being allocated from
+	uint64_t live;      // bytes handed out and not released yet
+	uint64_t total;     // bytes handed out over the arena's lifetime
+} key_arena;
+
+// memory a snapshot might still be reading, freed once it is released
+typedef struct retired {
+	void *ptr;          // an entry, or a table if capacity is not 0
+	uint32_t capacity;  // number of slots in the table
+	uint64_t seq;       // latest snapshot when it was retired
+} retired;
+
+/*
+ * A key as the probing code sees it: the bytes to compare, after get_key has
+ * been applied, along with their full hash.
+ */
+typedef struct key_ref {
+	const uint8_t *bytes;
+	uint32_t len;
+	uint32_t hash;
+} key_ref;
+
 typedef struct icsmap {
 	uint32_t size;      // number of elements in the map
 	uint32_t capacity;  // size of the underlying array
+	uint32_t tombstones;// number of deleted slots in the underlying array
 
 	uint32_t keysize;   // size of the key
 	uint32_t valsize;   // size of the value
+	uint32_t valspace;  // size of the value part of an entry
+	uint32_t key_off;   // offset of the key inside an entry, after any headers
+	uint32_t val_off;   // offset of the value inside an entry
 
 	get_key_fn get_key; // how to retrieve key from given key or null to just use the given one
 
+	ics_bool lru;       // whether this map is in cache mode
+	uint32_t max_entries; // evict once the map holds this many entries, 0 for no limit
+	uint64_t max_bytes; // evict once entries take up this many bytes, 0 for no limit
+	uint64_t bytes;     // bytes currently taken up by entries
+	evict_fn evict;     // called on each entry evicted in cache mode
+	void *evict_data;   // passed through to evict
+	map_entry lru_head; // most recently used entry
+	map_entry lru_tail; // least recently used entry
+
+	ics_bool ttl;       // whether entries can expire
+	uint32_t ttl_off;   // offset of the ttl_link inside an entry
+	clock_fn clock;     // where the current time comes from in ttl mode
+	uint64_t ttl_now;   // time as of the start of the current operation
+	timer_wheel *wheel; // tracks entries with an expiry, NULL if not in ttl mode
+
+	ics_bool owned_keys;// whether key bytes are copied into the map
+	ics_bool int_keys;  // whether keys are 4 or 8 byte integers, see ICSMAP_INT_KEYS
+	key_arena arena;    // where owned key bytes live
+
+	ics_bool var_vals;  // whether values are variable length var_vals
+
+	ics_bool multi;     // whether each key holds a list of values
+	uint32_t multi_inline; // number of values which fit inline in an entry
+	uint64_t values;    // total number of values in a multimap
+
+	uint32_t resizes;   // number of times the table was rehashed
+	uint32_t max_hit_probe;  // longest probe of a lookup which found its key
+	uint32_t max_miss_probe; // longest probe of a lookup which did not
+	uint64_t hits;      // lookups which found their key
+	uint64_t misses;    // lookups which did not
+	uint64_t hit_probes;     // slots examined over all hits
+	uint64_t miss_probes;    // slots examined over all misses
+
+	icsmap_allocator alloc; // where all of the map's memory comes from
+	ics_bool huge_pages;     // whether large tables are backed by huge pages
+	uint32_t numa_policy;    // icsmap_numa_policy for large tables
+	uint64_t numa_nodes;     // nodes numa_policy applies to
+
+	uint32_t engine;    // icsmap_engine the table is laid out and probed with
+	uint32_t stashed;   // number of occupied cuckoo stash slots
+
+	ics_bool seeded;    // whether keys are hashed with siphash under seed
+	ics_bool fixed_seed;// whether the seed came from icsmap_cfg
+	uint64_t seed;      // current seed, the first half of the siphash key
+	uint64_t seed_hi;   // second half of the siphash key, derived from seed
+	uint32_t reseeds;   // number of times a probe was long enough to reseed
+
 	map_entry *arr;     // underlying array
+	uint32_t *hashes;   // full hash of the key in each slot, stored after arr
+	uint32_t *hops;     // hopscotch neighbourhood bitmap of each slot, after hashes
+
+	// in compact mode arr and hashes are dense and in insertion order, and
+	// index is the hash table, holding positions in arr
+	ics_bool compact;   // whether this map is in compact mode
+	uint32_t used;      // number of positions in arr taken, live or deleted
+	void *index;        // positions + 1, 0 if empty or index_deleted if deleted
+	uint32_t index_cap; // number of slots in index
+	uint32_t index_width; // bytes per index slot: 1, 2 or 4
+
+	// small maps keep arr dense and in insertion order like compact ones, but
+	// with no index. arr and the entry pool sit right after the map.
+	ics_bool small;     // whether arr is still the inline small array
+	uint32_t pool_free; // bitmap of unused entries in the inline pool
+
+	// entries sorted by order_cmp, kept until an entry is added or removed
+	map_entry *order;   // NULL until the first ordered scan
+	uint32_t order_cap; // number of entries order has room for
+	ics_bool order_valid; // whether order holds every entry, sorted
+	icsmap_cmp_fn order_cmp; // what order is sorted by, NULL for integer keys
+
+	// snapshots reading from the map, oldest first
+	struct icsmap_snapshot *snap_head;
+	struct icsmap_snapshot *snap_tail;
+	uint64_t snap_seq;  // sequence number of the latest snapshot
+	retired *retired;   // entries and tables removed while snapshots were taken
+	uint32_t retired_count;
+	uint32_t retired_cap;
 } icsmap;
 
+static void snapshot_save(icsmap *map, uint32_t index);
+static void entry_moved(icsmap *map, map_entry entry);
+
+// every write to a slot goes through here, so that snapshots still reading the
+// table get a copy of the slot's chunk first
+static inline void
+set_slot(icsmap *map, uint32_t index, map_entry entry)
+{
+	if (map->snap_head != NULL) {
+		snapshot_save(map, index);
+	}
+	__atomic_store_n(&map->arr[index], entry, __ATOMIC_RELAXED);
+}
+
 /** Begin general function definition */
 const char *
 ics_status_str(ics_status status)
@@ -152,29 +402,219 @@ hash_fn(const map_key key, uint32_t len, uint32_t *res)
 	*res = hash;
 }
 
-static void
-hash(const icsmap *map, const map_key key, uint32_t keysize, uint32_t *res)
+static inline uint32_t
+ics_mix32(uint32_t x)
+{
+	// murmur3 32 bit finalizer, every step is invertible so distinct inputs
+	// never share a result. key_matches counts on that to take a matching
+	// hash of unseeded 4 byte keys as a matching key, so any change here has
+	// to stay one to one.
+	x ^= x >> 16;
+	x *= 0x85ebca6bu;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35u;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline uint64_t
+ics_mix64(uint64_t x)
+{
+	// murmur3 finalizer, spreads every input bit over the whole word
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static uint64_t
+hash64_fn(const map_key key, uint32_t len, uint64_t seed)
+{
+	// seeded FNV-1a, used where we need a family of independent hashes
+	uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+	uint32_t i;
+	for (i = 0; i < len; ++i) {
+		hash ^= key[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return ics_mix64(hash ^ len);
+}
+
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(v0, v1, v2, v3) do {                              \
+	v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+	v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2;                        \
+	v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0;                        \
+	v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+} while (0)
+
+/*
+ * SipHash-1-3 keyed with (k0, k1). Without the key an attacker cannot pick
+ * keys which collide, which is what makes it safe for untrusted input.
+ */
+static uint64_t
+siphash13(const uint8_t *key, uint32_t len, uint64_t k0, uint64_t k1)
+{
+	uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+	uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+	uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+	uint64_t v3 = 0x7465646279746573ULL ^ k1;
+	uint64_t m;
+	uint32_t i, end = len & ~7u;
+	for (i = 0; i < end; i += 8) {
+		m = 0;
+		int b;
+		for (b = 7; b >= 0; --b) {
+			m = (m << 8) | key[i + b];
+		}
+		v3 ^= m;
+		SIP_ROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+	// the last block holds the remaining bytes and the length
+	m = (uint64_t)len << 56;
+	for (; i < len; ++i) {
+		m |= (uint64_t)key[i] << ((i & 7) * 8);
+	}
+	v3 ^= m;
+	SIP_ROUND(v0, v1, v2, v3);
+	v0 ^= m;
+	v2 ^= 0xff;
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// a seed no one outside the process can guess
+static uint64_t
+random_seed(void)
+{
+	uint64_t seed;
+#if defined(__linux__) && defined(SYS_getrandom)
+	if (syscall(SYS_getrandom, &seed, sizeof(seed), 0) == sizeof(seed)) {
+		return seed;
+	}
+#endif
+	// fall back on what differs between processes and between calls
+	static uint64_t calls = 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	seed = (uint64_t)ts.tv_sec << 32 ^ (uint64_t)ts.tv_nsec ^ (uintptr_t)&seed;
+	return ics_mix64(seed ^ ++calls * 0x9e3779b97f4a7c15ULL);
+}
+
+static inline void
+set_seed(icsmap *map, uint64_t seed)
 {
-	hash_fn(key, keysize, res);
-	*res %= map->capacity;
+	map->seed = seed;
+	map->seed_hi = ics_mix64(seed ^ 0x9e3779b97f4a7c15ULL);
 }
 
 static inline uint64_t
 entry_size(const icsmap *map)
 {
-	return map->keysize + map->valsize;
+	return map->val_off + map->valspace;
 }
 
 static inline map_key
 map_entry_key(const icsmap *map, const map_entry entry)
 {
-	return (map_key) entry;
+	return (map_key)(entry + map->key_off);
 }
 
 static inline map_val
 map_entry_val(const icsmap *map, const map_entry entry)
 {
-	return (map_val)(entry + map->keysize);
+	return (map_val)(entry + map->val_off);
+}
+
+static inline lru_link *
+map_entry_lru(const map_entry entry)
+{
+	return (lru_link *)entry;
+}
+
+static inline ttl_link *
+map_entry_ttl(const icsmap *map, const map_entry entry)
+{
+	return (ttl_link *)(entry + map->ttl_off);
+}
+
+static inline owned_key *
+map_entry_owned(const icsmap *map, const map_entry entry)
+{
+	return (owned_key *)(entry + map->key_off);
+}
+
+static inline var_val *
+map_entry_var(const icsmap *map, const map_entry entry)
+{
+	return (var_val *)(entry + map->val_off);
+}
+
+static inline uint8_t *
+var_val_bytes(var_val *vv)
+{
+	return (uint8_t *)(vv + 1);
+}
+
+static inline multi_vals *
+map_entry_multi(const icsmap *map, const map_entry entry)
+{
+	return (multi_vals *)(entry + map->val_off);
+}
+
+// where the values of a multimap entry currently live
+static inline uint8_t *
+multi_vals_bytes(multi_vals *mv)
+{
+	return mv->spill != NULL ? mv->spill : (uint8_t *)(mv + 1);
+}
+
+// the value as handed back to callers. For variable length values that is an
+// icsmap_blob describing it, which is filled in to the scratch space given.
+static inline const void *
+visible_val(const icsmap *map, const map_entry entry, icsmap_blob *scratch)
+{
+	if (map->var_vals) {
+		var_val *vv = map_entry_var(map, entry);
+		scratch->data = var_val_bytes(vv);
+		scratch->len = vv->len;
+		return scratch;
+	}
+	return map_entry_val(map, entry);
+}
+
+// the key as handed back to callers: the stored key, or the key bytes
+// themselves if the map owns them
+static inline const void *
+visible_key(const icsmap *map, const map_entry entry)
+{
+	if (map->owned_keys) {
+		return map_entry_owned(map, entry)->bytes;
+	}
+	return map_entry_key(map, entry);
+}
+
+// bytes an entry accounts for against max_bytes, including owned key bytes
+static inline uint64_t
+entry_bytes(const icsmap *map, const map_entry entry)
+{
+	uint64_t bytes = entry_size(map);
+	if (map->owned_keys) {
+		bytes += map_entry_owned(map, entry)->len + 1;
+	}
+	if (map->var_vals) {
+		bytes += map_entry_var(map, entry)->cap;
+	}
+	if (map->multi) {
+		bytes += (uint64_t)map_entry_multi(map, entry)->cap * map->valsize;
+	}
+	return bytes;
 }
 
 static inline ics_bool
@@ -192,6 +632,11 @@ is_empty(const map_entry entry)
 static const map_key
 get_key(const icsmap *map, const void *key, uint32_t *size)
 {
+	// owned keys without a get_key are NUL terminated strings
+	if (map->owned_keys && map->get_key == NULL) {
+		*size = strlen(key);
+		return (const map_key)key;
+	}
 	// if the user did not specify a way to get the key, use default
 	if (map->get_key == NULL) {
 		*size = map->keysize;
@@ -201,276 +646,3973 @@ get_key(const icsmap *map, const void *key, uint32_t *size)
 	return (const map_key)map->get_key(key, size);
 }
 
-static inline ics_bool
-is_overloaded(const icsmap *map)
+// reads a key of keysize bytes as a native unsigned integer
+static inline uint64_t
+int_key(const icsmap *map, const void *key)
 {
-	return ics_percent(map->size, map->capacity) > LOAD_FACTOR;
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+	switch (map->keysize) {
+	case 1:
+		ics_memcpy(&u8, key, 1);
+		return u8;
+	case 2:
+		ics_memcpy(&u16, key, 2);
+		return u16;
+	case 4:
+		ics_memcpy(&u32, key, 4);
+		return u32;
+	default:
+		ics_memcpy(&u64, key, 8);
+		return u64;
+	}
 }
 
-static ics_status
-find_key(const icsmap *map, const map_key key, uint32_t *index)
+static inline uint32_t
+key_hash(const icsmap *map, const uint8_t *bytes, uint32_t len)
 {
-	uint32_t keysize;
-	const map_key k = get_key(map, key, &keysize);
-	/*const char *ckey = (const char *)k;*/
-	/*log("Finding %s", ckey);*/
-
-	uint32_t hash_index;
-	hash(map, k, keysize, &hash_index);
-	logkey(k, "finding index of key from map starting at index %d", hash_index);
-	// we now have the starting point for the key search space
-	uint32_t candidate_size, i = hash_index;
-	while (!is_empty(map->arr[i])) {
-		const map_key candidate = get_key(map, map_entry_key(map, map->arr[i]), &candidate_size);
-		assert(candidate_size == keysize);
-		if (ics_equal(candidate, k, keysize)) {
-			*index = i;
-			return ICS_OK;
-		}       
-		i = (i + 1) % map->capacity;
-		if (i == hash_index) {
-			// we looped back to hash index, can quit
-			break;
+	if (map->seeded) {
+		uint64_t h = siphash13(bytes, len, map->seed, map->seed_hi);
+		return (uint32_t)(h ^ (h >> 32));
+	}
+	if (map->int_keys) {
+		// good in every bit, so this serves all of the engines
+		if (len == 4) {
+			return ics_mix32((uint32_t)int_key(map, bytes));
 		}
+		uint64_t h = ics_mix64(int_key(map, bytes));
+		return (uint32_t)(h ^ (h >> 32));
 	}
-	// if here then it means we did not find the key
-	return ICS_NOT_FOUND;
+	if (map->engine != ICSMAP_LINEAR) {
+		// the bucketed engines need every bit of the hash to be good, which
+		// the default hash is not for short keys
+		uint64_t h = hash64_fn((const map_key)bytes, len, 0);
+		return (uint32_t)(h ^ (h >> 32));
+	}
+	uint32_t res;
+	hash_fn((const map_key)bytes, len, &res);
+	return res;
 }
 
-static ics_status
-find_hole(const icsmap *map, const map_key key, uint32_t *index)
+// builds the key_ref for a key passed in through the api
+static inline void
+probe_key(const icsmap *map, const void *key, key_ref *ref)
 {
-	// find a starting position
-	uint32_t keysize;
-	const map_key k = get_key(map, key, &keysize);
-
-	uint32_t hash_index;
-	hash(map, k, keysize, &hash_index);
-	assert(hash_index < map->capacity);
-
-	// for each value in the hashmap starting at index and looping with mod:
-	//     if this value is empty, then we have found a hole. return index/OK
-	//     if this value is deleted, then we have found a hole. return index/OK
-	//     if this value is the same, then compare for equality with search key.
-	//         if same search key, then return index/ICS_EXISTS
-	//         if not same search key, then continue to next loop
-	uint32_t candidate_size, i = hash_index;
-
-	// while we have not found an empty hole
-	while (!is_empty(map->arr[i])) {
-		const map_key candidate = get_key(map, map_entry_key(map, map->arr[i]), &candidate_size);
-		assert(candidate_size == keysize);
-		// if this value has been deleted
-		if (is_deleted(map->arr[i])) {
-			*index = i;
-			return ICS_OK;
-		// else if this is the same key we are finding a hole for
-		} else if (ics_equal(candidate, k, keysize)) {
-			*index = i;
-			return ICS_EXISTS;
-		}
-		// else increment i and loop back to beginning of array at end
-		i = (i + 1) % map->capacity;
+	if (map->int_keys) {
+		ref->bytes = key;
+		ref->len = map->keysize;
+		ref->hash = key_hash(map, ref->bytes, ref->len);
+		return;
 	}
-	// if here it means we have found an empty spot. We are guarenteed not to
-	// infinite loop because we resize the array when there is not enough space
-	// return index/ok
-	*index = i;
-	return ICS_OK;
+	ref->bytes = get_key(map, key, &ref->len);
+	ref->hash = key_hash(map, ref->bytes, ref->len);
 }
 
-ics_status
-icsmap_init(icsmap_handle *handle, const icsmap_cfg *cfg)
+// whether two maps give every key the same hash
+static inline ics_bool
+same_hashing(const icsmap *a, const icsmap *b)
 {
-	icsmap *map = malloc(sizeof(icsmap));
-	if (map == NULL) {
-		return ICS_NO_MEMORY;
-	}
-
-	map->size = 0;
-	map->capacity = INITIAL_SIZE;
-	map->keysize = cfg->keysize;
-	map->valsize = cfg->valsize;
-	map->get_key  = cfg->get_key;
-
-	uint64_t arr_size = sizeof(map_entry) * INITIAL_SIZE;
-	map->arr = malloc(arr_size);
-	if (map->arr == NULL) {
-		free(map);
-		return ICS_NO_MEMORY;
+	if (a->seeded != b->seeded || a->seed != b->seed) {
+		return false;
+	} else if (!a->seeded && (a->int_keys || b->int_keys)) {
+		return a->int_keys == b->int_keys;
 	}
-
-	ics_memset(map->arr, 0, arr_size);
-	*handle = map;
-	return ICS_OK;
+	return (a->engine == ICSMAP_LINEAR) == (b->engine == ICSMAP_LINEAR);
 }
 
-void
-icsmap_deinit(icsmap_handle handle)
+// the key bytes stored in an entry of src, without hashing them
+static inline void
+entry_key_bytes(const icsmap *src, const map_entry entry, key_ref *ref)
 {
-	assert(handle != NULL);
-	icsmap *map = handle;
-	uint32_t i;
-	for (i = 0; i < map->capacity; ++i) {
-		if (!is_empty(map->arr[i]) && !is_deleted(map->arr[i])) {
-			free(map->arr[i]);
-		}
+	if (src->owned_keys) {
+		owned_key *owned = map_entry_owned(src, entry);
+		ref->bytes = owned->bytes;
+		ref->len = owned->len;
+		return;
 	}
-	free(map->arr);
-	free(map);
+	// stored keys are still in the caller's format
+	uint32_t len;
+	ref->bytes = src->get_key == NULL ? map_entry_key(src, entry) :
+		(const map_key)src->get_key(map_entry_key(src, entry), &len);
+	ref->len = src->get_key == NULL ? src->keysize : len;
 }
 
-static ics_status
-resize(icsmap *map)
+// builds the key_ref for a key already stored in an entry of src, hashed the
+// way map hashes keys
+static inline void
+entry_key(const icsmap *src, const map_entry entry, const icsmap *map, key_ref *ref)
 {
-	uint32_t old_cap = map->capacity;
-	ics_next_prime(map->capacity * 2, &map->capacity);
-
-	map_entry *old_arr = map->arr;
-	uint32_t arr_size = sizeof(map_entry) * map->capacity;
-	map->arr = malloc(arr_size);
-	if (map->arr == NULL) {
-		map->arr = old_arr;
-		return ICS_NO_MEMORY;
-	}
-	ics_memset(map->arr, 0, arr_size);
-	log("Resize %d -> %d", old_cap, map->capacity);
-
-	ics_status status;
-	uint32_t i, hash_index;
-	for (i = 0; i < old_cap; ++i) {
-		if (!is_empty(old_arr[i]) && !is_deleted(old_arr[i])) {
-			status = find_hole(map, map_entry_key(map, old_arr[i]), &hash_index);
-			logentry(map, old_arr[i], "Relocating from old_arr[%d] to map->arr[%d] ", i, hash_index);
-			if (status != ICS_OK) {
-				log("Error Relocating: %s", ics_status_str(status));
-				return status;
-			}
-			// need to find an empty spot if collision
-			map->arr[hash_index] = old_arr[i];
-		}
+	entry_key_bytes(src, entry, ref);
+	if (src->owned_keys && src == map) {
+		ref->hash = map_entry_owned(src, entry)->hash;
+	} else {
+		ref->hash = key_hash(map, ref->bytes, ref->len);
 	}
-
-	free(old_arr);
-	return ICS_OK;
 }
 
-static void
-init_map_entry(const icsmap *map, map_entry entry, const void *key, const void *val)
+// entry_key for the entry in slot index of src, taking the hash stored with
+// the slot when map hashes the same way
+static inline void
+slot_key(const icsmap *src, uint32_t index, const icsmap *map, key_ref *ref)
 {
-	ics_memcpy(entry, key, map->keysize);
-	ics_memcpy(entry + map->keysize, val, map->valsize);
+	if (same_hashing(src, map)) {
+		entry_key_bytes(src, src->arr[index], ref);
+		ref->hash = src->hashes[index];
+	} else {
+		entry_key(src, src->arr[index], map, ref);
+	}
 }
 
-ics_status
-icsmap_put(icsmap_handle handle, const void *key, const void *val)
+// whether the entry's key is the one in ref. Callers compare slot hashes
+// first, so this is mostly only reached for the key actually being looked for.
+static inline ics_bool
+key_matches(const icsmap *map, const map_entry entry, const key_ref *ref)
 {
-	icsmap *map = handle;
-	if (is_overloaded(map)) {
-		log("icsmap_put: overloaded - resizing");
-		ics_status status = resize(map);
-		if (status != ICS_OK) {
-			return status;
+	if (map->int_keys) {
+		// unseeded 4 byte keys hash one to one through ics_mix32, so equal
+		// hashes are equal keys
+		if (map->keysize == 4 && !map->seeded) {
+			return true;
 		}
+		return int_key(map, map_entry_key(map, entry)) == int_key(map, ref->bytes);
 	}
-
-	uint32_t index;
-	ics_status status = find_hole(map, (const map_key)key, &index);
-	if (status == ICS_EXISTS) {
-		// value already exists in array replace the value
-		init_map_entry(map, map->arr[index], key, val);
-		logentry(map, map->arr[index], "icsmap_put: Key Exists, updating at index %d", index);
-		return ICS_OK;
-	}
-	// else we have found a hole
-	map_entry entry = malloc(entry_size(map));
-	if (entry == NULL) {
-		return ICS_NO_MEMORY;
+	if (map->owned_keys) {
+		owned_key *owned = map_entry_owned(map, entry);
+		return owned->len == ref->len && ics_equal(owned->bytes, ref->bytes, ref->len);
 	}
-	init_map_entry(map, entry, key, val);
-	logentry(map, entry, "icsmap_put: Does not exist, inserting at index %d", index);
-	map->arr[index] = entry;
-	map->size += 1;
-
-	return ICS_OK;
+	uint32_t candidate_size;
+	const map_key candidate = get_key(map, map_entry_key(map, entry), &candidate_size);
+	return candidate_size == ref->len && ics_equal(candidate, ref->bytes, ref->len);
 }
 
-ics_status
-icsmap_get(const icsmap_handle handle, const void *key, void *out)
+/** Begin cuckoo engine definition */
+static inline uint32_t
+cuckoo_buckets(const icsmap *map)
 {
-	icsmap *map = handle;
-	uint32_t index;
-	ics_status status = find_key(map, (const map_key)key, &index);
-	if (status != ICS_OK) {
-		return status;
-	}
-	logkey(key, "Key found at index %d", index);
-
-	assert(!is_empty(map->arr[index]) && !is_deleted(map->arr[index]));
-
-	ics_memcpy(out, map_entry_val(map, map->arr[index]), map->valsize);
-	return ICS_OK;
+	return (map->capacity - CUCKOO_STASH) / CUCKOO_WAYS;
 }
 
-ics_status
-icsmap_remove(icsmap_handle handle, const void *key)
+static inline uint32_t
+cuckoo_capacity(uint32_t buckets)
 {
-	icsmap *map = handle;
-	uint32_t index;
-	ics_status status = find_key(map, (const map_key)key, &index);
-	if (status != ICS_OK) {
-		return status;
-	}
-	assert(!is_empty(map->arr[index]) && !is_deleted(map->arr[index]));
-	
-	// delete by freeing the entry and setting the index to tombstone value
-	free(map->arr[index]);
-	map->arr[index] = tombstone;
-	map->size--;
+	return buckets * CUCKOO_WAYS + CUCKOO_STASH;
+}
 
-	return ICS_OK;
+// the two buckets a hash may live in. They are always different.
+static inline uint32_t
+cuckoo_first(const icsmap *map, uint32_t hash)
+{
+	return hash % cuckoo_buckets(map);
 }
 
-ics_status
-icsmap_contains(const icsmap_handle handle, const void *key)
+static inline uint32_t
+cuckoo_second(const icsmap *map, uint32_t hash)
 {
-	icsmap *map = handle;
-	uint32_t index;
-	ics_status status = find_key(map, (const map_key)key, &index);
-	return status == ICS_NOT_FOUND ? ICS_NOT_FOUND : ICS_EXISTS;
+	uint32_t buckets = cuckoo_buckets(map);
+	uint32_t first = hash % buckets;
+	uint32_t second = (uint32_t)ics_mix64(hash) % buckets;
+	return second != first ? second : (second + 1) % buckets;
 }
 
-void
-icsmap_foreach(const icsmap_handle handle, foreach_fn fn, void *data)
+// the bucket other than the given one a hash may live in
+static inline uint32_t
+cuckoo_other(const icsmap *map, uint32_t hash, uint32_t bucket)
+{
+	uint32_t first = cuckoo_first(map, hash);
+	return bucket == first ? cuckoo_second(map, hash) : first;
+}
+
+static inline ics_bool
+in_stash(const icsmap *map, uint32_t index)
+{
+	return map->engine == ICSMAP_CUCKOO && index >= map->capacity - CUCKOO_STASH;
+}
+
+static ics_bool
+cuckoo_free_slot(const icsmap *map, uint32_t bucket, uint32_t *index)
+{
+	uint32_t i;
+	for (i = bucket * CUCKOO_WAYS; i < (bucket + 1) * CUCKOO_WAYS; ++i) {
+		if (is_empty(map->arr[i])) {
+			*index = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static ics_bool
+cuckoo_search_bucket(const icsmap *map, uint32_t bucket, const key_ref *ref, uint32_t *index)
+{
+	uint32_t i;
+	for (i = bucket * CUCKOO_WAYS; i < (bucket + 1) * CUCKOO_WAYS; ++i) {
+		if (map->hashes[i] == ref->hash && !is_empty(map->arr[i]) &&
+			key_matches(map, map->arr[i], ref)) {
+			*index = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// a key is in one of its two buckets or, rarely, the stash. Nothing else is
+// ever looked at.
+static ics_status
+cuckoo_find(const icsmap *map, const key_ref *ref, uint32_t *index)
+{
+	if (cuckoo_search_bucket(map, cuckoo_first(map, ref->hash), ref, index) ||
+		cuckoo_search_bucket(map, cuckoo_second(map, ref->hash), ref, index)) {
+		return ICS_OK;
+	}
+	uint32_t i;
+	for (i = map->capacity - CUCKOO_STASH; map->stashed != 0 && i < map->capacity; ++i) {
+		if (map->hashes[i] == ref->hash && !is_empty(map->arr[i]) &&
+			key_matches(map, map->arr[i], ref)) {
+			*index = i;
+			return ICS_OK;
+		}
+	}
+	*index = map->capacity;
+	return ICS_NOT_FOUND;
+}
+
+// one step of the insert search: a slot whose entry could move to its other
+// bucket, and the step before it
+typedef struct cuckoo_step {
+	uint32_t slot;
+	int32_t prev;
+} cuckoo_step;
+
+// whether slot already appears on the path ending at step
+static ics_bool
+cuckoo_on_path(const cuckoo_step *steps, int32_t step, uint32_t slot)
+{
+	for (; step >= 0; step = steps[step].prev) {
+		if (steps[step].slot == slot) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Frees up a slot in one of hash's buckets. If both are full, a breadth first
+ * search looks for the shortest chain of entries which can each move to their
+ * other bucket, ending at one with a free slot, then moves them along it from
+ * the far end. Failing that the key goes in the stash. ICS_FAILURE means the
+ * stash is full too and the table has to grow.
+ */
+static ics_status
+cuckoo_make_room(icsmap *map, uint32_t hash, uint32_t *index)
+{
+	uint32_t buckets[2] = {cuckoo_first(map, hash), cuckoo_second(map, hash)};
+	if (cuckoo_free_slot(map, buckets[0], index) || cuckoo_free_slot(map, buckets[1], index)) {
+		return ICS_OK;
+	}
+
+	cuckoo_step steps[CUCKOO_MAX_SEARCH];
+	uint32_t head = 0, tail = 0, b, i;
+	for (b = 0; b < 2; ++b) {
+		for (i = 0; i < CUCKOO_WAYS; ++i) {
+			steps[tail].slot = buckets[b] * CUCKOO_WAYS + i;
+			steps[tail++].prev = -1;
+		}
+	}
+	while (head < tail) {
+		int32_t step = head++;
+		uint32_t slot = steps[step].slot;
+		uint32_t other = cuckoo_other(map, map->hashes[slot], slot / CUCKOO_WAYS);
+		uint32_t free_slot;
+		if (cuckoo_free_slot(map, other, &free_slot)) {
+			// shift every entry on the path one step towards the free slot
+			for (; step >= 0; step = steps[step].prev) {
+				slot = steps[step].slot;
+				set_slot(map, free_slot, map->arr[slot]);
+				map->hashes[free_slot] = map->hashes[slot];
+				set_slot(map, slot, NULL);
+				free_slot = slot;
+			}
+			*index = free_slot;
+			return ICS_OK;
+		}
+		for (i = 0; i < CUCKOO_WAYS && tail < CUCKOO_MAX_SEARCH; ++i) {
+			uint32_t next = other * CUCKOO_WAYS + i;
+			if (!cuckoo_on_path(steps, step, next)) {
+				steps[tail].slot = next;
+				steps[tail++].prev = step;
+			}
+		}
+	}
+
+	for (i = map->capacity - CUCKOO_STASH; i < map->capacity; ++i) {
+		if (is_empty(map->arr[i])) {
+			*index = i;
+			return ICS_OK;
+		}
+	}
+	return ICS_FAILURE;
+}
+
+// number of buckets a lookup examined before finding the key at index
+static inline uint32_t
+cuckoo_probes(const icsmap *map, uint32_t hash, uint32_t index)
+{
+	if (in_stash(map, index)) {
+		return 3;
+	}
+	return index / CUCKOO_WAYS == cuckoo_first(map, hash) ? 1 : 2;
+}
+/** End cuckoo engine definition */
+
+/** Begin hopscotch engine definition */
+
+// how many slots past from the slot to is, wrapping around the end
+static inline uint32_t
+hop_distance(const icsmap *map, uint32_t from, uint32_t to)
+{
+	return (to + map->capacity - from) % map->capacity;
+}
+
+// bit j of a slot's bitmap is set when the slot j further along holds a key
+// whose home is this slot, so only those slots are ever compared
+static ics_status
+hop_find(const icsmap *map, const key_ref *ref, uint32_t *index)
+{
+	uint32_t home = ref->hash % map->capacity;
+	uint32_t bits = map->hops[home];
+	while (bits != 0) {
+		uint32_t i = (home + __builtin_ctz(bits)) % map->capacity;
+		if (map->hashes[i] == ref->hash && key_matches(map, map->arr[i], ref)) {
+			*index = i;
+			return ICS_OK;
+		}
+		bits &= bits - 1;
+	}
+	*index = home;
+	return ICS_NOT_FOUND;
+}
+
+/*
+ * Frees up a slot within HOP_RANGE of hash's home slot. The nearest empty slot
+ * is moved closer by swapping it with an entry before it whose own home is
+ * still within range of the empty slot, furthest back first, until it is in
+ * the neighbourhood. ICS_FAILURE means no empty slot or no such entry was
+ * found and the table has to grow.
+ */
+static ics_status
+hop_make_room(icsmap *map, uint32_t hash, uint32_t *index)
+{
+	uint32_t capacity = map->capacity, home = hash % capacity;
+	uint32_t limit = capacity < HOP_MAX_SEARCH ? capacity : HOP_MAX_SEARCH;
+	uint32_t dist, free_slot = home;
+	for (dist = 0; dist < limit && !is_empty(map->arr[free_slot]); ++dist) {
+		free_slot = (free_slot + 1) % capacity;
+	}
+	if (dist == limit) {
+		return ICS_FAILURE;
+	}
+
+	while (dist >= HOP_RANGE) {
+		uint32_t back;
+		for (back = HOP_RANGE - 1; back > 0; --back) {
+			uint32_t b = (free_slot + capacity - back) % capacity;
+			// entries of b which sit before the free slot
+			uint32_t bits = map->hops[b] & ((1u << back) - 1);
+			if (bits != 0) {
+				uint32_t j = __builtin_ctz(bits);
+				uint32_t from = (b + j) % capacity;
+				set_slot(map, free_slot, map->arr[from]);
+				map->hashes[free_slot] = map->hashes[from];
+				set_slot(map, from, NULL);
+				map->hops[b] = (map->hops[b] & ~(1u << j)) | (1u << back);
+				dist -= hop_distance(map, from, free_slot);
+				free_slot = from;
+				break;
+			}
+		}
+		if (back == 0) {
+			return ICS_FAILURE;
+		}
+	}
+	*index = free_slot;
+	return ICS_OK;
+}
+
+// number of keys a lookup compared before finding the one at index, or all
+// of the candidates for a miss
+static inline uint32_t
+hop_probes(const icsmap *map, uint32_t hash, uint32_t index, ics_status status)
+{
+	uint32_t home = hash % map->capacity;
+	if (status != ICS_OK) {
+		return __builtin_popcount(map->hops[home]);
+	}
+	uint32_t offset = hop_distance(map, home, index);
+	return __builtin_popcount(map->hops[home] & ((1u << offset) - 1)) + 1;
+}
+/** End hopscotch engine definition */
+
+/** Begin compact mode definition */
+
+// the narrowest index slots which fit every position in a dense array of
+// the given capacity, plus the empty and deleted markers
+static inline uint32_t
+index_width(uint32_t capacity)
+{
+	return capacity < UINT8_MAX ? 1 : capacity < UINT16_MAX ? 2 : 4;
+}
+
+static inline uint32_t
+index_deleted(const icsmap *map)
+{
+	return map->index_width == 1 ? UINT8_MAX : map->index_width == 2 ? UINT16_MAX : UINT32_MAX;
+}
+
+// index slots for a dense array of the given capacity. arr never holds more
+// entries than that, so the index stays under the load factor.
+static inline uint32_t
+index_capacity(uint32_t capacity)
+{
+	uint32_t index_cap;
+	ics_next_prime((uint32_t)((uint64_t)capacity * 100 / LOAD_FACTOR), &index_cap);
+	return index_cap;
+}
+
+static inline uint32_t
+index_get(const icsmap *map, uint32_t i)
+{
+	switch (map->index_width) {
+	case 1:
+		return ((const uint8_t *)map->index)[i];
+	case 2:
+		return ((const uint16_t *)map->index)[i];
+	default:
+		return ((const uint32_t *)map->index)[i];
+	}
+}
+
+static inline void
+index_set(icsmap *map, uint32_t i, uint32_t value)
+{
+	switch (map->index_width) {
+	case 1:
+		((uint8_t *)map->index)[i] = (uint8_t)value;
+		break;
+	case 2:
+		((uint16_t *)map->index)[i] = (uint16_t)value;
+		break;
+	default:
+		((uint32_t *)map->index)[i] = value;
+		break;
+	}
+}
+
+// linear probing over the index. On a hit, *pos is the key's position in arr.
+// Either way *slot is the index slot the probe stopped on.
+static ics_status
+compact_find(const icsmap *map, const key_ref *ref, uint32_t *pos, uint32_t *slot)
+{
+	uint32_t start = ref->hash % map->index_cap, i = start, value;
+	uint32_t deleted = index_deleted(map);
+	while ((value = index_get(map, i)) != 0) {
+		if (value != deleted && map->hashes[value - 1] == ref->hash &&
+			key_matches(map, map->arr[value - 1], ref)) {
+			*pos = value - 1;
+			*slot = i;
+			return ICS_OK;
+		}
+		i = (i + 1) % map->index_cap;
+		if (i == start) {
+			break;
+		}
+	}
+	*slot = i;
+	return ICS_NOT_FOUND;
+}
+
+// points the first free index slot from hash at pos
+static void
+compact_index_add(icsmap *map, uint32_t pos, uint32_t hash)
+{
+	uint32_t i = hash % map->index_cap, value;
+	uint32_t deleted = index_deleted(map);
+	while ((value = index_get(map, i)) != 0 && value != deleted) {
+		i = (i + 1) % map->index_cap;
+	}
+	index_set(map, i, pos + 1);
+}
+
+static void
+compact_index_remove(icsmap *map, uint32_t pos)
+{
+	uint32_t i = map->hashes[pos] % map->index_cap;
+	while (index_get(map, i) != pos + 1) {
+		i = (i + 1) % map->index_cap;
+	}
+	index_set(map, i, index_deleted(map));
+}
+/** End compact mode definition */
+
+/** Begin small map definition */
+
+// whether arr is dense and in insertion order, with new entries going on the end
+static inline ics_bool
+is_dense(const icsmap *map)
+{
+	return map->compact || map->small;
+}
+
+// compares the stored hash of every slot at once, which the compiler can do
+// with a few vector instructions, then checks the keys of those which match
+static ics_status
+small_find(const icsmap *map, const key_ref *ref, uint32_t *index)
+{
+	uint32_t i, matches = 0;
+	for (i = 0; i < SMALL_CAPACITY; ++i) {
+		matches |= (uint32_t)(map->hashes[i] == ref->hash) << i;
+	}
+	// positions past used may hold stale hashes
+	matches &= (1u << map->used) - 1;
+	for (; matches != 0; matches &= matches - 1) {
+		i = __builtin_ctz(matches);
+		if (!is_deleted(map->arr[i]) && key_matches(map, map->arr[i], ref)) {
+			*index = i;
+			return ICS_OK;
+		}
+	}
+	*index = map->used;
+	return ICS_NOT_FOUND;
+}
+/** End small map definition */
+
+// puts the entry in an empty or deleted slot
+static inline void
+fill_slot(icsmap *map, uint32_t index, map_entry entry, uint32_t hash)
+{
+	set_slot(map, index, entry);
+	map->hashes[index] = hash;
+	if (is_dense(map)) {
+		if (!map->small) {
+			compact_index_add(map, index, hash);
+		}
+		map->used = index + 1;
+	} else if (map->engine == ICSMAP_CUCKOO) {
+		map->stashed += in_stash(map, index);
+	} else if (map->engine == ICSMAP_HOPSCOTCH) {
+		uint32_t home = hash % map->capacity;
+		map->hops[home] |= 1u << hop_distance(map, home, index);
+	}
+}
+
+static inline ics_bool
+is_overloaded(const icsmap *map)
+{
+	if (is_dense(map)) {
+		// new entries always go on the end of arr
+		return map->used == map->capacity;
+	} else if (map->engine == ICSMAP_CUCKOO) {
+		// no tombstones, and buckets stay cheap to search even when nearly full
+		return ics_percent(map->size, cuckoo_buckets(map) * CUCKOO_WAYS) > CUCKOO_LOAD_FACTOR;
+	} else if (map->engine == ICSMAP_HOPSCOTCH) {
+		// likewise, a neighbourhood costs the same to search however full
+		return ics_percent(map->size, map->capacity) > HOP_LOAD_FACTOR;
+	}
+	// tombstones count against the load factor too, otherwise a map with a lot
+	// of churn ends up with no empty slots left to stop a probe.
+	return ics_percent(map->size + map->tombstones, map->capacity) > LOAD_FACTOR;
+}
+
+// whether a cuckoo or hopscotch table is at least half way to its load factor.
+// Below that, running out of room for a key is not for lack of slots.
+static inline ics_bool
+is_crowded(const icsmap *map)
+{
+	if (map->engine == ICSMAP_CUCKOO) {
+		return ics_percent(map->size, cuckoo_buckets(map) * CUCKOO_WAYS) >= CUCKOO_LOAD_FACTOR / 2;
+	}
+	return ics_percent(map->size, map->capacity) >= HOP_LOAD_FACTOR / 2;
+}
+
+// whether a new key going in at index means the keys were picked to collide
+// under the current seed. With a keyed hash this is all but impossible by
+// chance.
+static inline ics_bool
+is_flooded(const icsmap *map, const key_ref *ref, uint32_t index)
+{
+	if (is_dense(map)) {
+		return false;
+	} else if (map->engine == ICSMAP_CUCKOO) {
+		// both buckets and every path out of them full, in a table which is not
+		return in_stash(map, index) && !is_crowded(map);
+	} else if (map->engine == ICSMAP_HOPSCOTCH) {
+		// half a neighbourhood already taken by keys from the same home
+		return __builtin_popcount(map->hops[ref->hash % map->capacity]) >= HOP_RANGE / 2;
+	}
+	return (index + map->capacity - ref->hash % map->capacity) % map->capacity >= HASH_FLOOD_PROBE;
+}
+
+// number of slots a lookup for hash examined, buckets for the cuckoo engine
+// and keys compared for hopscotch. index is where it found the key or stopped.
+static inline uint32_t
+probe_count(const icsmap *map, uint32_t hash, uint32_t index, ics_status status)
+{
+	if (map->engine == ICSMAP_CUCKOO) {
+		return status == ICS_OK ? cuckoo_probes(map, hash, index) : 2 + (map->stashed != 0);
+	} else if (map->engine == ICSMAP_HOPSCOTCH) {
+		return hop_probes(map, hash, index, status);
+	}
+	return (index + map->capacity - hash % map->capacity) % map->capacity + 1;
+}
+
+static ics_status
+find_key(const icsmap *map, const key_ref *ref, uint32_t *index)
+{
+	uint32_t slot;
+	if (map->small) {
+		return small_find(map, ref, index);
+	} else if (map->compact) {
+		return compact_find(map, ref, index, &slot);
+	} else if (map->engine == ICSMAP_CUCKOO) {
+		return cuckoo_find(map, ref, index);
+	} else if (map->engine == ICSMAP_HOPSCOTCH) {
+		return hop_find(map, ref, index);
+	}
+	uint32_t hash_index = ref->hash % map->capacity;
+	logkey(ref->bytes, "finding index of key from map starting at index %d", hash_index);
+	// we now have the starting point for the key search space
+	uint32_t i = hash_index;
+	while (!is_empty(map->arr[i])) {
+		// deleted slots do not end the probe, the key may be further along.
+		// The stored hash rules out nearly every other key without having to
+		// go to the entry for it.
+		if (map->hashes[i] == ref->hash && !is_deleted(map->arr[i]) &&
+			key_matches(map, map->arr[i], ref)) {
+			*index = i;
+			return ICS_OK;
+		}
+		i = (i + 1) % map->capacity;
+		if (i == hash_index) {
+			// we looped back to hash index, can quit
+			break;
+		}
+	}
+	// if here then it means we did not find the key. Leave index at the slot
+	// the probe stopped on so callers can tell how far it went.
+	*index = i;
+	return ICS_NOT_FOUND;
+}
+
+// finds the key's slot (ICS_EXISTS) or a slot to insert it in (ICS_OK). The
+// cuckoo and hopscotch engines may move other entries to make one, and return
+// ICS_FAILURE when the table has to grow first.
+static ics_status
+find_hole(icsmap *map, const key_ref *ref, uint32_t *index)
+{
+	uint32_t slot;
+	if (is_dense(map)) {
+		if ((map->small ? small_find(map, ref, index) : compact_find(map, ref, index, &slot)) == ICS_OK) {
+			return ICS_EXISTS;
+		}
+		*index = map->used;
+		return ICS_OK;
+	} else if (map->engine == ICSMAP_CUCKOO) {
+		if (cuckoo_find(map, ref, index) == ICS_OK) {
+			return ICS_EXISTS;
+		}
+		return cuckoo_make_room(map, ref->hash, index);
+	} else if (map->engine == ICSMAP_HOPSCOTCH) {
+		if (hop_find(map, ref, index) == ICS_OK) {
+			return ICS_EXISTS;
+		}
+		return hop_make_room(map, ref->hash, index);
+	}
+	// find a starting position
+	uint32_t hash_index = ref->hash % map->capacity;
+
+	// for each value in the hashmap starting at index and looping with mod:
+	//     if this value is empty, then we have found a hole. return index/OK
+	//     if this value is deleted, then remember it as a hole, but keep going
+	//         since the key may still exist further along the probe.
+	//     if this value is the same, then compare for equality with search key.
+	//         if same search key, then return index/ICS_EXISTS
+	//         if not same search key, then continue to next loop
+	uint32_t i = hash_index;
+	ics_bool have_hole = false;
+
+	// while we have not found an empty hole
+	while (!is_empty(map->arr[i])) {
+		// if this value has been deleted
+		if (is_deleted(map->arr[i])) {
+			if (!have_hole) {
+				*index = i;
+				have_hole = true;
+			}
+		// else if this is the same key we are finding a hole for
+		} else if (map->hashes[i] == ref->hash && key_matches(map, map->arr[i], ref)) {
+			*index = i;
+			return ICS_EXISTS;
+		}
+		// else increment i and loop back to beginning of array at end
+		i = (i + 1) % map->capacity;
+		if (i == hash_index) {
+			break;
+		}
+	}
+	// if here it means we have found an empty spot. We are guarenteed not to
+	// infinite loop because we resize the array when there is not enough space
+	// return index/ok
+	if (!have_hole) {
+		*index = i;
+	}
+	return ICS_OK;
+}
+
+// finds the slot holding the given entry
+static uint32_t
+find_entry(const icsmap *map, const map_entry entry)
+{
+	key_ref ref;
+	uint32_t index;
+	entry_key(map, entry, map, &ref);
+	ics_status status = find_key(map, &ref, &index);
+	assert(status == ICS_OK && map->arr[index] == entry);
+	(void)status;
+	return index;
+}
+
+/** Begin allocation definition */
+static void *
+default_alloc(uint64_t size, void *ctx)
+{
+	(void)ctx;
+	return malloc(size);
+}
+
+static void
+default_free(void *ptr, uint64_t size, void *ctx)
+{
+	(void)size;
+	(void)ctx;
+	free(ptr);
+}
+
+static void *
+default_realloc(void *ptr, uint64_t old_size, uint64_t new_size, void *ctx)
+{
+	(void)old_size;
+	(void)ctx;
+	return realloc(ptr, new_size);
+}
+
+static inline void *
+mem_alloc(const icsmap_allocator *alloc, uint64_t size)
+{
+	return alloc->alloc(size, alloc->ctx);
+}
+
+static inline void *
+mem_calloc(const icsmap_allocator *alloc, uint64_t size)
+{
+	void *ptr = alloc->alloc(size, alloc->ctx);
+	if (ptr != NULL) {
+		ics_memset(ptr, 0, size);
+	}
+	return ptr;
+}
+
+static inline void
+mem_free(const icsmap_allocator *alloc, void *ptr, uint64_t size)
+{
+	if (ptr != NULL) {
+		alloc->free(ptr, size, alloc->ctx);
+	}
+}
+
+// on failure the old block is left alone, like realloc
+static void *
+mem_realloc(const icsmap_allocator *alloc, void *ptr, uint64_t old_size, uint64_t new_size)
+{
+	if (alloc->realloc != NULL) {
+		return alloc->realloc(ptr, old_size, new_size, alloc->ctx);
+	}
+	void *moved = alloc->alloc(new_size, alloc->ctx);
+	if (moved == NULL) {
+		return NULL;
+	}
+	if (ptr != NULL) {
+		ics_memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+		alloc->free(ptr, old_size, alloc->ctx);
+	}
+	return moved;
+}
+
+// fills in the allocator a map uses from the one given in its cfg
+static ics_status
+resolve_allocator(const icsmap_allocator *given, icsmap_allocator *alloc)
+{
+	if (given->alloc == NULL && given->free == NULL) {
+		alloc->alloc = default_alloc;
+		alloc->free = default_free;
+		alloc->realloc = default_realloc;
+		alloc->ctx = NULL;
+		return ICS_OK;
+	} else if (given->alloc == NULL || given->free == NULL) {
+		return ICS_INVALID;
+	}
+	*alloc = *given;
+	return ICS_OK;
+}
+/** End allocation definition */
+
+/** Begin table allocation definition */
+#if defined(__linux__) && defined(MADV_HUGEPAGE) && defined(SYS_mbind)
+#define MAPPED_TABLES
+#endif
+
+// tables at least this big are mapped directly when huge pages or a numa
+// policy were asked for. Anything smaller would not fill a single huge page.
+#define HUGE_PAGE_SIZE ((uint64_t)2 << 20)
+
+// from linux/mempolicy.h, which is not always installed
+#define MPOL_BIND_MODE       2
+#define MPOL_INTERLEAVE_MODE 3
+
+// the slot array, the hashes after it and, for the hopscotch engine, the
+// neighbourhood bitmaps after those are allocated as one block
+static inline uint64_t
+table_size(const icsmap *map, uint32_t capacity)
+{
+	uint64_t slot = sizeof(map_entry) + sizeof(uint32_t);
+	if (map->engine == ICSMAP_HOPSCOTCH) {
+		slot += sizeof(uint32_t);
+	}
+	return slot * capacity;
+}
+
+// points the map at a table of the given capacity
+static inline void
+table_attach(icsmap *map, map_entry *arr, uint32_t capacity)
+{
+	map->arr = arr;
+	map->hashes = (uint32_t *)(arr + capacity);
+	map->hops = map->engine == ICSMAP_HOPSCOTCH ? map->hashes + capacity : NULL;
+	map->capacity = capacity;
+}
+
+// whether a table of this size bypasses the allocator and is mapped directly
+static inline ics_bool
+table_mapped(const icsmap *map, uint64_t size)
+{
+#ifdef MAPPED_TABLES
+	return (map->huge_pages || map->numa_policy != ICSMAP_NUMA_DEFAULT) && size >= HUGE_PAGE_SIZE;
+#else
+	(void)map;
+	(void)size;
+	return false;
+#endif
+}
+
+#ifdef MAPPED_TABLES
+static inline uint64_t
+table_mapped_size(uint64_t size)
+{
+	return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+/*
+ * Maps a zeroed table aligned to a huge page, so that every 2MB of it can be
+ * a single page. The placement hints are applied before anything touches the
+ * memory, since that is when the kernel picks the pages. Neither is fatal if
+ * refused: the table still works, it just lives in small or local pages.
+ */
+static map_entry *
+table_map(const icsmap *map, uint64_t size)
+{
+	size = table_mapped_size(size);
+	// map an extra huge page's worth and trim either side to get alignment
+	uint8_t *raw = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED) {
+		return NULL;
+	}
+	uint8_t *arr = (uint8_t *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+	if (arr > raw) {
+		munmap(raw, arr - raw);
+	}
+	if (arr + size < raw + size + HUGE_PAGE_SIZE) {
+		munmap(arr + size, raw + size + HUGE_PAGE_SIZE - (arr + size));
+	}
+
+	if (map->huge_pages && madvise(arr, size, MADV_HUGEPAGE) != 0) {
+		log("table_map: madvise refused, using small pages");
+	}
+	if (map->numa_policy != ICSMAP_NUMA_DEFAULT) {
+		unsigned long nodes = (unsigned long)map->numa_nodes;
+		int mode = map->numa_policy == ICSMAP_NUMA_BIND ? MPOL_BIND_MODE : MPOL_INTERLEAVE_MODE;
+		if (syscall(SYS_mbind, arr, size, mode, &nodes, sizeof(nodes) * 8 + 1, 0) != 0) {
+			log("table_map: mbind refused, using the default policy");
+		}
+	}
+	return (map_entry *)arr;
+}
+#endif
+
+// a zeroed table of capacity slots
+static map_entry *
+table_alloc(icsmap *map, uint32_t capacity)
+{
+	uint64_t size = table_size(map, capacity);
+#ifdef MAPPED_TABLES
+	if (table_mapped(map, size)) {
+		return table_map(map, size);
+	}
+#endif
+	return mem_calloc(&map->alloc, size);
+}
+
+// the small array, right after the map in the same allocation
+static inline map_entry *
+small_table(const icsmap *map)
+{
+	return (map_entry *)((uint8_t *)map + sizeof(icsmap));
+}
+
+// the inline entry pool, right after the small array. Entries are kept 8 byte
+// aligned for the links and headers in them.
+static inline uint8_t *
+pool_base(const icsmap *map)
+{
+	return (uint8_t *)small_table(map) + table_size(map, SMALL_CAPACITY);
+}
+
+static inline uint64_t
+pool_stride(const icsmap *map)
+{
+	return (entry_size(map) + 7) & ~(uint64_t)7;
+}
+
+// entries with variable length values are reallocated as they grow, so those
+// maps have no pool
+static inline uint64_t
+map_bytes(const icsmap *map)
+{
+	uint64_t bytes = sizeof(icsmap) + table_size(map, SMALL_CAPACITY);
+	if (!map->var_vals) {
+		bytes += SMALL_CAPACITY * pool_stride(map);
+	}
+	return bytes;
+}
+
+static inline uint32_t
+pool_all(void)
+{
+	return (uint32_t)(((uint64_t)1 << SMALL_CAPACITY) - 1);
+}
+
+// number of entries living in the pool
+static inline uint64_t
+pool_in_use(const icsmap *map)
+{
+	return map->var_vals ? 0 : __builtin_popcount(~map->pool_free & pool_all());
+}
+
+// memory for a new entry of size bytes, from the pool while it has room
+static map_entry
+entry_alloc(icsmap *map, uint64_t size)
+{
+	if (map->pool_free != 0) {
+		uint32_t i = __builtin_ctz(map->pool_free);
+		map->pool_free &= map->pool_free - 1;
+		return pool_base(map) + i * pool_stride(map);
+	}
+	return mem_alloc(&map->alloc, size);
+}
+
+static void
+entry_free(icsmap *map, map_entry entry, uint64_t size)
+{
+	uint8_t *pool = pool_base(map);
+	if (!map->var_vals && entry >= pool && entry < pool + SMALL_CAPACITY * pool_stride(map)) {
+		map->pool_free |= 1u << ((entry - pool) / pool_stride(map));
+		return;
+	}
+	mem_free(&map->alloc, entry, size);
+}
+
+static void
+table_free(icsmap *map, map_entry *arr, uint32_t capacity)
+{
+	if (arr == small_table(map)) {
+		// freed along with the map
+		return;
+	}
+	uint64_t size = table_size(map, capacity);
+#ifdef MAPPED_TABLES
+	if (table_mapped(map, size)) {
+		munmap(arr, table_mapped_size(size));
+		return;
+	}
+#endif
+	mem_free(&map->alloc, arr, size);
+}
+/** End table allocation definition */
+
+/** Begin owned key definition */
+static uint8_t *
+arena_alloc(icsmap *map, uint64_t len)
+{
+	key_arena *arena = &map->arena;
+	arena_chunk *chunk = arena->head;
+	if (chunk == NULL || chunk->size - chunk->used < len) {
+		uint64_t size = len > ARENA_CHUNK_SIZE ? len : ARENA_CHUNK_SIZE;
+		chunk = mem_alloc(&map->alloc, sizeof(arena_chunk) + size);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk->size = size;
+		chunk->used = 0;
+		chunk->next = arena->head;
+		arena->head = chunk;
+	}
+	uint8_t *res = chunk->data + chunk->used;
+	chunk->used += len;
+	arena->live += len;
+	arena->total += len;
+	return res;
+}
+
+static inline void
+arena_release(key_arena *arena, uint64_t len)
+{
+	arena->live -= len;
+}
+
+static void
+arena_free(icsmap *map)
+{
+	key_arena *arena = &map->arena;
+	arena_chunk *chunk = arena->head;
+	while (chunk != NULL) {
+		arena_chunk *next = chunk->next;
+		mem_free(&map->alloc, chunk, sizeof(arena_chunk) + chunk->size);
+		chunk = next;
+	}
+	arena->head = NULL;
+	arena->live = arena->total = 0;
+}
+
+// copies the key bytes into the arena and fills in the entry's owned_key
+static ics_status
+owned_key_init(icsmap *map, map_entry entry, const key_ref *ref)
+{
+	owned_key *owned = map_entry_owned(map, entry);
+	owned->bytes = arena_alloc(map, (uint64_t)ref->len + 1);
+	if (owned->bytes == NULL) {
+		return ICS_NO_MEMORY;
+	}
+	ics_memcpy(owned->bytes, ref->bytes, ref->len);
+	owned->bytes[ref->len] = '\0';
+	owned->len = ref->len;
+	owned->hash = ref->hash;
+	return ICS_OK;
+}
+
+/*
+ * Once more than half of the arena is dead space, the live keys are copied
+ * into a single fresh chunk. Called while rehashing since every entry gets
+ * touched then anyway. Failing to compact is not an error, we just keep the
+ * old arena.
+ */
+static void
+arena_compact(icsmap *map)
+{
+	key_arena *arena = &map->arena;
+	if (arena->total < ARENA_CHUNK_SIZE || arena->total - arena->live <= arena->live) {
+		return;
+	}
+	arena_chunk *chunk = mem_alloc(&map->alloc, sizeof(arena_chunk) + arena->live);
+	if (chunk == NULL) {
+		return;
+	}
+	chunk->next = NULL;
+	chunk->size = arena->live;
+	chunk->used = 0;
+	uint32_t i;
+	for (i = 0; i < map->capacity; ++i) {
+		if (!is_empty(map->arr[i]) && !is_deleted(map->arr[i])) {
+			owned_key *owned = map_entry_owned(map, map->arr[i]);
+			uint64_t len = (uint64_t)owned->len + 1;
+			ics_memcpy(chunk->data + chunk->used, owned->bytes, len);
+			owned->bytes = chunk->data + chunk->used;
+			chunk->used += len;
+		}
+	}
+	assert(chunk->used == arena->live);
+	uint64_t live = arena->live;
+	arena_free(map);
+	arena->head = chunk;
+	arena->live = arena->total = live;
+}
+/** End owned key definition */
+
+/** Begin cache mode definition */
+
+// unlinks the entry from the recency list
+static void
+lru_unlink(icsmap *map, map_entry entry)
+{
+	lru_link *link = map_entry_lru(entry);
+	if (link->prev != NULL) {
+		map_entry_lru(link->prev)->next = link->next;
+	} else {
+		map->lru_head = link->next;
+	}
+	if (link->next != NULL) {
+		map_entry_lru(link->next)->prev = link->prev;
+	} else {
+		map->lru_tail = link->prev;
+	}
+	link->prev = link->next = NULL;
+}
+
+// links the entry in as the most recently used
+static void
+lru_push(icsmap *map, map_entry entry)
+{
+	lru_link *link = map_entry_lru(entry);
+	link->prev = NULL;
+	link->next = map->lru_head;
+	if (map->lru_head != NULL) {
+		map_entry_lru(map->lru_head)->prev = entry;
+	} else {
+		map->lru_tail = entry;
+	}
+	map->lru_head = entry;
+}
+
+static inline void
+lru_touch(icsmap *map, map_entry entry)
+{
+	if (map->lru && map->lru_head != entry) {
+		lru_unlink(map, entry);
+		lru_push(map, entry);
+	}
+}
+
+static inline ics_bool
+lru_is_full(const icsmap *map, uint64_t incoming)
+{
+	return (map->max_entries != 0 && map->size >= map->max_entries) ||
+		(map->max_bytes != 0 && map->bytes + incoming > map->max_bytes);
+}
+
+static void remove_at(icsmap *map, uint32_t index);
+
+// calls fn with the entry, or once for each of its values in a multimap
+static void
+visit_entry(const icsmap *map, const map_entry entry, foreach_fn fn, void *data)
+{
+	if (map->multi) {
+		multi_vals *mv = map_entry_multi(map, entry);
+		uint8_t *vals = multi_vals_bytes(mv);
+		uint32_t i;
+		for (i = 0; i < mv->count; ++i) {
+			fn(visible_key(map, entry), vals + (uint64_t)i * map->valsize, data);
+		}
+		return;
+	}
+	icsmap_blob blob;
+	fn(visible_key(map, entry), visible_val(map, entry, &blob), data);
+}
+
+// hands the entry to the evict callback and removes it from the map
+static void
+evict_entry(icsmap *map, map_entry victim)
+{
+	uint32_t index = find_entry(map, victim);
+	if (map->evict != NULL) {
+		visit_entry(map, victim, map->evict, map->evict_data);
+	}
+	remove_at(map, index);
+}
+
+// evicts least recently used entries until an entry of the given size fits.
+// keep, if not NULL, is an entry which is growing and must not be evicted.
+static void
+lru_make_room(icsmap *map, uint64_t incoming, map_entry keep)
+{
+	while (map->lru_tail != NULL && map->lru_tail != keep && lru_is_full(map, incoming)) {
+		evict_entry(map, map->lru_tail);
+	}
+}
+/** End cache mode definition */
+
+/** Begin ttl mode definition */
+static uint64_t
+default_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec;
+}
+
+static inline ics_bool
+ttl_expired(const icsmap *map, const map_entry entry, uint64_t now)
+{
+	uint64_t expires = map_entry_ttl(map, entry)->expires;
+	return expires != 0 && expires <= now;
+}
+
+// links the entry into the wheel slot matching its expiry
+static void
+wheel_insert(icsmap *map, map_entry entry)
+{
+	timer_wheel *wheel = map->wheel;
+	ttl_link *link = map_entry_ttl(map, entry);
+	uint64_t expires = link->expires;
+	if (expires < wheel->now) {
+		// already due, handle it on the current tick
+		expires = wheel->now;
+	} else if (expires - wheel->now >= WHEEL_SPAN) {
+		// too far out, park it as far away as we can. It gets placed again
+		// when its slot cascades.
+		expires = wheel->now + WHEEL_SPAN - 1;
+	}
+
+	uint64_t delta = expires - wheel->now;
+	uint32_t level = 0;
+	while (level < WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << (WHEEL_BITS * (level + 1)))) {
+		level++;
+	}
+	uint32_t slot = (uint32_t)(expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+	map_entry *head = &wheel->slots[level][slot];
+	link->slot = level * WHEEL_SLOTS + slot;
+	link->prev = NULL;
+	link->next = *head;
+	if (*head != NULL) {
+		map_entry_ttl(map, *head)->prev = entry;
+	}
+	*head = entry;
+	wheel->occupied[level] |= (uint64_t)1 << slot;
+	wheel->count++;
+}
+
+static void
+wheel_unlink(icsmap *map, map_entry entry)
+{
+	timer_wheel *wheel = map->wheel;
+	ttl_link *link = map_entry_ttl(map, entry);
+	uint32_t level = link->slot / WHEEL_SLOTS, slot = link->slot % WHEEL_SLOTS;
+	if (link->prev != NULL) {
+		map_entry_ttl(map, link->prev)->next = link->next;
+	} else {
+		wheel->slots[level][slot] = link->next;
+		if (link->next == NULL) {
+			wheel->occupied[level] &= ~((uint64_t)1 << slot);
+		}
+	}
+	if (link->next != NULL) {
+		map_entry_ttl(map, link->next)->prev = link->prev;
+	}
+	link->prev = link->next = NULL;
+	wheel->count--;
+}
+
+// sets when the entry expires, moving it to the right wheel slot
+static void
+ttl_set(icsmap *map, map_entry entry, uint64_t expires)
+{
+	ttl_link *link = map_entry_ttl(map, entry);
+	if (link->expires != 0) {
+		wheel_unlink(map, entry);
+	}
+	link->expires = expires;
+	if (expires != 0) {
+		wheel_insert(map, entry);
+	}
+}
+
+// moves everything out of the wheel slot, placing it again relative to now
+static void
+wheel_cascade(icsmap *map, uint32_t level, uint32_t slot)
+{
+	timer_wheel *wheel = map->wheel;
+	map_entry entry = wheel->slots[level][slot];
+	wheel->slots[level][slot] = NULL;
+	wheel->occupied[level] &= ~((uint64_t)1 << slot);
+	while (entry != NULL) {
+		map_entry next = map_entry_ttl(map, entry)->next;
+		wheel->count--;
+		wheel_insert(map, entry);
+		entry = next;
+	}
+}
+
+// the next tick after wheel->now at which some slot needs to be looked at
+static uint64_t
+wheel_next_event(const timer_wheel *wheel)
+{
+	uint64_t next = UINT64_MAX;
+	uint32_t level;
+	for (level = 0; level < WHEEL_LEVELS; ++level) {
+		uint64_t bits = wheel->occupied[level];
+		if (bits == 0) {
+			continue;
+		}
+		uint32_t shift = WHEEL_BITS * level;
+		uint64_t cur = wheel->now >> shift;
+		uint32_t pos = (uint32_t)(cur & WHEEL_MASK);
+		// slots after the current one come up in this rotation, the rest
+		// (including the current one, which was already handled) in the next
+		uint64_t later = pos == WHEEL_MASK ? 0 : bits & (~(uint64_t)0 << (pos + 1));
+		uint64_t tick;
+		if (later != 0) {
+			tick = ((cur & ~(uint64_t)WHEEL_MASK) + __builtin_ctzll(later)) << shift;
+		} else {
+			tick = ((cur & ~(uint64_t)WHEEL_MASK) + WHEEL_SLOTS + __builtin_ctzll(bits)) << shift;
+		}
+		if (tick < next) {
+			next = tick;
+		}
+	}
+	return next;
+}
+
+/*
+ * Advances the wheel up to and including now, reclaiming at most budget
+ * expired entries. If the budget runs out, the wheel stays on the current
+ * tick and picks up where it left off next time.
+ */
+static uint32_t
+wheel_advance(icsmap *map, uint64_t now, uint32_t budget)
+{
+	timer_wheel *wheel = map->wheel;
+	uint32_t reclaimed = 0;
+	while (wheel->now <= now) {
+		if (wheel->count == 0) {
+			wheel->now = now + 1;
+			wheel->cascaded = false;
+			break;
+		}
+		if (!wheel->cascaded) {
+			// when a lower level wraps around, the matching slot of the level
+			// above is spread out over the levels below it.
+			uint32_t level;
+			for (level = WHEEL_LEVELS - 1; level > 0; --level) {
+				uint32_t shift = WHEEL_BITS * level;
+				if ((wheel->now & (((uint64_t)1 << shift) - 1)) == 0) {
+					wheel_cascade(map, level, (uint32_t)(wheel->now >> shift) & WHEEL_MASK);
+				}
+			}
+			wheel->cascaded = true;
+		}
+
+		uint32_t slot = (uint32_t)wheel->now & WHEEL_MASK;
+		while (wheel->slots[0][slot] != NULL) {
+			if (reclaimed == budget) {
+				return reclaimed;
+			}
+			map_entry entry = wheel->slots[0][slot];
+			assert(ttl_expired(map, entry, wheel->now));
+			evict_entry(map, entry);
+			reclaimed++;
+		}
+
+		uint64_t next = wheel_next_event(wheel);
+		wheel->now = next <= now ? next : now + 1;
+		wheel->cascaded = false;
+	}
+	return reclaimed;
+}
+
+// called at the start of each operation to pick up the time and do a little
+// bit of expiry work on the side
+static inline void
+ttl_tick(icsmap *map)
+{
+	if (map->ttl) {
+		map->ttl_now = map->clock();
+		wheel_advance(map, map->ttl_now, TTL_OP_BUDGET);
+	}
+}
+
+// reclaims everything which has expired so far
+static inline void
+ttl_flush(icsmap *map)
+{
+	if (map->ttl) {
+		map->ttl_now = map->clock();
+		wheel_advance(map, map->ttl_now, UINT32_MAX);
+	}
+}
+
+// find_key, except an expired entry is reclaimed and reported as not found
+static ics_status
+find_live_key(icsmap *map, const key_ref *ref, uint32_t *index)
+{
+	ics_status status;
+	uint32_t probes;
+	if (map->small) {
+		// every slot is looked at, but the keys compared are the real cost
+		status = small_find(map, ref, index);
+		probes = status == ICS_OK ? *index + 1 : map->used;
+	} else if (map->compact) {
+		// the probe went through the index rather than arr
+		uint32_t slot;
+		status = compact_find(map, ref, index, &slot);
+		probes = (slot + map->index_cap - ref->hash % map->index_cap) % map->index_cap + 1;
+	} else {
+		status = find_key(map, ref, index);
+		// number of slots the probe examined, including the one it stopped on
+		probes = probe_count(map, ref->hash, *index, status);
+	}
+	if (status == ICS_OK) {
+		map->hits++;
+		map->hit_probes += probes;
+		map->max_hit_probe = probes > map->max_hit_probe ? probes : map->max_hit_probe;
+	} else {
+		map->misses++;
+		map->miss_probes += probes;
+		map->max_miss_probe = probes > map->max_miss_probe ? probes : map->max_miss_probe;
+	}
+	if (status == ICS_OK && map->ttl && ttl_expired(map, map->arr[*index], map->ttl_now)) {
+		evict_entry(map, map->arr[*index]);
+		return ICS_NOT_FOUND;
+	}
+	return status;
+}
+/** End ttl mode definition */
+
+// frees an entry along with anything it owns outside of the key arena
+static void
+free_entry(icsmap *map, map_entry entry)
+{
+	uint64_t size = entry_size(map);
+	if (map->var_vals) {
+		size += map_entry_var(map, entry)->cap;
+	}
+	if (map->multi) {
+		multi_vals *mv = map_entry_multi(map, entry);
+		mem_free(&map->alloc, mv->spill, (uint64_t)mv->cap * map->valsize);
+	}
+	entry_free(map, entry, size);
+}
+
+/** Begin snapshot definition */
+
+// a chunk of slots as they were when the map first wrote to them after a
+// snapshot, shared by every snapshot which needed a copy at that time
+typedef struct snap_chunk {
+	uint32_t refs;      // number of snapshots holding this copy
+	map_entry slots[SNAP_CHUNK];
+} snap_chunk;
+
+typedef struct icsmap_snapshot {
+	icsmap *map;        // the map the snapshot was taken of
+	map_entry *arr;     // the map's table at the time, read where not saved
+	uint32_t capacity;  // number of slots in arr
+	uint32_t size;      // number of entries at the time
+	uint64_t seq;       // order the snapshot was taken in
+	snap_chunk **saved; // copy of each chunk the map wrote to, NULL until the first
+	ics_bool failed;    // a copy could not be saved, so the view is inconsistent
+	struct icsmap_snapshot *prev;
+	struct icsmap_snapshot *next;
+} map_snapshot;
+
+static inline uint32_t
+snap_chunks(uint32_t capacity)
+{
+	return (capacity + SNAP_CHUNK - 1) / SNAP_CHUNK;
+}
+
+/*
+ * Called before the map writes to the slot at index. Every snapshot still
+ * reading the current table which has no copy of the slot's chunk yet is given
+ * one. The copies are published before the write, so a reader which sees the
+ * write is guaranteed to also see the copy.
+ */
+static void
+snapshot_save(icsmap *map, uint32_t index)
+{
+	uint32_t chunk = index / SNAP_CHUNK;
+	snap_chunk *copy = NULL;
+	map_snapshot *snap;
+	for (snap = map->snap_head; snap != NULL; snap = snap->next) {
+		if (snap->arr != map->arr || snap->failed) {
+			continue;
+		}
+		if (snap->saved == NULL) {
+			snap_chunk **saved = mem_calloc(&map->alloc,
+				(uint64_t)snap_chunks(snap->capacity) * sizeof(snap_chunk *));
+			if (saved == NULL) {
+				__atomic_store_n(&snap->failed, true, __ATOMIC_RELEASE);
+				continue;
+			}
+			__atomic_store_n(&snap->saved, saved, __ATOMIC_RELEASE);
+		}
+		if (snap->saved[chunk] != NULL) {
+			continue;
+		}
+		if (copy == NULL) {
+			copy = mem_alloc(&map->alloc, sizeof(snap_chunk));
+			if (copy == NULL) {
+				__atomic_store_n(&snap->failed, true, __ATOMIC_RELEASE);
+				continue;
+			}
+			uint32_t first = chunk * SNAP_CHUNK;
+			uint32_t count = map->capacity - first < SNAP_CHUNK ? map->capacity - first : SNAP_CHUNK;
+			copy->refs = 0;
+			ics_memcpy(copy->slots, map->arr + first, (uint64_t)count * sizeof(map_entry));
+		}
+		copy->refs++;
+		__atomic_store_n(&snap->saved[chunk], copy, __ATOMIC_RELEASE);
+	}
+	// keeps the slot write which follows from being seen before the copies
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// hands memory which snapshots may still be reading over to be freed once
+// they are released. Should the list fail to grow, the memory is leaked, as
+// freeing it under a reader would be far worse.
+static void
+retire(icsmap *map, void *ptr, uint32_t capacity)
+{
+	if (map->retired_count == map->retired_cap) {
+		uint32_t cap = map->retired_cap != 0 ? map->retired_cap * 2 : 16;
+		retired *grown = mem_realloc(&map->alloc, map->retired,
+			(uint64_t)map->retired_cap * sizeof(retired), (uint64_t)cap * sizeof(retired));
+		if (grown == NULL) {
+			return;
+		}
+		map->retired = grown;
+		map->retired_cap = cap;
+	}
+	retired *r = &map->retired[map->retired_count++];
+	r->ptr = ptr;
+	r->capacity = capacity;
+	r->seq = map->snap_seq;
+}
+
+// frees everything retired before the oldest snapshot still around was taken
+static void
+reclaim_retired(icsmap *map)
+{
+	uint64_t oldest = map->snap_head != NULL ? map->snap_head->seq : UINT64_MAX;
+	uint32_t i, j;
+	// seq only ever grows, so what can be freed is always at the front
+	for (i = 0; i < map->retired_count && map->retired[i].seq < oldest; ++i) {
+		if (map->retired[i].capacity != 0) {
+			table_free(map, map->retired[i].ptr, map->retired[i].capacity);
+		} else {
+			free_entry(map, map->retired[i].ptr);
+		}
+	}
+	for (j = i; j < map->retired_count; ++j) {
+		map->retired[j - i] = map->retired[j];
+	}
+	map->retired_count -= i;
+}
+
+// frees a table the map no longer uses, unless a snapshot is still reading it
+static void
+table_release(icsmap *map, map_entry *arr, uint32_t capacity)
+{
+	map_snapshot *snap;
+	for (snap = map->snap_head; snap != NULL; snap = snap->next) {
+		if (snap->arr == arr) {
+			retire(map, arr, capacity);
+			return;
+		}
+	}
+	table_free(map, arr, capacity);
+}
+
+// gives the entry at index a copy of its own before it is changed in place,
+// leaving the original to the snapshots
+static ics_status
+unshare_entry(icsmap *map, uint32_t index)
+{
+	map_entry entry = map->arr[index];
+	map_entry copy = entry_alloc(map, entry_size(map));
+	if (copy == NULL) {
+		return ICS_NO_MEMORY;
+	}
+	ics_memcpy(copy, entry, entry_size(map));
+	entry_moved(map, copy);
+	set_slot(map, index, copy);
+	retire(map, entry, 0);
+	return ICS_OK;
+}
+
+// the saved copy of a chunk, if the map has written to it since the snapshot
+static inline const snap_chunk *
+snapshot_chunk(const map_snapshot *snap, uint32_t chunk)
+{
+	snap_chunk **saved = __atomic_load_n(&snap->saved, __ATOMIC_ACQUIRE);
+	return saved != NULL ? __atomic_load_n(&saved[chunk], __ATOMIC_ACQUIRE) : NULL;
+}
+
+ics_status
+icsmap_snapshot(icsmap_handle handle, icsmap_snapshot_handle *out)
+{
+	icsmap *map = handle;
+	if (map->owned_keys || map->var_vals || map->multi) {
+		return ICS_INVALID;
+	}
+	map_snapshot *snap = mem_alloc(&map->alloc, sizeof(map_snapshot));
+	if (snap == NULL) {
+		return ICS_NO_MEMORY;
+	}
+	snap->map = map;
+	snap->arr = map->arr;
+	snap->capacity = map->capacity;
+	snap->size = map->size;
+	snap->seq = ++map->snap_seq;
+	snap->saved = NULL;
+	snap->failed = false;
+	snap->prev = map->snap_tail;
+	snap->next = NULL;
+	if (map->snap_tail != NULL) {
+		map->snap_tail->next = snap;
+	} else {
+		map->snap_head = snap;
+	}
+	map->snap_tail = snap;
+	*out = snap;
+	return ICS_OK;
+}
+
+ics_status
+icsmap_snapshot_foreach(const icsmap_snapshot_handle snap, foreach_fn fn, void *data)
+{
+	map_entry slots[SNAP_CHUNK];
+	uint32_t chunk, i;
+	for (chunk = 0; chunk < snap_chunks(snap->capacity); ++chunk) {
+		uint32_t first = chunk * SNAP_CHUNK;
+		uint32_t count = snap->capacity - first < SNAP_CHUNK ? snap->capacity - first : SNAP_CHUNK;
+		const snap_chunk *copy = snapshot_chunk(snap, chunk);
+		if (copy == NULL) {
+			for (i = 0; i < count; ++i) {
+				slots[i] = __atomic_load_n(&snap->arr[first + i], __ATOMIC_RELAXED);
+			}
+			// had the map written to any of these slots it would have saved
+			// a copy first, and the copy is what the snapshot should see
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			copy = snapshot_chunk(snap, chunk);
+		}
+		const map_entry *src = copy != NULL ? copy->slots : slots;
+		for (i = 0; i < count; ++i) {
+			if (!is_empty(src[i]) && !is_deleted(src[i])) {
+				visit_entry(snap->map, src[i], fn, data);
+			}
+		}
+	}
+	return __atomic_load_n(&snap->failed, __ATOMIC_ACQUIRE) ? ICS_NO_MEMORY : ICS_OK;
+}
+
+uint32_t
+icsmap_snapshot_count(const icsmap_snapshot_handle snap)
+{
+	return snap->size;
+}
+
+void
+icsmap_snapshot_release(icsmap_snapshot_handle snap)
+{
+	icsmap *map = snap->map;
+	if (snap->prev != NULL) {
+		snap->prev->next = snap->next;
+	} else {
+		map->snap_head = snap->next;
+	}
+	if (snap->next != NULL) {
+		snap->next->prev = snap->prev;
+	} else {
+		map->snap_tail = snap->prev;
+	}
+	if (snap->saved != NULL) {
+		uint32_t chunk, chunks = snap_chunks(snap->capacity);
+		for (chunk = 0; chunk < chunks; ++chunk) {
+			snap_chunk *copy = snap->saved[chunk];
+			if (copy != NULL && --copy->refs == 0) {
+				mem_free(&map->alloc, copy, sizeof(snap_chunk));
+			}
+		}
+		mem_free(&map->alloc, snap->saved, (uint64_t)chunks * sizeof(snap_chunk *));
+	}
+	mem_free(&map->alloc, snap, sizeof(map_snapshot));
+	reclaim_retired(map);
+}
+/** End snapshot definition */
+
+ics_status
+icsmap_init(icsmap_handle *handle, const icsmap_cfg *cfg)
+{
+	icsmap_allocator alloc;
+	if (resolve_allocator(&cfg->allocator, &alloc) != ICS_OK) {
+		return ICS_INVALID;
+	}
+	// the map is worked out here first, as how big its allocation is depends
+	// on the size of its entries
+	icsmap layout;
+	icsmap *map = &layout;
+	map->alloc = alloc;
+	map->seeded = (cfg->flags & ICSMAP_SEEDED_HASH) != 0;
+	map->fixed_seed = cfg->seed != 0;
+	set_seed(map, map->seeded ? (cfg->seed != 0 ? cfg->seed : random_seed()) : 0);
+	map->reseeds = 0;
+	map->huge_pages = (cfg->flags & ICSMAP_HUGE_PAGES) != 0;
+	map->numa_policy = cfg->numa_policy;
+	map->numa_nodes = cfg->numa_nodes;
+	if (map->numa_policy > ICSMAP_NUMA_INTERLEAVE ||
+		(map->numa_policy != ICSMAP_NUMA_DEFAULT && map->numa_nodes == 0)) {
+		return ICS_INVALID;
+	}
+
+	map->engine = cfg->engine;
+	map->stashed = 0;
+	map->compact = (cfg->flags & ICSMAP_COMPACT) != 0;
+	map->used = 0;
+	map->index = NULL;
+	map->index_cap = 0;
+	map->index_width = 0;
+	map->order = NULL;
+	map->order_cap = 0;
+	map->order_valid = false;
+	map->order_cmp = NULL;
+	map->snap_head = NULL;
+	map->snap_tail = NULL;
+	map->snap_seq = 0;
+	map->retired = NULL;
+	map->retired_count = 0;
+	map->retired_cap = 0;
+	if (map->engine > ICSMAP_HOPSCOTCH || (map->compact && map->engine != ICSMAP_LINEAR)) {
+		return ICS_INVALID;
+	}
+
+	map->size = 0;
+	map->capacity = SMALL_CAPACITY;
+	map->small = true;
+	map->tombstones = 0;
+	map->keysize = cfg->keysize;
+	map->valsize = cfg->valsize;
+	map->get_key  = cfg->get_key;
+
+	map->lru = cfg->max_entries != 0 || cfg->max_bytes != 0;
+	map->max_entries = cfg->max_entries;
+	map->max_bytes = cfg->max_bytes;
+	map->bytes = 0;
+	map->evict = cfg->evict;
+	map->evict_data = cfg->evict_data;
+	map->lru_head = map->lru_tail = NULL;
+	map->key_off = map->lru ? sizeof(lru_link) : 0;
+
+	map->var_vals = (cfg->flags & ICSMAP_VAR_VALS) != 0;
+	if (map->var_vals) {
+		// the value part of an entry is the var_val header from here on
+		map->valsize = sizeof(var_val);
+	}
+	map->valspace = map->valsize;
+
+	map->multi = (cfg->flags & ICSMAP_MULTI) != 0;
+	map->multi_inline = 0;
+	map->values = 0;
+	if (map->multi) {
+		if (map->var_vals || map->valsize == 0) {
+			return ICS_INVALID;
+		}
+		map->multi_inline = map->valsize < MULTI_INLINE_BYTES ? MULTI_INLINE_BYTES / map->valsize : 1;
+		map->valspace = sizeof(multi_vals) + map->multi_inline * map->valsize;
+	}
+
+	map->resizes = 0;
+	map->max_hit_probe = map->max_miss_probe = 0;
+	map->hits = map->misses = 0;
+	map->hit_probes = map->miss_probes = 0;
+
+	map->owned_keys = (cfg->flags & ICSMAP_OWNED_KEYS) != 0;
+	map->arena.head = NULL;
+	map->arena.live = map->arena.total = 0;
+	if (map->owned_keys) {
+		// the key part of an entry is the owned_key record from here on
+		map->keysize = sizeof(owned_key);
+	}
+	map->int_keys = !map->owned_keys && map->get_key == NULL &&
+		(map->keysize == 4 || map->keysize == 8);
+	if ((cfg->flags & ICSMAP_INT_KEYS) != 0 && !map->int_keys) {
+		return ICS_INVALID;
+	}
+
+	map->ttl = (cfg->flags & ICSMAP_TTL) != 0;
+	map->ttl_off = map->key_off;
+	map->clock = cfg->clock != NULL ? cfg->clock : default_clock;
+	map->ttl_now = 0;
+	map->wheel = NULL;
+	if (map->ttl) {
+		map->key_off += sizeof(ttl_link);
+	}
+	map->val_off = map->key_off + map->keysize;
+	if (map->var_vals || map->multi) {
+		// keep the var_val or multi_vals header aligned
+		map->val_off = (map->val_off + 7) & ~7u;
+	}
+
+	if (map->max_bytes != 0 && map->max_bytes < entry_size(map)) {
+		// not even a single entry would fit
+		return ICS_INVALID;
+	}
+
+	map = mem_alloc(&alloc, map_bytes(&layout));
+	if (map == NULL) {
+		return ICS_NO_MEMORY;
+	}
+	*map = layout;
+	map->pool_free = map->var_vals ? 0 : pool_all();
+	table_attach(map, small_table(map), SMALL_CAPACITY);
+	ics_memset(map->arr, 0, table_size(map, SMALL_CAPACITY));
+
+	if (map->ttl) {
+		map->wheel = mem_calloc(&alloc, sizeof(timer_wheel));
+		if (map->wheel == NULL) {
+			mem_free(&alloc, map, map_bytes(map));
+			return ICS_NO_MEMORY;
+		}
+		map->ttl_now = map->clock();
+		map->wheel->now = map->ttl_now;
+	}
+
+	*handle = map;
+	return ICS_OK;
+}
+
+void
+icsmap_deinit(icsmap_handle handle)
+{
+	assert(handle != NULL);
+	icsmap *map = handle;
+	uint32_t i;
+	assert(map->snap_head == NULL);
+	reclaim_retired(map);
+	for (i = 0; i < map->capacity; ++i) {
+		if (!is_empty(map->arr[i]) && !is_deleted(map->arr[i])) {
+			free_entry(map, map->arr[i]);
+		}
+	}
+	icsmap_allocator alloc = map->alloc;
+	table_free(map, map->arr, map->capacity);
+	mem_free(&alloc, map->index, (uint64_t)map->index_cap * map->index_width);
+	mem_free(&alloc, map->order, (uint64_t)map->order_cap * sizeof(map_entry));
+	mem_free(&alloc, map->retired, (uint64_t)map->retired_cap * sizeof(retired));
+	mem_free(&alloc, map->wheel, sizeof(timer_wheel));
+	arena_free(map);
+	mem_free(&alloc, map, map_bytes(map));
+}
+
+// hashes the entry's key again, for when the seed changed under it
+static uint32_t
+entry_rehash(icsmap *map, map_entry entry)
+{
+	key_ref ref;
+	entry_key(map, entry, map, &ref);
+	return key_hash(map, ref.bytes, ref.len);
+}
+
+// the next bigger capacity for the map's engine
+static uint32_t
+grow_capacity(const icsmap *map, uint32_t capacity)
+{
+	if (map->engine == ICSMAP_CUCKOO) {
+		return cuckoo_capacity((capacity - CUCKOO_STASH) / CUCKOO_WAYS * 2);
+	}
+	ics_next_prime(capacity * 2, &capacity);
+	return capacity;
+}
+
+// finds a slot for an entry being moved into a fresh table, which holds no
+// tombstones nor any other entry with the same key
+static ics_status
+place_hash(icsmap *map, uint32_t hash, uint32_t *index)
+{
+	if (map->engine == ICSMAP_CUCKOO) {
+		return cuckoo_make_room(map, hash, index);
+	} else if (map->engine == ICSMAP_HOPSCOTCH) {
+		return hop_make_room(map, hash, index);
+	}
+	uint32_t i = hash % map->capacity;
+	while (!is_empty(map->arr[i])) {
+		i = (i + 1) % map->capacity;
+	}
+	*index = i;
+	return ICS_OK;
+}
+
+// rebuilds a compact map with room for capacity entries, squeezing out the
+// deleted positions while keeping the live ones in order
+static ics_status
+compact_rehash(icsmap *map, uint32_t capacity, ics_bool rekey)
+{
+	uint32_t old_cap = map->capacity, old_used = map->used;
+	map_entry *old_arr = map->arr;
+	uint32_t *old_hashes = map->hashes;
+	void *old_index = map->index;
+	uint64_t old_index_bytes = (uint64_t)map->index_cap * map->index_width;
+
+	map_entry *arr = table_alloc(map, capacity);
+	uint32_t index_cap = index_capacity(capacity), width = index_width(capacity);
+	void *index = mem_calloc(&map->alloc, (uint64_t)index_cap * width);
+	if (arr == NULL || index == NULL) {
+		if (arr != NULL) {
+			table_free(map, arr, capacity);
+		}
+		mem_free(&map->alloc, index, (uint64_t)index_cap * width);
+		return ICS_NO_MEMORY;
+	}
+	table_attach(map, arr, capacity);
+	map->index = index;
+	map->index_cap = index_cap;
+	map->index_width = width;
+	map->used = 0;
+	log("Resize %d -> %d", old_cap, map->capacity);
+
+	uint32_t i;
+	for (i = 0; i < old_used; ++i) {
+		if (!is_deleted(old_arr[i])) {
+			uint32_t hash = rekey ? entry_rehash(map, old_arr[i]) : old_hashes[i];
+			if (rekey && map->owned_keys) {
+				map_entry_owned(map, old_arr[i])->hash = hash;
+			}
+			fill_slot(map, map->used, old_arr[i], hash);
+		}
+	}
+	map->resizes++;
+	map->tombstones = 0;
+	table_release(map, old_arr, old_cap);
+	mem_free(&map->alloc, old_index, old_index_bytes);
+	if (map->owned_keys) {
+		arena_compact(map);
+	}
+	return ICS_OK;
+}
+
+// moves every entry into a fresh array with the given capacity. With rekey,
+// every key is hashed again rather than reusing the stored hashes.
+static ics_status
+rehash(icsmap *map, uint32_t capacity, ics_bool rekey)
+{
+	if (map->compact) {
+		return compact_rehash(map, capacity, rekey);
+	}
+	uint32_t old_cap = map->capacity, old_stashed = map->stashed;
+	map_entry *old_arr = map->arr;
+	uint32_t *old_hashes = map->hashes;
+	uint32_t i, hash, hash_index, grows = 0;
+	for (;;) {
+		map_entry *arr = table_alloc(map, capacity);
+		if (arr == NULL) {
+			return ICS_NO_MEMORY;
+		}
+		table_attach(map, arr, capacity);
+		map->stashed = 0;
+		log("Resize %d -> %d", old_cap, map->capacity);
+
+		// every key is already known to be distinct and the new array has no
+		// tombstones, so placing an entry only needs its hash. Unless
+		// rekeying, neither the keys nor the hash function are touched.
+		for (i = 0; i < old_cap; ++i) {
+			if (!is_empty(old_arr[i]) && !is_deleted(old_arr[i])) {
+				hash = rekey ? entry_rehash(map, old_arr[i]) : old_hashes[i];
+				if (place_hash(map, hash, &hash_index) != ICS_OK) {
+					break;
+				}
+				logentry(map, old_arr[i], "Relocating from old_arr[%d] to map->arr[%d] ", i, hash_index);
+				fill_slot(map, hash_index, old_arr[i], hash);
+			}
+		}
+		if (i == old_cap) {
+			break;
+		}
+		// the cuckoo or hopscotch engine ran out of room, start over bigger
+		table_free(map, map->arr, capacity);
+		table_attach(map, old_arr, old_cap);
+		map->stashed = old_stashed;
+		if (grows++ == ENGINE_MAX_GROWS) {
+			return ICS_FAILURE;
+		}
+		capacity = grow_capacity(map, capacity);
+	}
+	map->resizes++;
+
+	if (rekey && map->owned_keys) {
+		// only now that nothing can fail is it safe to update the cached hashes
+		for (i = 0; i < map->capacity; ++i) {
+			if (!is_empty(map->arr[i])) {
+				map_entry_owned(map, map->arr[i])->hash = map->hashes[i];
+			}
+		}
+	}
+
+	map->tombstones = 0;
+	table_release(map, old_arr, old_cap);
+	if (map->owned_keys) {
+		arena_compact(map);
+	}
+	return ICS_OK;
+}
+
+// the capacity the map's engine needs to hold count entries without growing
+static uint32_t
+fit_capacity(const icsmap *map, uint32_t count)
+{
+	uint32_t capacity;
+	if (map->compact) {
+		return count;
+	} else if (map->engine == ICSMAP_CUCKOO) {
+		return cuckoo_capacity((uint32_t)((uint64_t)count * 100 / CUCKOO_LOAD_FACTOR / CUCKOO_WAYS + 1));
+	}
+	uint32_t load = map->engine == ICSMAP_HOPSCOTCH ? HOP_LOAD_FACTOR : LOAD_FACTOR;
+	ics_next_prime((uint32_t)((uint64_t)count * 100 / load + 1), &capacity);
+	return capacity;
+}
+
+// closes up the gaps removed entries left in a small map's array, in place
+static void
+small_squeeze(icsmap *map)
+{
+	uint32_t i, used = 0;
+	for (i = 0; i < map->used; ++i) {
+		if (!is_deleted(map->arr[i])) {
+			if (i != used) {
+				set_slot(map, used, map->arr[i]);
+				map->hashes[used] = map->hashes[i];
+			}
+			used++;
+		}
+	}
+	for (i = used; i < map->used; ++i) {
+		set_slot(map, i, NULL);
+	}
+	map->used = used;
+	map->tombstones = 0;
+	map->resizes++;
+}
+
+// moves a small map into a table of the engine it was configured with, with
+// room for count entries. The stored hashes come along, keys are not hashed
+// again.
+static ics_status
+small_upgrade(icsmap *map, uint32_t count)
+{
+	map->small = false;
+	ics_status status = rehash(map, fit_capacity(map, count), false);
+	if (status != ICS_OK) {
+		map->small = true;
+	}
+	return status;
+}
+
+static ics_status
+resize(icsmap *map)
+{
+	uint32_t capacity = map->capacity;
+	if (map->small) {
+		// squeezing the array is cheap enough to do whenever it frees a slot
+		if (map->tombstones != 0) {
+			small_squeeze(map);
+			return ICS_OK;
+		}
+		return small_upgrade(map, capacity * 2);
+	} else if (map->compact) {
+		// squeezing out deleted positions makes enough room unless most of
+		// arr is still live
+		return rehash(map, map->size * 2 >= capacity ? capacity * 2 : capacity, false);
+	}
+	// if we got here mostly because of tombstones, clearing them out is enough
+	// and we can rehash into an array of the same size.
+	if (map->engine != ICSMAP_LINEAR || ics_percent(map->size, map->capacity) >= LOAD_FACTOR / 2) {
+		capacity = grow_capacity(map, capacity);
+	}
+	return rehash(map, capacity, false);
+}
+
+// moves a seeded map to a new seed, rehashing every key in place
+static ics_status
+reseed(icsmap *map)
+{
+	uint64_t old_seed = map->seed;
+	// a seed from the config stays reproducible across reseeds
+	set_seed(map, map->fixed_seed ? ics_mix64(old_seed + 1) : random_seed());
+	log("reseed: probe too long, rehashing %d keys", map->size);
+	ics_status status = rehash(map, map->capacity, true);
+	if (status != ICS_OK) {
+		set_seed(map, old_seed);
+		return status;
+	}
+	map->reseeds++;
+	return ICS_OK;
+}
+
+// grows the map up front so that count entries fit without further resizes
+static ics_status
+reserve(icsmap *map, uint32_t count)
+{
+	if (is_dense(map) && count + map->tombstones <= map->capacity) {
+		return ICS_OK;
+	} else if (map->small) {
+		return small_upgrade(map, count);
+	} else if (map->compact) {
+		return rehash(map, count, false);
+	}
+	uint32_t capacity = fit_capacity(map, count);
+	return capacity <= map->capacity ? ICS_OK : rehash(map, capacity, false);
+}
+
+// copies the key into a new entry. Owned keys are copied from ref, anything
+// else is copied as is from key.
+static ics_status
+init_entry_key(icsmap *map, map_entry entry, const void *key, const key_ref *ref)
+{
+	if (map->owned_keys) {
+		return owned_key_init(map, entry, ref);
+	}
+	ics_memcpy(map_entry_key(map, entry), key, map->keysize);
+	return ICS_OK;
+}
+
+// frees the entry at index and leaves a tombstone in its place
+static void
+remove_at(icsmap *map, uint32_t index)
+{
+	map_entry entry = map->arr[index];
+	assert(!is_empty(entry) && !is_deleted(entry));
+	if (map->lru) {
+		lru_unlink(map, entry);
+	}
+	if (map->ttl && map_entry_ttl(map, entry)->expires != 0) {
+		wheel_unlink(map, entry);
+	}
+	map->bytes -= entry_bytes(map, entry);
+	if (map->owned_keys) {
+		arena_release(&map->arena, (uint64_t)map_entry_owned(map, entry)->len + 1);
+	}
+	if (map->multi) {
+		map->values -= map_entry_multi(map, entry)->count;
+	}
+	if (map->snap_head != NULL) {
+		retire(map, entry, 0);
+	} else {
+		free_entry(map, entry);
+	}
+	if (is_dense(map)) {
+		// the position stays taken so later entries keep their order
+		if (!map->small) {
+			compact_index_remove(map, index);
+		}
+		set_slot(map, index, tombstone);
+		map->tombstones++;
+	} else if (map->engine == ICSMAP_CUCKOO) {
+		// a key is only ever looked for in its own buckets, so nothing needs
+		// to know a slot used to be full
+		map->stashed -= in_stash(map, index);
+		set_slot(map, index, NULL);
+	} else if (map->engine == ICSMAP_HOPSCOTCH) {
+		// nor in anything but its own neighbourhood
+		uint32_t home = map->hashes[index] % map->capacity;
+		map->hops[home] &= ~(1u << hop_distance(map, home, index));
+		set_slot(map, index, NULL);
+	} else {
+		set_slot(map, index, tombstone);
+		map->tombstones++;
+	}
+	map->size--;
+	map->order_valid = false;
+}
+
+// initial inline storage for a variable length value of the given length
+static inline uint32_t
+var_val_cap(uint32_t len)
+{
+	return (len + 7) & ~7u;
+}
+
+// an entry may have moved in memory, so everything pointing at it is pointed
+// at its new location
+static void
+entry_moved(icsmap *map, map_entry entry)
+{
+	map->order_valid = false;
+	if (map->lru) {
+		lru_link *link = map_entry_lru(entry);
+		if (link->prev != NULL) {
+			map_entry_lru(link->prev)->next = entry;
+		} else {
+			map->lru_head = entry;
+		}
+		if (link->next != NULL) {
+			map_entry_lru(link->next)->prev = entry;
+		} else {
+			map->lru_tail = entry;
+		}
+	}
+	if (map->ttl && map_entry_ttl(map, entry)->expires != 0) {
+		ttl_link *link = map_entry_ttl(map, entry);
+		if (link->prev != NULL) {
+			map_entry_ttl(map, link->prev)->next = entry;
+		} else {
+			map->wheel->slots[link->slot / WHEEL_SLOTS][link->slot % WHEEL_SLOTS] = entry;
+		}
+		if (link->next != NULL) {
+			map_entry_ttl(map, link->next)->prev = entry;
+		}
+	}
+}
+
+/*
+ * Stores a variable length value in the entry at index. Values which fit in
+ * the current inline storage are written in place, otherwise the entry is
+ * grown with realloc (which often extends it in place too). Storage is given
+ * back if the value shrinks to well under the capacity.
+ */
+static ics_status
+var_val_set(icsmap *map, uint32_t index, const void *val, uint32_t len)
+{
+	map_entry entry = map->arr[index];
+	var_val *vv = map_entry_var(map, entry);
+	uint32_t cap = vv->cap;
+	if (len > cap || len < cap / 4) {
+		uint32_t new_cap = var_val_cap(len);
+		if (len > cap && new_cap < cap + cap / 2) {
+			// grow geometrically so a value growing a bit at a time is
+			// amortized O(1) per byte
+			new_cap = var_val_cap(cap + cap / 2);
+		}
+		if (map->lru && new_cap > cap) {
+			lru_make_room(map, new_cap - cap, entry);
+		}
+		map_entry moved = mem_realloc(&map->alloc, entry, entry_size(map) + cap, entry_size(map) + new_cap);
+		if (moved == NULL) {
+			if (len > cap) {
+				return ICS_NO_MEMORY;
+			}
+			// shrinking failed, the old storage is still good enough
+			moved = entry;
+			new_cap = cap;
+		}
+		map->bytes = map->bytes - cap + new_cap;
+		entry_moved(map, moved);
+		set_slot(map, index, moved);
+		vv = map_entry_var(map, moved);
+		vv->cap = new_cap;
+	}
+	ics_memcpy(var_val_bytes(vv), val, len);
+	vv->len = len;
+	return ICS_OK;
+}
+
+/*
+ * Appends a value to the multimap entry at index, moving the values out to
+ * the spill chunk once they no longer fit inline.
+ */
+static ics_status
+multi_append(icsmap *map, uint32_t index, const void *val)
+{
+	map_entry entry = map->arr[index];
+	multi_vals *mv = map_entry_multi(map, entry);
+	uint32_t room = mv->spill != NULL ? mv->cap : map->multi_inline;
+	if (mv->count == room) {
+		uint32_t cap = room * 2;
+		if (map->lru) {
+			lru_make_room(map, (uint64_t)(cap - mv->cap) * map->valsize, entry);
+		}
+		uint8_t *spill = mem_realloc(&map->alloc, mv->spill, (uint64_t)mv->cap * map->valsize,
+			(uint64_t)cap * map->valsize);
+		if (spill == NULL) {
+			return ICS_NO_MEMORY;
+		}
+		if (mv->spill == NULL) {
+			ics_memcpy(spill, mv + 1, mv->count * map->valsize);
+		}
+		map->bytes += (uint64_t)(cap - mv->cap) * map->valsize;
+		mv->spill = spill;
+		mv->cap = cap;
+	}
+	ics_memcpy(multi_vals_bytes(mv) + (uint64_t)mv->count * map->valsize, val, map->valsize);
+	mv->count++;
+	map->values++;
+	return ICS_OK;
+}
+
+// drops every value of a multimap entry, leaving it empty and inline
+static void
+multi_clear(icsmap *map, map_entry entry)
+{
+	multi_vals *mv = map_entry_multi(map, entry);
+	map->bytes -= (uint64_t)mv->cap * map->valsize;
+	map->values -= mv->count;
+	mem_free(&map->alloc, mv->spill, (uint64_t)mv->cap * map->valsize);
+	mv->spill = NULL;
+	mv->cap = 0;
+	mv->count = 0;
+}
+
+// what put_entry does with a key which is already in the map
+typedef enum put_mode {
+	PUT_REPLACE,        // overwrite the value
+	PUT_KEEP,           // leave the entry alone and return ICS_EXISTS
+	PUT_APPEND          // add the value to the key's values in a multimap
+} put_mode;
+
+// shared by icsmap_put, icsmap_put_ttl, icsmap_put_var, icsmap_insert and
+// icsmap_add. key is the key as passed through the api and ref its probe form.
+// vlen is the length of val for maps with variable length values. expires is
+// 0 for entries which never expire.
+static ics_status
+put_entry(icsmap *map, const void *key, const key_ref *ref, const void *val,
+	uint32_t vlen, uint64_t expires, put_mode mode)
+{
+	if (is_overloaded(map)) {
+		log("icsmap_put: overloaded - resizing");
+		ics_status status = resize(map);
+		if (status != ICS_OK) {
+			return status;
+		}
+	}
+
+	uint32_t index, grows = 0;
+	ics_bool reseeded = false;
+	key_ref rekeyed;
+	ics_status status;
+	for (;;) {
+		status = find_hole(map, ref, &index);
+		ics_bool full = status == ICS_FAILURE;
+		if (!full && (status != ICS_OK || !map->seeded || reseeded || !is_flooded(map, ref, index))) {
+			break;
+		}
+		if (full && grows < ENGINE_MAX_GROWS && is_crowded(map)) {
+			// the cuckoo or hopscotch engine found no room, growing makes some
+			grows++;
+			status = rehash(map, grow_capacity(map, map->capacity), false);
+			if (status != ICS_OK) {
+				return status;
+			}
+		} else if (map->seeded && !reseeded) {
+			// either no size fits the keys sharing this key's hash, or the key
+			// landed where only keys picked to collide would put it. A new
+			// seed splits them up. After a flood, failing to reseed is not
+			// fatal, just slow.
+			reseeded = true;
+			status = reseed(map);
+			if (status == ICS_OK) {
+				rekeyed = *ref;
+				rekeyed.hash = key_hash(map, ref->bytes, ref->len);
+				ref = &rekeyed;
+			} else if (full) {
+				return status;
+			}
+		} else {
+			// with the default hash, keys sharing a hash share it at any size
+			log("icsmap_put: too many keys share a hash");
+			return ICS_FAILURE;
+		}
+	}
+	if (status == ICS_EXISTS && map->ttl && ttl_expired(map, map->arr[index], map->ttl_now)) {
+		// the old entry already expired, reclaim it and insert from scratch
+		evict_entry(map, map->arr[index]);
+		status = find_hole(map, ref, &index);
+	}
+	if (status == ICS_EXISTS && mode == PUT_KEEP) {
+		return ICS_EXISTS;
+	} else if (status == ICS_EXISTS) {
+		if (map->snap_head != NULL) {
+			status = unshare_entry(map, index);
+			if (status != ICS_OK) {
+				return status;
+			}
+		}
+		// value already exists in array replace the value. Owned key bytes
+		// are equal by definition so only borrowed keys are copied again.
+		if (!map->owned_keys) {
+			ics_memcpy(map_entry_key(map, map->arr[index]), key, map->keysize);
+		}
+		lru_touch(map, map->arr[index]);
+		if (map->var_vals) {
+			status = var_val_set(map, index, val, vlen);
+			if (status != ICS_OK) {
+				return status;
+			}
+		} else if (map->multi) {
+			if (mode == PUT_REPLACE) {
+				multi_clear(map, map->arr[index]);
+			}
+			status = multi_append(map, index, val);
+			if (status != ICS_OK) {
+				return status;
+			}
+		} else {
+			ics_memcpy(map_entry_val(map, map->arr[index]), val, map->valsize);
+		}
+		if (map->ttl) {
+			ttl_set(map, map->arr[index], expires);
+		}
+		logentry(map, map->arr[index], "icsmap_put: Key Exists, updating at index %d", index);
+		return ICS_OK;
+	}
+	// else we have found a hole. In cache mode we may need to evict first,
+	// which only ever turns slots into tombstones so the hole stays valid.
+	uint32_t vcap = map->var_vals ? var_val_cap(vlen) : 0;
+	if (map->lru) {
+		lru_make_room(map, entry_size(map) + vcap + (map->owned_keys ? ref->len + 1 : 0), NULL);
+	}
+	map_entry entry = entry_alloc(map, entry_size(map) + vcap);
+	if (entry == NULL) {
+		return ICS_NO_MEMORY;
+	}
+	if (init_entry_key(map, entry, key, ref) != ICS_OK) {
+		entry_free(map, entry, entry_size(map) + vcap);
+		return ICS_NO_MEMORY;
+	}
+	if (map->var_vals) {
+		var_val *vv = map_entry_var(map, entry);
+		vv->cap = vcap;
+		vv->len = vlen;
+		ics_memcpy(var_val_bytes(vv), val, vlen);
+	} else if (map->multi) {
+		multi_vals *mv = map_entry_multi(map, entry);
+		mv->count = 1;
+		mv->cap = 0;
+		mv->spill = NULL;
+		ics_memcpy(mv + 1, val, map->valsize);
+		map->values++;
+	} else {
+		ics_memcpy(map_entry_val(map, entry), val, map->valsize);
+	}
+	logentry(map, entry, "icsmap_put: Does not exist, inserting at index %d", index);
+	if (is_deleted(map->arr[index])) {
+		map->tombstones--;
+	}
+	fill_slot(map, index, entry, ref->hash);
+	map->size += 1;
+	map->order_valid = false;
+	map->bytes += entry_bytes(map, entry);
+	if (map->lru) {
+		lru_push(map, entry);
+	}
+	if (map->ttl) {
+		map_entry_ttl(map, entry)->expires = 0;
+		ttl_set(map, entry, expires);
+	}
+
+	return ICS_OK;
+}
+
+ics_status
+icsmap_put(icsmap_handle handle, const void *key, const void *val)
+{
+	icsmap *map = handle;
+	key_ref ref;
+	if (map->var_vals) {
+		return ICS_INVALID;
+	}
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	return put_entry(map, key, &ref, val, 0, 0, PUT_REPLACE);
+}
+
+ics_status
+icsmap_put_ttl(icsmap_handle handle, const void *key, const void *val, uint64_t ttl)
+{
+	icsmap *map = handle;
+	if (!map->ttl || map->var_vals) {
+		return ICS_INVALID;
+	}
+	key_ref ref;
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	return put_entry(map, key, &ref, val, 0, ttl == 0 ? 0 : map->ttl_now + ttl, PUT_REPLACE);
+}
+
+ics_status
+icsmap_put_var(icsmap_handle handle, const void *key, const void *val, uint32_t len)
+{
+	icsmap *map = handle;
+	if (!map->var_vals) {
+		return ICS_INVALID;
+	}
+	key_ref ref;
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	return put_entry(map, key, &ref, val, len, 0, PUT_REPLACE);
+}
+
+ics_status
+icsmap_get_var(const icsmap_handle handle, const void *key, const void **val, uint32_t *len)
+{
+	icsmap *map = handle;
+	if (!map->var_vals) {
+		return ICS_INVALID;
+	}
+	key_ref ref;
+	uint32_t index;
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	ics_status status = find_live_key(map, &ref, &index);
+	if (status != ICS_OK) {
+		return status;
+	}
+	lru_touch(map, map->arr[index]);
+	var_val *vv = map_entry_var(map, map->arr[index]);
+	*val = var_val_bytes(vv);
+	*len = vv->len;
+	return ICS_OK;
+}
+
+ics_status
+icsmap_insert(icsmap_handle handle, const void *key)
+{
+	icsmap *map = handle;
+	if (map->valsize != 0) {
+		return ICS_INVALID;
+	}
+	key_ref ref;
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	return put_entry(map, key, &ref, NULL, 0, 0, PUT_KEEP);
+}
+
+ics_status
+icsmap_add(icsmap_handle handle, const void *key, const void *val)
+{
+	icsmap *map = handle;
+	if (!map->multi) {
+		return ICS_INVALID;
+	}
+	key_ref ref;
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	return put_entry(map, key, &ref, val, 0, 0, PUT_APPEND);
+}
+
+ics_status
+icsmap_get_all(const icsmap_handle handle, const void *key, icsmap_cursor *cursor)
+{
+	icsmap *map = handle;
+	if (!map->multi) {
+		return ICS_INVALID;
+	}
+	key_ref ref;
+	uint32_t index;
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	ics_status status = find_live_key(map, &ref, &index);
+	if (status != ICS_OK) {
+		return status;
+	}
+	lru_touch(map, map->arr[index]);
+	multi_vals *mv = map_entry_multi(map, map->arr[index]);
+	cursor->vals = multi_vals_bytes(mv);
+	cursor->count = mv->count;
+	cursor->valsize = map->valsize;
+	cursor->pos = 0;
+	return ICS_OK;
+}
+
+const void *
+icsmap_cursor_next(icsmap_cursor *cursor)
+{
+	if (cursor->pos >= cursor->count) {
+		return NULL;
+	}
+	return (const uint8_t *)cursor->vals + (uint64_t)cursor->valsize * cursor->pos++;
+}
+
+ics_status
+icsmap_remove_one(icsmap_handle handle, const void *key, const void *val)
+{
+	icsmap *map = handle;
+	if (!map->multi) {
+		return ICS_INVALID;
+	}
+	key_ref ref;
+	uint32_t index;
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	ics_status status = find_live_key(map, &ref, &index);
+	if (status != ICS_OK) {
+		return status;
+	}
+	multi_vals *mv = map_entry_multi(map, map->arr[index]);
+	uint8_t *vals = multi_vals_bytes(mv);
+	uint32_t i;
+	for (i = 0; i < mv->count; ++i) {
+		if (memcmp(vals + (uint64_t)i * map->valsize, val, map->valsize) == 0) {
+			break;
+		}
+	}
+	if (i == mv->count) {
+		return ICS_NOT_FOUND;
+	}
+	if (mv->count == 1) {
+		// that was the last value, the key goes with it
+		remove_at(map, index);
+		return ICS_OK;
+	}
+	// shift the rest down so the values stay in the order they were added
+	memmove(vals + (uint64_t)i * map->valsize, vals + (uint64_t)(i + 1) * map->valsize,
+		(uint64_t)(mv->count - i - 1) * map->valsize);
+	mv->count--;
+	map->values--;
+	if (mv->spill != NULL && mv->count <= map->multi_inline) {
+		// few enough to move back inline
+		ics_memcpy(mv + 1, mv->spill, mv->count * map->valsize);
+		mem_free(&map->alloc, mv->spill, (uint64_t)mv->cap * map->valsize);
+		map->bytes -= (uint64_t)mv->cap * map->valsize;
+		mv->spill = NULL;
+		mv->cap = 0;
+	}
+	return ICS_OK;
+}
+
+uint32_t
+icsmap_expire(icsmap_handle handle, uint64_t now, uint32_t budget)
+{
+	icsmap *map = handle;
+	if (!map->ttl) {
+		return 0;
+	}
+	map->ttl_now = now;
+	return wheel_advance(map, now, budget);
+}
+
+ics_status
+icsmap_get(const icsmap_handle handle, const void *key, void *out)
+{
+	icsmap *map = handle;
+	key_ref ref;
+	uint32_t index;
+	if (map->var_vals) {
+		// there is no telling whether out is big enough, use icsmap_get_var
+		return ICS_INVALID;
+	}
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	ics_status status = find_live_key(map, &ref, &index);
+	if (status != ICS_OK) {
+		return status;
+	}
+	logkey(key, "Key found at index %d", index);
+
+	assert(!is_empty(map->arr[index]) && !is_deleted(map->arr[index]));
+
+	lru_touch(map, map->arr[index]);
+	if (map->multi) {
+		// the first value added under the key
+		ics_memcpy(out, multi_vals_bytes(map_entry_multi(map, map->arr[index])), map->valsize);
+		return ICS_OK;
+	}
+	ics_memcpy(out, map_entry_val(map, map->arr[index]), map->valsize);
+	return ICS_OK;
+}
+
+ics_status
+icsmap_remove(icsmap_handle handle, const void *key)
+{
+	icsmap *map = handle;
+	key_ref ref;
+	uint32_t index;
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	ics_status status = find_live_key(map, &ref, &index);
+	if (status != ICS_OK) {
+		return status;
+	}
+	// delete by freeing the entry and setting the index to tombstone value
+	remove_at(map, index);
+	return ICS_OK;
+}
+
+ics_status
+icsmap_contains(const icsmap_handle handle, const void *key)
+{
+	icsmap *map = handle;
+	key_ref ref;
+	uint32_t index;
+	ttl_tick(map);
+	probe_key(map, key, &ref);
+	ics_status status = find_live_key(map, &ref, &index);
+	return status == ICS_NOT_FOUND ? ICS_NOT_FOUND : ICS_EXISTS;
+}
+
+void
+icsmap_foreach(const icsmap_handle handle, foreach_fn fn, void *data)
+{
+	icsmap *map = handle;
+	uint32_t i;
+	ttl_flush(map);
+	for (i = 0; i < map->capacity; ++i) {
+		map_entry entry = map->arr[i];
+		if (!is_empty(entry) && !is_deleted(entry)) {
+			visit_entry(map, entry, fn, data);
+		}
+	}
+}
+
+uint32_t
+icsmap_count(const icsmap_handle handle)
+{
+	return ((icsmap *)handle)->size;
+}
+
+uint64_t
+icsmap_value_count(const icsmap_handle handle)
+{
+	icsmap *map = handle;
+	return map->multi ? map->values : map->size;
+}
+
+// copies one key/value pair out to position index of icsmap_all's arrays
+static void
+all_store(const icsmap *map, const map_entry entry, const void *val,
+	void *keys, void *vals, uint64_t index)
+{
+	if (map->owned_keys) {
+		((const void **)keys)[index] = visible_key(map, entry);
+	} else {
+		ics_memcpy((uint8_t *)keys + index * map->keysize, map_entry_key(map, entry), map->keysize);
+	}
+	if (map->var_vals) {
+		visible_val(map, entry, (icsmap_blob *)vals + index);
+	} else {
+		ics_memcpy((uint8_t *)vals + index * map->valsize, val, map->valsize);
+	}
+}
+
+void
+icsmap_all(const icsmap_handle handle, void *keys, void *vals)
+{
+	icsmap *map = handle;
+	uint32_t i, j;
+	uint64_t index = 0;
+	ttl_flush(map);
+	for (i = 0; i < map->capacity; ++i) {
+		map_entry entry = map->arr[i];
+		if (is_empty(entry) || is_deleted(entry)) {
+			continue;
+		}
+		if (map->multi) {
+			multi_vals *mv = map_entry_multi(map, entry);
+			for (j = 0; j < mv->count; ++j) {
+				all_store(map, entry, multi_vals_bytes(mv) + (uint64_t)j * map->valsize,
+					keys, vals, index++);
+			}
+		} else {
+			all_store(map, entry, map_entry_val(map, entry), keys, vals, index++);
+		}
+	}
+	assert(index == icsmap_value_count(map));
+}
+
+/** Begin sorted view definition */
+
+// bits sorted on per radix sort pass
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// whether a NULL comparator can order this map's keys as integers
+static inline ics_bool
+has_int_keys(const icsmap *map)
+{
+	return !map->owned_keys &&
+		(map->keysize == 1 || map->keysize == 2 || map->keysize == 4 || map->keysize == 8);
+}
+
+static inline int
+order_compare(const icsmap *map, icsmap_cmp_fn cmp, const void *a, const void *b)
+{
+	if (cmp != NULL) {
+		return cmp(a, b);
+	}
+	uint64_t x = int_key(map, a), y = int_key(map, b);
+	return x < y ? -1 : x > y;
+}
+
+typedef struct radix_item {
+	uint64_t key;
+	map_entry entry;
+} radix_item;
+
+/*
+ * Least significant digit first radix sort of the map's entries by integer
+ * key. The histograms for every digit are counted in a single pass up front,
+ * and digits which are the same for every key are skipped, so small keys in a
+ * wide type only pay for the passes their bits need.
+ */
+static ics_status
+radix_sort(icsmap *map, map_entry *order, uint32_t n)
+{
+	radix_item *items = mem_alloc(&map->alloc, (uint64_t)n * 2 * sizeof(radix_item));
+	if (items == NULL) {
+		return ICS_NO_MEMORY;
+	}
+	radix_item *src = items, *dst = items + n, *swap;
+	uint32_t passes = map->keysize * 8 / RADIX_BITS;
+	uint32_t counts[8][RADIX_BUCKETS];
+	uint32_t i, pass;
+	ics_memset(counts, 0, sizeof(counts));
+	for (i = 0; i < n; ++i) {
+		src[i].entry = order[i];
+		src[i].key = int_key(map, map_entry_key(map, order[i]));
+		for (pass = 0; pass < passes; ++pass) {
+			counts[pass][(src[i].key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+		}
+	}
+	for (pass = 0; pass < passes; ++pass) {
+		uint32_t shift = pass * RADIX_BITS, *count = counts[pass], sum = 0, b;
+		if (count[(src[0].key >> shift) & (RADIX_BUCKETS - 1)] == n) {
+			continue;
+		}
+		for (b = 0; b < RADIX_BUCKETS; ++b) {
+			uint32_t c = count[b];
+			count[b] = sum;
+			sum += c;
+		}
+		for (i = 0; i < n; ++i) {
+			dst[count[(src[i].key >> shift) & (RADIX_BUCKETS - 1)]++] = src[i];
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+	for (i = 0; i < n; ++i) {
+		order[i] = src[i].entry;
+	}
+	mem_free(&map->alloc, items, (uint64_t)n * 2 * sizeof(radix_item));
+	return ICS_OK;
+}
+
+// merges the sorted runs order[lo, mid) and order[mid, hi) through tmp
+static void
+merge_runs(const icsmap *map, icsmap_cmp_fn cmp, map_entry *order, map_entry *tmp,
+	uint32_t lo, uint32_t mid, uint32_t hi)
+{
+	uint32_t i = lo, j = mid, k = lo;
+	while (i < mid && j < hi) {
+		if (cmp(visible_key(map, order[j]), visible_key(map, order[i])) < 0) {
+			tmp[k++] = order[j++];
+		} else {
+			tmp[k++] = order[i++];
+		}
+	}
+	while (i < mid) {
+		tmp[k++] = order[i++];
+	}
+	while (j < hi) {
+		tmp[k++] = order[j++];
+	}
+	ics_memcpy(order + lo, tmp + lo, (uint64_t)(hi - lo) * sizeof(map_entry));
+}
+
+// bottom up merge sort, since qsort has no way to pass the map through to cmp
+static ics_status
+merge_sort(icsmap *map, icsmap_cmp_fn cmp, map_entry *order, uint32_t n)
+{
+	map_entry *tmp = mem_alloc(&map->alloc, (uint64_t)n * sizeof(map_entry));
+	if (tmp == NULL) {
+		return ICS_NO_MEMORY;
+	}
+	uint32_t width, lo;
+	for (width = 1; width < n; width *= 2) {
+		for (lo = 0; lo + width < n; lo += 2 * width) {
+			uint32_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+			merge_runs(map, cmp, order, tmp, lo, lo + width, hi);
+		}
+	}
+	mem_free(&map->alloc, tmp, (uint64_t)n * sizeof(map_entry));
+	return ICS_OK;
+}
+
+// brings map->order up to date for cmp, sorting again only if entries were
+// added or removed or the order was built with another cmp
+static ics_status
+sort_entries(icsmap *map, icsmap_cmp_fn cmp)
+{
+	if (cmp == NULL && !has_int_keys(map)) {
+		return ICS_INVALID;
+	}
+	ttl_flush(map);
+	if (map->order_valid && map->order_cmp == cmp) {
+		return ICS_OK;
+	}
+	if (map->order_cap < map->size || map->order_cap / 4 > map->size) {
+		map_entry *order = mem_alloc(&map->alloc, (uint64_t)map->size * sizeof(map_entry));
+		if (order == NULL && map->size != 0) {
+			return ICS_NO_MEMORY;
+		}
+		mem_free(&map->alloc, map->order, (uint64_t)map->order_cap * sizeof(map_entry));
+		map->order = order;
+		map->order_cap = order != NULL ? map->size : 0;
+	}
+	uint32_t i, n = 0;
+	for (i = 0; i < map->capacity; ++i) {
+		if (!is_empty(map->arr[i]) && !is_deleted(map->arr[i])) {
+			map->order[n++] = map->arr[i];
+		}
+	}
+	assert(n == map->size);
+	ics_status status = ICS_OK;
+	if (n > 1) {
+		status = cmp == NULL ? radix_sort(map, map->order, n) : merge_sort(map, cmp, map->order, n);
+	}
+	map->order_valid = status == ICS_OK;
+	map->order_cmp = cmp;
+	return status;
+}
+
+// index of the first sorted entry not before key, or after it with after set
+static uint32_t
+order_bound(const icsmap *map, icsmap_cmp_fn cmp, const void *key, ics_bool after)
+{
+	uint32_t lo = 0, hi = map->size;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int c = order_compare(map, cmp, visible_key(map, map->order[mid]), key);
+		if (c < 0 || (after && c == 0)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+ics_status
+icsmap_sorted_iter(const icsmap_handle handle, icsmap_cmp_fn cmp, foreach_fn fn, void *data)
+{
+	return icsmap_range(handle, cmp, NULL, NULL, fn, data);
+}
+
+ics_status
+icsmap_range(const icsmap_handle handle, icsmap_cmp_fn cmp, const void *lo, const void *hi,
+	foreach_fn fn, void *data)
 {
 	icsmap *map = handle;
+	ics_status status = sort_entries(map, cmp);
+	if (status != ICS_OK) {
+		return status;
+	}
+	uint32_t first = lo != NULL ? order_bound(map, cmp, lo, false) : 0;
+	uint32_t last = hi != NULL ? order_bound(map, cmp, hi, true) : map->size;
 	uint32_t i;
+	for (i = first; i < last; ++i) {
+		visit_entry(map, map->order[i], fn, data);
+	}
+	return ICS_OK;
+}
+/** End sorted view definition */
+
+void
+icsmap_stats(const icsmap_handle handle, icsmap_statistics *stats)
+{
+	icsmap *map = handle;
+	ics_memset(stats, 0, sizeof(*stats));
+	stats->capacity = map->index != NULL ? map->index_cap : map->capacity;
+	stats->count = map->size;
+	stats->tombstones = map->tombstones;
+	// entries in the pool are already counted as part of the map
+	stats->bytes = map_bytes(map) + map->bytes + (uint64_t)map->index_cap * map->index_width -
+		pool_in_use(map) * entry_size(map);
+	if (!map->small) {
+		stats->bytes += table_size(map, map->capacity);
+	}
+	if (map->wheel != NULL) {
+		stats->bytes += sizeof(timer_wheel);
+	}
+	stats->resizes = map->resizes;
+	stats->reseeds = map->reseeds;
+	stats->hits = map->hits;
+	stats->misses = map->misses;
+	stats->avg_hit_probe = map->hits != 0 ? (double)map->hit_probes / map->hits : 0;
+	stats->avg_miss_probe = map->misses != 0 ? (double)map->miss_probes / map->misses : 0;
+	stats->max_hit_probe = map->max_hit_probe;
+	stats->max_miss_probe = map->max_miss_probe;
+}
+
+// records a run of len occupied or deleted slots
+static void
+stats_add_cluster(icsmap_statistics *stats, uint32_t len, uint64_t *miss_probes)
+{
+	uint32_t bucket = 0;
+	while (bucket + 1 < ICSMAP_STATS_BUCKETS && (len >> (bucket + 1)) != 0) {
+		bucket++;
+	}
+	stats->clusters[bucket]++;
+	if (len > stats->max_cluster) {
+		stats->max_cluster = len;
+	}
+	// a miss starting j slots into the run examines the len - j slots left
+	// in it plus the empty slot ending it
+	*miss_probes += (uint64_t)len * (len + 1) / 2 + len;
+}
+
+typedef enum slot_state {
+	SLOT_EMPTY,
+	SLOT_DELETED,
+	SLOT_FULL
+} slot_state;
+
+// what is in a linearly probed slot, and the hash of its key if full. In
+// compact mode the probed slots are those of the index.
+static slot_state
+scan_slot(const icsmap *map, uint32_t i, uint32_t *hash)
+{
+	if (map->compact) {
+		uint32_t value = index_get(map, i);
+		if (value == 0) {
+			return SLOT_EMPTY;
+		} else if (value == index_deleted(map)) {
+			return SLOT_DELETED;
+		}
+		*hash = map->hashes[value - 1];
+		return SLOT_FULL;
+	}
+	if (is_empty(map->arr[i])) {
+		return SLOT_EMPTY;
+	} else if (is_deleted(map->arr[i])) {
+		return SLOT_DELETED;
+	}
+	*hash = map->hashes[i];
+	return SLOT_FULL;
+}
+
+void
+icsmap_stats_scan(const icsmap_handle handle, icsmap_statistics *stats)
+{
+	icsmap *map = handle;
+	uint32_t i, start;
+	uint64_t hit_probes = 0, miss_probes = 0;
+	icsmap_stats(map, stats);
+
+	if (map->small) {
+		// no clusters, a hit compares the keys up to its own and a miss
+		// every one
+		for (i = 0; i < map->used; ++i) {
+			if (!is_deleted(map->arr[i])) {
+				hit_probes += i + 1;
+				stats->scan_max_hit_probe = i + 1;
+			}
+		}
+		stats->scan_avg_hit_probe = map->size != 0 ? (double)hit_probes / map->size : 0;
+		stats->scan_max_miss_probe = map->used;
+		stats->scan_avg_miss_probe = map->used;
+		return;
+	} else if (map->engine == ICSMAP_CUCKOO) {
+		// there are no clusters, every miss looks at the same buckets
+		for (i = 0; i < map->capacity; ++i) {
+			if (!is_empty(map->arr[i])) {
+				uint32_t probes = cuckoo_probes(map, map->hashes[i], i);
+				hit_probes += probes;
+				if (probes > stats->scan_max_hit_probe) {
+					stats->scan_max_hit_probe = probes;
+				}
+			}
+		}
+		stats->scan_avg_hit_probe = map->size != 0 ? (double)hit_probes / map->size : 0;
+		stats->scan_max_miss_probe = 2 + (map->stashed != 0);
+		stats->scan_avg_miss_probe = stats->scan_max_miss_probe;
+		return;
+	} else if (map->engine == ICSMAP_HOPSCOTCH) {
+		// no clusters either, a miss compares every key sharing its home
+		for (i = 0; i < map->capacity; ++i) {
+			uint32_t misses = __builtin_popcount(map->hops[i]);
+			miss_probes += misses;
+			if (misses > stats->scan_max_miss_probe) {
+				stats->scan_max_miss_probe = misses;
+			}
+			if (!is_empty(map->arr[i])) {
+				uint32_t probes = hop_probes(map, map->hashes[i], i, ICS_OK);
+				hit_probes += probes;
+				if (probes > stats->scan_max_hit_probe) {
+					stats->scan_max_hit_probe = probes;
+				}
+			}
+		}
+		stats->scan_avg_hit_probe = map->size != 0 ? (double)hit_probes / map->size : 0;
+		stats->scan_avg_miss_probe = (double)miss_probes / map->capacity;
+		return;
+	}
+
+	// start right after an empty slot so no run wraps around the end. The load
+	// factor guarantees there is one.
+	uint32_t slots = stats->capacity, hash;
+	for (start = 0; start < slots && scan_slot(map, start, &hash) != SLOT_EMPTY; ++start)
+		;
+	assert(start < slots);
+
+	uint32_t run = 0;
+	for (i = 1; i <= slots; ++i) {
+		uint32_t index = (start + i) % slots;
+		slot_state state = scan_slot(map, index, &hash);
+		if (state == SLOT_EMPTY) {
+			if (run != 0) {
+				stats_add_cluster(stats, run, &miss_probes);
+			}
+			run = 0;
+			miss_probes++;
+			continue;
+		}
+		run++;
+		if (state == SLOT_DELETED) {
+			continue;
+		}
+		uint32_t probes = (index + slots - hash % slots) % slots + 1;
+		hit_probes += probes;
+		if (probes > stats->scan_max_hit_probe) {
+			stats->scan_max_hit_probe = probes;
+		}
+	}
+	stats->scan_avg_hit_probe = map->size != 0 ? (double)hit_probes / map->size : 0;
+	stats->scan_avg_miss_probe = (double)miss_probes / slots;
+	stats->scan_max_miss_probe = stats->max_cluster + 1;
+}
+
+/** Begin clone definition */
+
+/*
+ * Maps each of the source's entries to its copy while cloning, so the lru and
+ * ttl links between entries can be pointed at the copies. Open addressed on
+ * the entry's address, which needs no hashing of keys.
+ */
+typedef struct entry_remap {
+	map_entry *from;
+	map_entry *to;
+	uint64_t mask;
+} entry_remap;
+
+static inline uint64_t
+remap_slot(const entry_remap *remap, const map_entry entry)
+{
+	return (((uintptr_t)entry >> 4) * 0x9e3779b97f4a7c15ull >> 20) & remap->mask;
+}
+
+static ics_status
+remap_init(icsmap *map, entry_remap *remap, uint32_t count)
+{
+	uint64_t slots = 16;
+	while (slots < (uint64_t)count * 2) {
+		slots *= 2;
+	}
+	remap->mask = slots - 1;
+	remap->from = mem_calloc(&map->alloc, slots * sizeof(map_entry));
+	remap->to = mem_alloc(&map->alloc, slots * sizeof(map_entry));
+	if (remap->from == NULL || remap->to == NULL) {
+		mem_free(&map->alloc, remap->from, slots * sizeof(map_entry));
+		mem_free(&map->alloc, remap->to, slots * sizeof(map_entry));
+		remap->from = remap->to = NULL;
+		return ICS_NO_MEMORY;
+	}
+	return ICS_OK;
+}
+
+static void
+remap_free(icsmap *map, entry_remap *remap)
+{
+	mem_free(&map->alloc, remap->from, (remap->mask + 1) * sizeof(map_entry));
+	mem_free(&map->alloc, remap->to, (remap->mask + 1) * sizeof(map_entry));
+}
+
+static void
+remap_add(entry_remap *remap, const map_entry from, map_entry to)
+{
+	uint64_t i = remap_slot(remap, from);
+	while (remap->from[i] != NULL) {
+		i = (i + 1) & remap->mask;
+	}
+	remap->from[i] = from;
+	remap->to[i] = to;
+}
+
+// the copy of an entry, NULL staying NULL
+static map_entry
+remap_get(const entry_remap *remap, const map_entry from)
+{
+	if (from == NULL) {
+		return NULL;
+	}
+	uint64_t i = remap_slot(remap, from);
+	while (remap->from[i] != from) {
+		i = (i + 1) & remap->mask;
+	}
+	return remap->to[i];
+}
+
+// copies a single entry along with its spilled values, but not its key bytes
+static map_entry
+clone_entry(icsmap *map, const map_entry entry)
+{
+	uint64_t size = entry_size(map);
+	if (map->var_vals) {
+		size += map_entry_var(map, entry)->cap;
+	}
+	map_entry copy = entry_alloc(map, size);
+	if (copy == NULL) {
+		return NULL;
+	}
+	memcpy(copy, entry, size);
+	if (map->multi && map_entry_multi(map, copy)->spill != NULL) {
+		multi_vals *mv = map_entry_multi(map, copy);
+		uint64_t bytes = (uint64_t)mv->cap * map->valsize;
+		uint8_t *spill = mem_alloc(&map->alloc, bytes);
+		if (spill == NULL) {
+			entry_free(map, copy, size);
+			return NULL;
+		}
+		memcpy(spill, mv->spill, bytes);
+		mv->spill = spill;
+	}
+	return copy;
+}
+
+// points the lru and ttl links of every copied entry, and the heads of the
+// lists they are threaded on, at the copies
+static void
+clone_links(icsmap *map, const icsmap *src, const entry_remap *remap)
+{
+	uint32_t i, level, slot;
+	if (map->lru) {
+		map->lru_head = remap_get(remap, src->lru_head);
+		map->lru_tail = remap_get(remap, src->lru_tail);
+	}
+	if (map->ttl) {
+		for (level = 0; level < WHEEL_LEVELS; ++level) {
+			for (slot = 0; slot < WHEEL_SLOTS; ++slot) {
+				map->wheel->slots[level][slot] = remap_get(remap, src->wheel->slots[level][slot]);
+			}
+		}
+	}
 	for (i = 0; i < map->capacity; ++i) {
 		map_entry entry = map->arr[i];
+		if (is_empty(entry) || is_deleted(entry)) {
+			continue;
+		}
+		if (map->lru) {
+			lru_link *link = map_entry_lru(entry);
+			link->prev = remap_get(remap, link->prev);
+			link->next = remap_get(remap, link->next);
+		}
+		// entries which never expire are not in the wheel, and their links
+		// were never set
+		if (map->ttl && map_entry_ttl(map, entry)->expires != 0) {
+			ttl_link *link = map_entry_ttl(map, entry);
+			link->prev = remap_get(remap, link->prev);
+			link->next = remap_get(remap, link->next);
+		}
+	}
+}
+
+ics_status
+icsmap_clone(const icsmap_handle handle, icsmap_handle *out)
+{
+	const icsmap *src = handle;
+	icsmap *map = mem_alloc(&src->alloc, map_bytes(src));
+	if (map == NULL) {
+		return ICS_NO_MEMORY;
+	}
+	*map = *src;
+	map->pool_free = map->var_vals ? 0 : pool_all();
+	// nothing is shared with src from here on, so that deinit can clean up
+	// after a failure at any point
+	map->lru_head = map->lru_tail = NULL;
+	map->wheel = NULL;
+	map->arena.head = NULL;
+	map->arena.live = map->arena.total = 0;
+	map->index = NULL;
+	map->order = NULL;
+	map->order_cap = 0;
+	map->order_valid = false;
+	map->snap_head = map->snap_tail = NULL;
+	map->snap_seq = 0;
+	map->retired = NULL;
+	map->retired_count = map->retired_cap = 0;
+	map->resizes = map->reseeds = 0;
+	map->hits = map->misses = map->hit_probes = map->miss_probes = 0;
+	map->max_hit_probe = map->max_miss_probe = 0;
+
+	map->arr = map->small ? small_table(map) : table_alloc(map, map->capacity);
+	if (map->arr == NULL) {
+		mem_free(&map->alloc, map, map_bytes(map));
+		return ICS_NO_MEMORY;
+	}
+	table_attach(map, map->arr, map->capacity);
+	// the stored hashes and neighbourhood bitmaps come over as they are, and
+	// with them every entry's slot
+	uint64_t table_bytes = (uint64_t)map->capacity * sizeof(map_entry);
+	memcpy(map->hashes, src->hashes, table_size(map, map->capacity) - table_bytes);
+
+	entry_remap remap = { NULL, NULL, 0 };
+	uint32_t i = 0;
+	if (src->index != NULL) {
+		uint64_t index_bytes = (uint64_t)map->index_cap * map->index_width;
+		map->index = mem_alloc(&map->alloc, index_bytes);
+		if (map->index == NULL) {
+			goto fail;
+		}
+		memcpy(map->index, src->index, index_bytes);
+	}
+	if (map->ttl) {
+		map->wheel = mem_alloc(&map->alloc, sizeof(timer_wheel));
+		if (map->wheel == NULL) {
+			goto fail;
+		}
+		memcpy(map->wheel, src->wheel, sizeof(timer_wheel));
+	}
+	if (map->owned_keys && src->arena.live != 0) {
+		// every key goes into one chunk, the same as compacting the arena
+		arena_chunk *chunk = mem_alloc(&map->alloc, sizeof(arena_chunk) + src->arena.live);
+		if (chunk == NULL) {
+			goto fail;
+		}
+		chunk->next = NULL;
+		chunk->size = src->arena.live;
+		chunk->used = 0;
+		map->arena.head = chunk;
+		map->arena.live = map->arena.total = src->arena.live;
+	}
+	if ((map->lru || map->ttl) && remap_init(map, &remap, map->size) != ICS_OK) {
+		goto fail;
+	}
+
+	for (i = 0; i < map->capacity; ++i) {
+		map_entry entry = src->arr[i];
+		if (is_empty(entry) || is_deleted(entry)) {
+			map->arr[i] = entry;
+			continue;
+		}
+		map_entry copy = clone_entry(map, entry);
+		if (copy == NULL) {
+			goto fail;
+		}
+		if (map->owned_keys) {
+			arena_chunk *chunk = map->arena.head;
+			owned_key *owned = map_entry_owned(map, copy);
+			uint64_t len = (uint64_t)owned->len + 1;
+			memcpy(chunk->data + chunk->used, owned->bytes, len);
+			owned->bytes = chunk->data + chunk->used;
+			chunk->used += len;
+		}
+		if (remap.from != NULL) {
+			remap_add(&remap, entry, copy);
+		}
+		map->arr[i] = copy;
+	}
+	assert(!map->owned_keys || map->arena.live == 0 || map->arena.head->used == map->arena.live);
+	if (remap.from != NULL) {
+		clone_links(map, src, &remap);
+		remap_free(map, &remap);
+	}
+	*out = map;
+	return ICS_OK;
+
+fail:
+	if (remap.from != NULL) {
+		remap_free(map, &remap);
+	}
+	// entries not copied yet are still src's, and must not be freed
+	for (; i < map->capacity; ++i) {
+		map->arr[i] = NULL;
+	}
+	icsmap_deinit(map);
+	return ICS_NO_MEMORY;
+}
+/** End clone definition */
+
+/** Begin set algebra definition */
+
+// creates an empty set with the same kind of keys as the given one
+static ics_status
+set_init_like(const icsmap *map, icsmap_handle *out)
+{
+	icsmap_cfg cfg = {
+		.keysize = map->keysize,
+		.valsize = 0,
+		.get_key = map->get_key,
+		.flags = (map->owned_keys ? ICSMAP_OWNED_KEYS : 0) | (map->huge_pages ? ICSMAP_HUGE_PAGES : 0) |
+			(map->seeded ? ICSMAP_SEEDED_HASH : 0) | (map->compact ? ICSMAP_COMPACT : 0),
+		.seed = map->fixed_seed ? map->seed : 0,
+		.engine = map->engine,
+		.allocator = map->alloc,
+		.numa_policy = map->numa_policy,
+		.numa_nodes = map->numa_nodes
+	};
+	return icsmap_init(out, &cfg);
+}
+
+static ics_bool
+set_compatible(const icsmap *a, const icsmap *b)
+{
+	return a->valsize == 0 && b->valsize == 0 && !a->var_vals && !b->var_vals && a->owned_keys == b->owned_keys &&
+		a->keysize == b->keysize && a->get_key == b->get_key;
+}
+
+// inserts every key of src into dst
+static ics_status
+set_add_all(icsmap *dst, const icsmap *src)
+{
+	uint32_t i;
+	key_ref ref;
+	for (i = 0; i < src->capacity; ++i) {
+		map_entry entry = src->arr[i];
 		if (!is_empty(entry) && !is_deleted(entry)) {
-			fn(map_entry_key(map, entry), map_entry_val(map, entry), data);
+			entry_key(src, entry, dst, &ref);
+			ics_status status = put_entry(dst, map_entry_key(src, entry), &ref, NULL, 0, 0, PUT_KEEP);
+			if (status != ICS_OK && status != ICS_EXISTS) {
+				return status;
+			}
+		}
+	}
+	return ICS_OK;
+}
+
+// finishes off a set operation, tearing down the result on failure
+static ics_status
+set_finish(icsmap_handle result, ics_status status, icsmap_handle *out)
+{
+	if (status != ICS_OK) {
+		icsmap_deinit(result);
+		return status;
+	}
+	*out = result;
+	return ICS_OK;
+}
+
+ics_status
+icsmap_union(const icsmap_handle a, const icsmap_handle b, icsmap_handle *out)
+{
+	if (!set_compatible(a, b)) {
+		return ICS_INVALID;
+	}
+	ttl_flush(a);
+	ttl_flush(b);
+	const icsmap *larger = a->size >= b->size ? a : b;
+	const icsmap *smaller = larger == a ? b : a;
+
+	icsmap_handle result;
+	ics_status status = set_init_like(a, &result);
+	if (status != ICS_OK) {
+		return status;
+	}
+	// the larger set is copied over wholesale, only the smaller one's keys
+	// need to be probed for in it.
+	status = reserve(result, larger->size + smaller->size);
+	if (status == ICS_OK) {
+		status = set_add_all(result, larger);
+	}
+	if (status == ICS_OK) {
+		status = set_add_all(result, smaller);
+	}
+	return set_finish(result, status, out);
+}
+
+ics_status
+icsmap_intersect(const icsmap_handle a, const icsmap_handle b, icsmap_handle *out)
+{
+	if (!set_compatible(a, b)) {
+		return ICS_INVALID;
+	}
+	ttl_flush(a);
+	ttl_flush(b);
+	icsmap *larger = a->size >= b->size ? a : b;
+	const icsmap *smaller = larger == a ? b : a;
+
+	icsmap_handle result;
+	ics_status status = set_init_like(a, &result);
+	if (status != ICS_OK) {
+		return status;
+	}
+	status = reserve(result, smaller->size);
+	uint32_t i, index;
+	key_ref ref;
+	for (i = 0; status == ICS_OK && i < smaller->capacity; ++i) {
+		map_entry entry = smaller->arr[i];
+		if (is_empty(entry) || is_deleted(entry)) {
+			continue;
+		}
+		entry_key(smaller, entry, larger, &ref);
+		if (find_key(larger, &ref, &index) == ICS_OK) {
+			entry_key(smaller, entry, result, &ref);
+			status = put_entry(result, map_entry_key(smaller, entry), &ref, NULL, 0, 0, PUT_KEEP);
+		}
+	}
+	return set_finish(result, status, out);
+}
+
+ics_status
+icsmap_difference(const icsmap_handle a, const icsmap_handle b, icsmap_handle *out)
+{
+	if (!set_compatible(a, b)) {
+		return ICS_INVALID;
+	}
+	ttl_flush(a);
+	ttl_flush(b);
+
+	icsmap_handle result;
+	ics_status status = set_init_like(a, &result);
+	if (status != ICS_OK) {
+		return status;
+	}
+	status = reserve(result, a->size);
+	uint32_t i, index;
+	key_ref ref;
+	if (a->size <= b->size) {
+		// keep the keys of a which b does not have
+		for (i = 0; status == ICS_OK && i < a->capacity; ++i) {
+			map_entry entry = a->arr[i];
+			if (is_empty(entry) || is_deleted(entry)) {
+				continue;
+			}
+			entry_key(a, entry, b, &ref);
+			if (find_key(b, &ref, &index) == ICS_NOT_FOUND) {
+				entry_key(a, entry, result, &ref);
+				status = put_entry(result, map_entry_key(a, entry), &ref, NULL, 0, 0, PUT_KEEP);
+			}
+		}
+	} else {
+		// b is the smaller one, so copy a and knock out the keys of b
+		if (status == ICS_OK) {
+			status = set_add_all(result, a);
+		}
+		for (i = 0; status == ICS_OK && i < b->capacity; ++i) {
+			map_entry entry = b->arr[i];
+			if (is_empty(entry) || is_deleted(entry)) {
+				continue;
+			}
+			entry_key(b, entry, result, &ref);
+			if (find_key(result, &ref, &index) == ICS_OK) {
+				remove_at(result, index);
+			}
+		}
+	}
+	return set_finish(result, status, out);
+}
+/** End set algebra definition */
+
+/** Begin merge definition */
+static ics_bool
+merge_compatible(const icsmap *dst, const icsmap *src)
+{
+	return dst != src && !dst->var_vals && !src->var_vals && !dst->multi && !src->multi &&
+		dst->keysize == src->keysize && dst->valsize == src->valsize &&
+		dst->owned_keys == src->owned_keys && dst->get_key == src->get_key;
+}
+
+// shard a key falls in, the same for every map whatever its seed or engine
+static inline uint32_t
+key_shard(const key_ref *ref, uint32_t nshards)
+{
+	return (uint32_t)(hash64_fn((const map_key)ref->bytes, ref->len, 0) % nshards);
+}
+
+ics_status
+icsmap_merge_shard(icsmap_handle dst, const icsmap_handle src, uint32_t shard, uint32_t nshards,
+	icsmap_combine_fn combine, void *ctx)
+{
+	icsmap *map = dst;
+	if (!merge_compatible(map, src) || nshards == 0 || shard >= nshards) {
+		return ICS_INVALID;
+	}
+	// src is only ever read, expired entries included, so that several
+	// shards of it can be merged at once
+	uint64_t now = src->ttl ? src->clock() : 0;
+	ttl_flush(map);
+	ics_status status = reserve(map, map->size + src->size / nshards);
+	uint32_t i, index;
+	key_ref ref;
+	for (i = 0; status == ICS_OK && i < src->capacity; ++i) {
+		map_entry entry = src->arr[i];
+		if (is_empty(entry) || is_deleted(entry) || (src->ttl && ttl_expired(src, entry, now))) {
+			continue;
+		}
+		slot_key(src, i, map, &ref);
+		if (nshards > 1 && key_shard(&ref, nshards) != shard) {
+			continue;
+		}
+		const void *val = map_entry_val(src, entry);
+		uint64_t expires = src->ttl && map->ttl ? map_entry_ttl(src, entry)->expires : 0;
+		if (combine == NULL) {
+			status = put_entry(map, map_entry_key(src, entry), &ref, val, 0, expires, PUT_REPLACE);
+		} else if (find_live_key(map, &ref, &index) == ICS_OK) {
+			// the value is about to change in place, which snapshots must not see
+			if (map->snap_head != NULL) {
+				status = unshare_entry(map, index);
+			}
+			if (status == ICS_OK) {
+				combine(visible_key(map, map->arr[index]), map_entry_val(map, map->arr[index]), val, ctx);
+				// an update in place is a use, the same as a put replacing it
+				lru_touch(map, map->arr[index]);
+			}
+		} else {
+			status = put_entry(map, map_entry_key(src, entry), &ref, val, 0, expires, PUT_KEEP);
 		}
 	}
+	return status;
+}
+
+ics_status
+icsmap_merge(icsmap_handle dst, const icsmap_handle src, icsmap_combine_fn combine, void *ctx)
+{
+	return icsmap_merge_shard(dst, src, 0, 1, combine, ctx);
 }
 
 uint32_t
-icsmap_count(const icsmap_handle handle)
+icsmap_shard(const icsmap_handle handle, const void *key, uint32_t nshards)
 {
-	return ((icsmap *)handle)->size;
+	key_ref ref;
+	ref.bytes = get_key(handle, key, &ref.len);
+	return key_shard(&ref, nshards);
 }
+/** End merge definition */
 
-void
-icsmap_all(const icsmap_handle handle, void *keys, void *vals)
+/** Begin frozen map definition */
+
+// average number of keys sharing a displacement bucket. Larger buckets mean a
+// smaller displacement table but a slower build.
+#define FROZEN_BUCKET_SIZE 4
+
+// how many seeds we try before giving up on building the perfect hash
+#define FROZEN_MAX_SEEDS 32
+
+// how many displacements we try for a single bucket before picking a new seed
+#define FROZEN_MAX_DISPLACEMENTS (1 << 20)
+
+typedef struct icsmap_frozen {
+	uint32_t size;      // number of keys, which is also the number of slots
+	uint32_t nbuckets;  // number of displacement buckets
+
+	uint32_t keysize;   // size of the key
+	uint32_t valsize;   // size of the value
+
+	get_key_fn get_key; // same as the map this was frozen from
+	uint64_t seed;      // seed the perfect hash was built with
+	icsmap_allocator alloc; // same as the map this was frozen from
+
+	uint32_t *disp;     // (d0, d1) displacement pair for each bucket
+	uint8_t *keys;      // packed keys, slot i at keys[i * keysize]
+	uint8_t *vals;      // packed vals, slot i at vals[i * valsize]
+} icsmap_frozen;
+
+// the three values CHD derives from a key: its bucket and the two hashes
+// the bucket's displacement is applied to.
+typedef struct frozen_hash {
+	uint32_t bucket;
+	uint32_t f1;
+	uint32_t f2;
+} frozen_hash;
+
+static const map_key
+frozen_get_key(const icsmap_frozen *frozen, const void *key, uint32_t *size)
+{
+	if (frozen->get_key == NULL) {
+		*size = frozen->keysize;
+		return (const map_key)key;
+	}
+	return (const map_key)frozen->get_key(key, size);
+}
+
+static void
+frozen_hash_key(const icsmap_frozen *frozen, const void *key, uint64_t seed, frozen_hash *res)
+{
+	uint32_t keysize;
+	const map_key k = frozen_get_key(frozen, key, &keysize);
+	uint64_t h = hash64_fn(k, keysize, seed);
+	uint64_t h2 = ics_mix64(h);
+	res->bucket = (uint32_t)(h % frozen->nbuckets);
+	res->f1 = (uint32_t)((h2 & 0xffffffff) % frozen->size);
+	res->f2 = (uint32_t)((h2 >> 32) % frozen->size);
+}
+
+static inline uint32_t
+frozen_position(const icsmap_frozen *frozen, const frozen_hash *fh, uint32_t d0, uint32_t d1)
+{
+	return (uint32_t)((fh->f1 + (uint64_t)d0 * fh->f2 + d1) % frozen->size);
+}
+
+/*
+ * Tries to find a displacement for every bucket using the given seed. Buckets
+ * are placed largest first while the table is still mostly empty; singleton
+ * buckets are handed the remaining free slots directly. On success, pos[i]
+ * holds the slot of entries[i].
+ */
+static ics_status
+frozen_place(icsmap_frozen *frozen, map_entry *entries, frozen_hash *fh,
+	uint32_t *order, uint32_t *bstart, uint8_t *taken, uint32_t *pos, uint64_t seed)
+{
+	uint32_t n = frozen->size, nb = frozen->nbuckets;
+	uint32_t i, b;
+
+	for (i = 0; i < n; ++i) {
+		frozen_hash_key(frozen, entries[i], seed, &fh[i]);
+	}
+
+	// counting sort the entries by bucket. bstart[b] .. bstart[b + 1] are the
+	// indexes in order[] of the entries which fell in bucket b.
+	ics_memset(bstart, 0, sizeof(uint32_t) * (nb + 1));
+	for (i = 0; i < n; ++i) {
+		bstart[fh[i].bucket + 1]++;
+	}
+	uint32_t max_bsize = 0;
+	for (b = 0; b < nb; ++b) {
+		if (bstart[b + 1] > max_bsize) {
+			max_bsize = bstart[b + 1];
+		}
+		bstart[b + 1] += bstart[b];
+	}
+	const icsmap_allocator *alloc = &frozen->alloc;
+	uint32_t *fill = mem_alloc(alloc, sizeof(uint32_t) * nb);
+	uint32_t *bcount = mem_alloc(alloc, sizeof(uint32_t) * (max_bsize + 2));
+	uint32_t *bsorted = mem_alloc(alloc, sizeof(uint32_t) * nb);
+	if (fill == NULL || bcount == NULL || bsorted == NULL) {
+		mem_free(alloc, fill, sizeof(uint32_t) * nb);
+		mem_free(alloc, bcount, sizeof(uint32_t) * (max_bsize + 2));
+		mem_free(alloc, bsorted, sizeof(uint32_t) * nb);
+		return ICS_NO_MEMORY;
+	}
+	ics_memcpy(fill, bstart, sizeof(uint32_t) * nb);
+	for (i = 0; i < n; ++i) {
+		order[fill[fh[i].bucket]++] = i;
+	}
+	mem_free(alloc, fill, sizeof(uint32_t) * nb);
+
+	// now order the buckets largest first, again with a counting sort, so the
+	// hard buckets are placed while the table is still mostly empty.
+	ics_memset(bcount, 0, sizeof(uint32_t) * (max_bsize + 2));
+	for (b = 0; b < nb; ++b) {
+		bcount[max_bsize - (bstart[b + 1] - bstart[b]) + 1]++;
+	}
+	for (i = 0; i <= max_bsize; ++i) {
+		bcount[i + 1] += bcount[i];
+	}
+	for (b = 0; b < nb; ++b) {
+		bsorted[bcount[max_bsize - (bstart[b + 1] - bstart[b])]++] = b;
+	}
+	mem_free(alloc, bcount, sizeof(uint32_t) * (max_bsize + 2));
+
+	ics_memset(taken, 0, n);
+	ics_status status = ICS_OK;
+	uint32_t bi;
+	for (bi = 0; bi < nb; ++bi) {
+		b = bsorted[bi];
+		uint32_t first = bstart[b], bsize = bstart[b + 1] - first;
+		if (bsize <= 1) {
+			// everything after this is a singleton or empty
+			break;
+		}
+
+		uint32_t tries = 0, d0, d1, k;
+		ics_bool placed = false;
+		for (d0 = 0; d0 < n && !placed && tries < FROZEN_MAX_DISPLACEMENTS; ++d0) {
+			for (d1 = 0; d1 < n && tries < FROZEN_MAX_DISPLACEMENTS; ++d1, ++tries) {
+				// mark the candidate slots, backing out on the first clash
+				for (k = 0; k < bsize; ++k) {
+					uint32_t p = frozen_position(frozen, &fh[order[first + k]], d0, d1);
+					if (taken[p]) {
+						break;
+					}
+					taken[p] = 1;
+					pos[order[first + k]] = p;
+				}
+				if (k == bsize) {
+					frozen->disp[b * 2] = d0;
+					frozen->disp[b * 2 + 1] = d1;
+					placed = true;
+					break;
+				}
+				while (k-- > 0) {
+					taken[pos[order[first + k]]] = 0;
+				}
+			}
+		}
+		if (!placed) {
+			status = ICS_FAILURE;
+			break;
+		}
+	}
+
+	// singletons take whatever slots are left over, in order. With d0 = 0 the
+	// position is f1 + d1, so d1 can be solved for directly.
+	uint32_t free_slot = 0;
+	for (; status == ICS_OK && bi < nb; ++bi) {
+		b = bsorted[bi];
+		if (bstart[b + 1] == bstart[b]) {
+			frozen->disp[b * 2] = 0;
+			frozen->disp[b * 2 + 1] = 0;
+			continue;
+		}
+		while (taken[free_slot]) {
+			free_slot++;
+		}
+		i = order[bstart[b]];
+		taken[free_slot] = 1;
+		pos[i] = free_slot;
+		frozen->disp[b * 2] = 0;
+		frozen->disp[b * 2 + 1] = (free_slot + n - fh[i].f1) % n;
+	}
+
+	mem_free(alloc, bsorted, sizeof(uint32_t) * nb);
+	return status;
+}
+
+ics_status
+icsmap_freeze(const icsmap_handle handle, icsmap_frozen_handle *frozen_handle)
 {
 	icsmap *map = handle;
+	if (map->owned_keys || map->var_vals || map->multi) {
+		// frozen maps pack keys and values at a fixed size
+		return ICS_INVALID;
+	}
+	ttl_flush(map);
+	const icsmap_allocator *alloc = &map->alloc;
+	icsmap_frozen *frozen = mem_alloc(alloc, sizeof(icsmap_frozen));
+	if (frozen == NULL) {
+		return ICS_NO_MEMORY;
+	}
+	frozen->alloc = map->alloc;
+	uint32_t n = map->size;
+	frozen->size = n;
+	frozen->nbuckets = n == 0 ? 1 : (n + FROZEN_BUCKET_SIZE - 1) / FROZEN_BUCKET_SIZE;
+	frozen->keysize = map->keysize;
+	frozen->valsize = map->valsize;
+	frozen->get_key = map->get_key;
+	frozen->seed = 0;
+	frozen->disp = mem_calloc(alloc, sizeof(uint32_t) * frozen->nbuckets * 2);
+	frozen->keys = mem_alloc(alloc, (uint64_t)n * map->keysize + 1);
+	frozen->vals = mem_alloc(alloc, (uint64_t)n * map->valsize + 1);
+
+	// scratch space for the build
+	map_entry *entries = mem_alloc(alloc, sizeof(map_entry) * (n + 1));
+	frozen_hash *fh = mem_alloc(alloc, sizeof(frozen_hash) * (n + 1));
+	uint32_t *order = mem_alloc(alloc, sizeof(uint32_t) * (n + 1));
+	uint32_t *bstart = mem_alloc(alloc, sizeof(uint32_t) * (frozen->nbuckets + 1));
+	uint32_t *pos = mem_alloc(alloc, sizeof(uint32_t) * (n + 1));
+	uint8_t *taken = mem_alloc(alloc, n + 1);
+
+	ics_status status = ICS_OK;
+	if (frozen->disp == NULL || frozen->keys == NULL || frozen->vals == NULL ||
+		entries == NULL || fh == NULL || order == NULL || bstart == NULL ||
+		pos == NULL || taken == NULL) {
+		status = ICS_NO_MEMORY;
+		goto out;
+	}
+
 	uint32_t i, index = 0;
 	for (i = 0; i < map->capacity; ++i) {
-		map_entry entry = map->arr[i];
-		if (!is_empty(entry) && !is_deleted(entry)) {
-			ics_memcpy(&keys[index * map->keysize], map_entry_key(map, entry), map->keysize);
-			ics_memcpy(&vals[index * map->valsize], map_entry_val(map, entry), map->valsize);
-			index++;
+		if (!is_empty(map->arr[i]) && !is_deleted(map->arr[i])) {
+			entries[index++] = map->arr[i];
 		}
 	}
-	assert(index == map->size);
+	assert(index == n);
+
+	if (n > 0) {
+		uint32_t attempt;
+		status = ICS_FAILURE;
+		for (attempt = 0; attempt < FROZEN_MAX_SEEDS && status == ICS_FAILURE; ++attempt) {
+			frozen->seed = ics_mix64(attempt + 1);
+			status = frozen_place(frozen, entries, fh, order, bstart, taken, pos, frozen->seed);
+		}
+		if (status != ICS_OK) {
+			log("icsmap_freeze: could not build perfect hash: %s", ics_status_str(status));
+			goto out;
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		ics_memcpy(frozen->keys + (uint64_t)pos[i] * map->keysize,
+			map_entry_key(map, entries[i]), map->keysize);
+		ics_memcpy(frozen->vals + (uint64_t)pos[i] * map->valsize,
+			map_entry_val(map, entries[i]), map->valsize);
+	}
+
+out:
+	mem_free(alloc, entries, sizeof(map_entry) * (n + 1));
+	mem_free(alloc, fh, sizeof(frozen_hash) * (n + 1));
+	mem_free(alloc, order, sizeof(uint32_t) * (n + 1));
+	mem_free(alloc, bstart, sizeof(uint32_t) * (frozen->nbuckets + 1));
+	mem_free(alloc, pos, sizeof(uint32_t) * (n + 1));
+	mem_free(alloc, taken, n + 1);
+	if (status != ICS_OK) {
+		icsmap_frozen_deinit(frozen);
+		return status;
+	}
+	*frozen_handle = frozen;
+	return ICS_OK;
+}
+
+static ics_status
+frozen_find(const icsmap_frozen *frozen, const void *key, uint32_t *index)
+{
+	if (frozen->size == 0) {
+		return ICS_NOT_FOUND;
+	}
+	frozen_hash fh;
+	frozen_hash_key(frozen, key, frozen->seed, &fh);
+	uint32_t p = frozen_position(frozen, &fh,
+		frozen->disp[fh.bucket * 2], frozen->disp[fh.bucket * 2 + 1]);
+
+	// the perfect hash sends every frozen key to its own slot, but keys which
+	// were never frozen land somewhere arbitrary so we still have to compare.
+	uint32_t keysize, candidate_size;
+	const map_key k = frozen_get_key(frozen, key, &keysize);
+	const map_key candidate = frozen_get_key(frozen,
+		frozen->keys + (uint64_t)p * frozen->keysize, &candidate_size);
+	if (candidate_size != keysize || !ics_equal(candidate, k, keysize)) {
+		return ICS_NOT_FOUND;
+	}
+	*index = p;
+	return ICS_OK;
+}
+
+ics_status
+icsmap_frozen_get(const icsmap_frozen_handle frozen, const void *key, void *out)
+{
+	uint32_t index;
+	ics_status status = frozen_find(frozen, key, &index);
+	if (status != ICS_OK) {
+		return status;
+	}
+	ics_memcpy(out, frozen->vals + (uint64_t)index * frozen->valsize, frozen->valsize);
+	return ICS_OK;
+}
+
+ics_status
+icsmap_frozen_contains(const icsmap_frozen_handle frozen, const void *key)
+{
+	uint32_t index;
+	return frozen_find(frozen, key, &index) == ICS_OK ? ICS_EXISTS : ICS_NOT_FOUND;
+}
+
+void
+icsmap_frozen_foreach(const icsmap_frozen_handle frozen, foreach_fn fn, void *data)
+{
+	uint32_t i;
+	for (i = 0; i < frozen->size; ++i) {
+		fn(frozen->keys + (uint64_t)i * frozen->keysize,
+			frozen->vals + (uint64_t)i * frozen->valsize, data);
+	}
+}
+
+uint32_t
+icsmap_frozen_count(const icsmap_frozen_handle frozen)
+{
+	return frozen->size;
+}
+
+void
+icsmap_frozen_deinit(icsmap_frozen_handle frozen)
+{
+	assert(frozen != NULL);
+	icsmap_allocator alloc = frozen->alloc;
+	mem_free(&alloc, frozen->disp, sizeof(uint32_t) * frozen->nbuckets * 2);
+	mem_free(&alloc, frozen->keys, (uint64_t)frozen->size * frozen->keysize + 1);
+	mem_free(&alloc, frozen->vals, (uint64_t)frozen->size * frozen->valsize + 1);
+	mem_free(&alloc, frozen, sizeof(icsmap_frozen));
 }
+/** End frozen map definition */
@@ -13,7 +13,8 @@
 	DEFINE_ICS_ERR(ICS_FAILURE,   "Failure"           )  \
 	DEFINE_ICS_ERR(ICS_NO_MEMORY, "Out of memory"     )  \
 	DEFINE_ICS_ERR(ICS_NOT_FOUND, "Not found"         )  \
-	DEFINE_ICS_ERR(ICS_EXISTS,    "Already Exists"    )      
+	DEFINE_ICS_ERR(ICS_EXISTS,    "Already Exists"    )  \
+	DEFINE_ICS_ERR(ICS_INVALID,   "Invalid argument"  )
 
 /*
  * We define ics_status as an enum here but we do some other macro magic elsewhere
@@ -33,12 +34,236 @@ typedef enum ics_status {
 struct icsmap;
 typedef struct icsmap *icsmap_handle;
 
+/*
+ * A frozen icsmap is a read-only copy of a map built with a minimal perfect
+ * hash. Lookups touch exactly one slot and keys/values are packed with no
+ * empty space. See icsmap_freeze.
+ */
+struct icsmap_frozen;
+typedef struct icsmap_frozen *icsmap_frozen_handle;
+
+/*
+ * A point in time, read-only view of a map, see icsmap_snapshot.
+ */
+struct icsmap_snapshot;
+typedef struct icsmap_snapshot *icsmap_snapshot_handle;
+
 // If the user needs to customize how to extract the key from the supplied void*
 typedef const void * (*get_key_fn) (const void *icsmap_key, uint32_t *size);
 
 // function called on each iteration of the foreach loop
 typedef void (*foreach_fn) (const void *key, const void *val, void *data);
 
+// orders two keys, as handed to foreach_fn, like strcmp: less than, equal to or
+// greater than zero when a sorts before, with or after b
+typedef int (*icsmap_cmp_fn) (const void *a, const void *b);
+
+// resolves a key found in both maps being merged, see icsmap_merge. dst_val is
+// the destination's value and is updated in place; src_val is only read. The
+// values sit right after their keys, so they need not be aligned for their
+// type: read and write them with memcpy.
+typedef void (*icsmap_combine_fn) (const void *key, void *dst_val, const void *src_val, void *ctx);
+
+// function called on each entry evicted from a map in cache mode, or reclaimed
+// after expiring in ttl mode. The key and val are only valid for the duration
+// of the call.
+typedef void (*evict_fn) (const void *key, const void *val, void *data);
+
+// describes a variable length value, see ICSMAP_VAR_VALS
+typedef struct icsmap_blob {
+	const void *data;   // the value bytes, owned by the map
+	uint32_t len;       // number of bytes
+} icsmap_blob;
+
+// walks the values of a key in a multimap, see icsmap_get_all
+typedef struct icsmap_cursor {
+	const void *vals;   // the key's values, stored back to back
+	uint32_t count;     // number of values
+	uint32_t valsize;   // size of each value
+	uint32_t pos;       // index of the value icsmap_cursor_next returns next
+} icsmap_cursor;
+
+// number of buckets in the cluster length histogram of icsmap_stats
+#define ICSMAP_STATS_BUCKETS 16
+
+/*
+ * A snapshot of a map's health, see icsmap_stats. A probe is counted as the
+ * number of slots a lookup examines, so a key found in its home slot has a
+ * probe length of 1. A cluster is a run of occupied or deleted slots between
+ * two empty ones; long clusters make every lookup landing in them slow.
+ */
+typedef struct icsmap_statistics {
+	uint32_t capacity;  // number of slots
+	uint32_t count;     // number of entries
+	uint32_t tombstones;// number of deleted slots
+	uint32_t resizes;   // number of times the table was rehashed
+	uint32_t reseeds;   // number of times a seeded map moved to a new seed
+	uint64_t bytes;     // bytes taken up by the table and its entries
+
+	// gathered as lookups happen, over the lifetime of the map
+	uint64_t hits;      // lookups which found their key
+	uint64_t misses;    // lookups which did not
+	double avg_hit_probe;
+	double avg_miss_probe;
+	uint32_t max_hit_probe;
+	uint32_t max_miss_probe;
+
+	// only filled in by icsmap_stats_scan, from the table's current contents
+	double scan_avg_hit_probe;  // averaged over every entry in the map
+	double scan_avg_miss_probe; // averaged over a miss starting at every slot
+	uint32_t scan_max_hit_probe;
+	uint32_t scan_max_miss_probe;
+	uint32_t max_cluster;       // length of the longest cluster
+	// clusters[i] counts clusters of length 2^i up to 2^(i+1) - 1. The last
+	// bucket also counts everything longer.
+	uint32_t clusters[ICSMAP_STATS_BUCKETS];
+} icsmap_statistics;
+
+// where a map in ttl mode gets the current time from. Any monotonic unit works
+// as long as ttls passed to icsmap_put_ttl use the same one.
+typedef uint64_t (*clock_fn) (void);
+
+/*
+ * Where a map gets its memory from. Every allocation the map, its entries, its
+ * owned keys and anything frozen from it make goes through alloc, and is handed
+ * back to free along with the size it was allocated with, so arenas and pools
+ * need no headers of their own. realloc is optional; without one, growing a
+ * block allocates a new one, copies and frees the old. On failure alloc and
+ * realloc return NULL and realloc leaves the old block alone. ctx is passed
+ * through to each call.
+ *
+ * Leave the whole struct zeroed to use malloc and free. Setting only one of
+ * alloc and free is invalid.
+ */
+typedef void * (*icsmap_alloc_fn) (uint64_t size, void *ctx);
+typedef void (*icsmap_free_fn) (void *ptr, uint64_t size, void *ctx);
+typedef void * (*icsmap_realloc_fn) (void *ptr, uint64_t old_size, uint64_t new_size, void *ctx);
+
+typedef struct icsmap_allocator {
+	icsmap_alloc_fn alloc;
+	icsmap_free_fn free;
+	icsmap_realloc_fn realloc; // or NULL
+	void *ctx;
+} icsmap_allocator;
+
+/*
+ * Optional behaviours which can be switched on through icsmap_cfg.flags.
+ *
+ * ICSMAP_OWNED_KEYS makes keys variable length and owned by the map. get_key
+ * extracts the key bytes from whatever is passed to the api (or, without a
+ * get_key, keys are NUL terminated strings) and icsmap_put copies those bytes
+ * into storage owned by the map, so callers do not need to keep them alive.
+ * keysize is ignored. Keys handed back through foreach and evict callbacks
+ * point at the owned, NUL terminated bytes, and icsmap_all fills keys with one
+ * const void * per entry. Owned keys cannot be frozen.
+ *
+ * ICSMAP_VAR_VALS makes values variable length. They are stored inline in the
+ * entry through icsmap_put_var and read back without a copy by icsmap_get_var;
+ * icsmap_put, icsmap_put_ttl and icsmap_get return ICS_INVALID and valsize is
+ * ignored. Values handed to foreach and evict callbacks point at an icsmap_blob
+ * describing the value, and icsmap_all fills vals with one icsmap_blob per
+ * entry. Variable length values cannot be frozen.
+ *
+ * ICSMAP_MULTI turns the map into a multimap where a key holds a list of
+ * values. icsmap_add appends a value to a key and icsmap_get_all walks them in
+ * the order they were added. A key's values are stored back to back, inline in
+ * the entry while there are only a few of them. icsmap_put replaces all of a
+ * key's values with the one given, icsmap_get returns the first one and
+ * icsmap_remove drops the key along with all its values. icsmap_count counts
+ * keys; foreach and evict callbacks see each key/value pair, as does
+ * icsmap_all, so size its arrays with icsmap_value_count. Multimaps need a
+ * valsize and cannot be frozen or combined with ICSMAP_VAR_VALS.
+ *
+ * ICSMAP_HUGE_PAGES backs the slot array with 2MB transparent huge pages once
+ * it grows past one of them, so random probes into a very large table stop
+ * missing the TLB on nearly every lookup. Such tables are mapped directly
+ * instead of going through icsmap_cfg.allocator. Entries are still allocated
+ * one at a time; give the map an allocator carving them out of huge pages to
+ * cover those too. On systems without transparent huge pages the flag does
+ * nothing, and it is only ever a hint to the kernel.
+ *
+ * ICSMAP_SEEDED_HASH hashes keys with SipHash-1-3 under a per-map secret seed.
+ * The default hash is fast but anyone can compute it, so a set of keys picked
+ * to collide turns every lookup into a scan of the whole cluster; use this for
+ * maps keyed by untrusted input. The seed is random unless icsmap_cfg.seed
+ * fixes one for reproducible tests. Should an insert still probe suspiciously
+ * far, the map moves to a new seed and rehashes every key.
+ *
+ * ICSMAP_COMPACT keeps entries in a dense array in the order they were first
+ * put, with the hash table reduced to an index of positions in that array. The
+ * index uses 1, 2 or 4 bytes a slot depending on how many entries the array
+ * holds, so the sparse part of the table is a fraction of the size of the
+ * usual pointer and hash per slot. Iteration walks the dense array, so it
+ * visits keys in insertion order and is the same on every run. Removed
+ * entries leave a hole in the array until the next resize squeezes it out.
+ * Lookups pay one extra indirection. Only ICSMAP_LINEAR supports it.
+ *
+ * ICSMAP_INT_KEYS treats keys as 4 or 8 byte integers: they are hashed with a
+ * single integer mix instead of a loop over their bytes, and compared with one
+ * load rather than byte by byte. Any map whose keysize is 4 or 8 and which has
+ * no get_key and no owned keys gets this without asking; setting the flag only
+ * makes icsmap_init return ICS_INVALID when the keys do not qualify. Keys are
+ * still compared by value, so padding or byte order does not matter. Unless
+ * ICSMAP_SEEDED_HASH is set, the mix is one to one for 4 byte keys and a
+ * matching stored hash is enough to find the key without touching its entry.
+ */
+typedef enum icsmap_flags {
+	ICSMAP_TTL = 1 << 0, // entries may expire, see icsmap_put_ttl
+	ICSMAP_OWNED_KEYS = 1 << 1, // key bytes are copied into the map, see below
+	ICSMAP_VAR_VALS = 1 << 2,   // values are variable length, see below
+	ICSMAP_MULTI = 1 << 3,      // keys hold a list of values, see below
+	ICSMAP_HUGE_PAGES = 1 << 4, // large tables use huge pages, see below
+	ICSMAP_SEEDED_HASH = 1 << 5,// keys are hashed with a secret seed, see below
+	ICSMAP_COMPACT = 1 << 6,    // dense insertion ordered entries, see below
+	ICSMAP_INT_KEYS = 1 << 7,   // require integer keys, see below
+} icsmap_flags;
+
+/*
+ * How the table is laid out and searched, picked through icsmap_cfg.engine.
+ *
+ * ICSMAP_LINEAR probes slot after slot from a key's home slot. It is the
+ * fastest on average but a probe has no upper bound.
+ *
+ * ICSMAP_CUCKOO splits the table into buckets of 4 slots and gives every key
+ * two buckets it can live in. A lookup examines those two buckets and nothing
+ * else, plus a tiny stash in the rare case a key could not be placed, so the
+ * worst case lookup is as cheap as the average one. Inserts into two full
+ * buckets search for a short chain of entries to move over to their other
+ * buckets. The table fills to 90% before growing and removes leave no
+ * tombstones. Probe lengths in icsmap_statistics count buckets rather than
+ * slots, and clusters are not collected. Keys sharing a full hash share their
+ * buckets at any size, so once there are more of them than two buckets and the
+ * stash hold, icsmap_put returns ICS_FAILURE rather than growing the table
+ * without end. With ICSMAP_SEEDED_HASH the map moves to a new seed instead.
+ *
+ * ICSMAP_HOPSCOTCH keeps every key within 32 slots of its home slot, and each
+ * slot has a bitmap of which of the next 32 hold keys that live there. Lookups
+ * compare only those keys, which are close together in memory. Inserts move
+ * the nearest empty slot back into range by shifting entries along within
+ * their own neighbourhoods. The table fills to 90% before growing and removes
+ * leave no tombstones. Probe lengths count the keys compared, and clusters
+ * are not collected. Keys sharing a full hash share a home slot at any size,
+ * so past 32 of them icsmap_put returns ICS_FAILURE, or with
+ * ICSMAP_SEEDED_HASH moves the map to a new seed.
+ */
+typedef enum icsmap_engine {
+	ICSMAP_LINEAR = 0,
+	ICSMAP_CUCKOO,
+	ICSMAP_HOPSCOTCH,
+} icsmap_engine;
+
+/*
+ * Where the pages of a large slot array are placed on a NUMA machine. Like
+ * ICSMAP_HUGE_PAGES, this applies once the table outgrows a huge page, takes
+ * the table out of the allocator and is a hint the kernel may refuse. Linux
+ * only; elsewhere it is ignored.
+ */
+typedef enum icsmap_numa_policy {
+	ICSMAP_NUMA_DEFAULT = 0,    // wherever the kernel puts it, usually the local node
+	ICSMAP_NUMA_BIND,           // only on the nodes in numa_nodes
+	ICSMAP_NUMA_INTERLEAVE,     // spread page by page across the nodes in numa_nodes
+} icsmap_numa_policy;
+
 /*
  * icsmap_init takes in a config struct. This makes it easy later on to add new
  * features to the map. It also allows clients to be explicit with how they want
@@ -46,8 +271,27 @@ typedef void (*foreach_fn) (const void *key, const void *val, void *data);
  */
 typedef struct icsmap_cfg {
 	uint32_t keysize;   // size of keys passed to put/get
-	uint32_t valsize;   // size of values passed through api
+	uint32_t valsize;   // size of values passed through api, 0 for a set
 	get_key_fn get_key; // a custom function to extract a key, or NULL to use default
+
+	/*
+	 * Cache mode. Setting either limit turns the map into an LRU cache: when
+	 * icsmap_put inserts a new key into a full map, the least recently used
+	 * entry is evicted first. icsmap_get and icsmap_put count as a use,
+	 * icsmap_contains does not.
+	 */
+	uint32_t max_entries; // maximum number of entries, or 0 for no limit
+	uint64_t max_bytes;   // maximum bytes taken up by entries, or 0 for no limit
+	evict_fn evict;       // called on each evicted or expired entry, or NULL
+	void *evict_data;     // passed through to evict
+
+	uint32_t flags;       // bitwise or of icsmap_flags
+	clock_fn clock;       // time source in ttl mode, or NULL for monotonic seconds
+	icsmap_allocator allocator; // memory source, zeroed for malloc and free
+	uint32_t numa_policy; // icsmap_numa_policy for the slot array
+	uint64_t numa_nodes;  // bitmask of nodes numa_policy uses, bit n for node n
+	uint64_t seed;        // seed for ICSMAP_SEEDED_HASH, or 0 for a random one
+	uint32_t engine;      // icsmap_engine, ICSMAP_LINEAR by default
 } icsmap_cfg;
 
 /*
@@ -63,6 +307,15 @@ ics_status_str(ics_status status);
 
 /*
  * icsmap_init initializes the icsmap struct with the given configuration.
+ *
+ * Every map starts out small: up to 8 entries live in the same allocation as
+ * the map along with their slots, so a map that stays that small costs a
+ * single allocation. Lookups compare the stored hashes of all 8 slots at once
+ * instead of probing, and iteration is in insertion order. The first insert
+ * past that moves the map to a table of its engine without hashing any key
+ * again. Entries already in the map's own allocation stay there, and later
+ * entries reuse that room as it frees up.
+ *
  * Args:
  *	handle [IN/OUT]: A handle to an icsmap
  *	cfg    [IN]: A configuration struct
@@ -76,6 +329,8 @@ icsmap_init(icsmap_handle *handle, const icsmap_cfg *cfg);
 /*
  * icsmap_put stores the key and value in the map. If the key already exists,
  * the value is overwritten by the new value. Keys and values are copied by value.
+ * In cache mode, inserting a new key into a full map evicts the least recently
+ * used entries to make room.
  * Args:
  *	handle [IN/OUT]: A handle to an icsmap
  *	key    [IN]: A pointer to a key to search for
@@ -87,6 +342,151 @@ icsmap_init(icsmap_handle *handle, const icsmap_cfg *cfg);
 ics_status
 icsmap_put(icsmap_handle handle, const void *key, const void *val);
 
+/*
+ * icsmap_put_ttl behaves like icsmap_put, except the entry expires ttl clock
+ * units from now (seconds, unless icsmap_cfg.clock says otherwise). Expired
+ * entries are treated as absent by every lookup. They are reclaimed a few at
+ * a time as a side effect of other operations, or in bulk by icsmap_expire.
+ * A ttl of 0 means the entry never expires, which is also what icsmap_put does.
+ * Only available on maps created with ICSMAP_TTL.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	key    [IN]: A pointer to a key to search for
+ *	val    [IN]: A pointer to a val to place in the map
+ *	ttl    [IN]: How long the entry lives for
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_INVALID if the map is not in ttl mode,
+ *	Appropriate error on failure.
+ */
+ics_status
+icsmap_put_ttl(icsmap_handle handle, const void *key, const void *val, uint64_t ttl);
+
+/*
+ * icsmap_put_var stores a variable length value in a map created with
+ * ICSMAP_VAR_VALS. The value bytes are copied into the entry itself. Storing
+ * a bigger value under an existing key grows the entry, in place when the
+ * allocator allows it.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	key    [IN]: A pointer to a key to search for
+ *	val    [IN]: A pointer to the value bytes
+ *	len    [IN]: The number of value bytes
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_INVALID if the map does not have variable length
+ *	values, Appropriate error on failure.
+ */
+ics_status
+icsmap_put_var(icsmap_handle handle, const void *key, const void *val, uint32_t len);
+
+/*
+ * icsmap_get_var looks up a variable length value without copying it.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	key    [IN]: A pointer to a key to search for
+ *	val    [OUT]: Set to point at the value bytes inside the map. They stay
+ *	              valid until the map is next modified.
+ *	len    [OUT]: Set to the number of value bytes
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_NOT_FOUND if the key is not in the map,
+ *	ICS_INVALID if the map does not have variable length values.
+ */
+ics_status
+icsmap_get_var(const icsmap_handle handle, const void *key, const void **val, uint32_t *len);
+
+/*
+ * icsmap_insert adds a key to a set, a map created with a valsize of 0. Unlike
+ * icsmap_put an existing key is left untouched, which makes the result usable
+ * for deduplication.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	key    [IN]: A pointer to the key to add
+ *
+ * Returns:
+ *	ICS_OK if the key was added, ICS_EXISTS if it was already in the set,
+ *	ICS_INVALID if the map is not a set, Appropriate error on failure.
+ */
+ics_status
+icsmap_insert(icsmap_handle handle, const void *key);
+
+/*
+ * icsmap_add appends a value to a key in a multimap, adding the key if it is
+ * not in the map yet.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	key    [IN]: A pointer to a key
+ *	val    [IN]: A pointer to the value to add
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_INVALID if the map is not a multimap,
+ *	Appropriate error on failure.
+ */
+ics_status
+icsmap_add(icsmap_handle handle, const void *key, const void *val);
+
+/*
+ * icsmap_get_all points a cursor at all values of a key in a multimap, to be
+ * stepped through with icsmap_cursor_next. The cursor reads straight out of the
+ * map so it is only valid until the map is next modified.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	key    [IN]: A pointer to a key to search for
+ *	cursor [OUT]: The cursor to set up
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_NOT_FOUND if the key is not in the map,
+ *	ICS_INVALID if the map is not a multimap.
+ */
+ics_status
+icsmap_get_all(const icsmap_handle handle, const void *key, icsmap_cursor *cursor);
+
+/*
+ * Returns:
+ *	the next value of the cursor, or NULL once all of them have been seen
+ */
+const void *
+icsmap_cursor_next(icsmap_cursor *cursor);
+
+/*
+ * icsmap_remove_one removes the first value of a key in a multimap which is
+ * bytewise equal to val. The key itself is removed along with its last value.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	key    [IN]: A pointer to a key
+ *	val    [IN]: A pointer to the value to remove
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_NOT_FOUND if the key does not have that value,
+ *	ICS_INVALID if the map is not a multimap.
+ */
+ics_status
+icsmap_remove_one(icsmap_handle handle, const void *key, const void *val);
+
+/*
+ * Reclaims entries which expired at or before now, calling the evict callback
+ * for each of them. At most budget entries are reclaimed so the amount of work
+ * done per call can be bounded; call again to continue.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	now    [IN]: The current time, in the map's clock units
+ *	budget [IN]: The maximum number of entries to reclaim
+ *
+ * Returns:
+ *	the number of entries reclaimed
+ */
+uint32_t
+icsmap_expire(icsmap_handle handle, uint64_t now, uint32_t budget);
+
 /*
  * icsmap_get retrieves the value associated with the key from the map. Consumers
  * pass in a pointer to a local val with enough space and icsmap handles copying
@@ -148,7 +548,8 @@ void
 icsmap_foreach(const icsmap_handle handle, foreach_fn fn, void *data);
 
 /*
- * Retrieves the number of keys inside the map
+ * Retrieves the number of keys inside the map. In ttl mode this includes
+ * expired entries which have not been reclaimed yet.
  *
  * Args:
  *	handle [IN/OUT]: A handle to an icsmap
@@ -159,6 +560,92 @@ icsmap_foreach(const icsmap_handle handle, foreach_fn fn, void *data);
 uint32_t
 icsmap_count(const icsmap_handle);
 
+/*
+ * Retrieves the number of values inside the map. The same as icsmap_count,
+ * except in a multimap where a key can have many.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *
+ * Returns:
+ *	the number of values in the map
+ */
+uint64_t
+icsmap_value_count(const icsmap_handle handle);
+
+/*
+ * icsmap_stats fills in the counters a map keeps as it goes. It is cheap enough
+ * to call on every metrics scrape. The scan_ fields and the cluster histogram
+ * are left zeroed.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	stats  [OUT]: Where to put the stats
+ *
+ * Returns:
+ *	nothing
+ */
+void
+icsmap_stats(const icsmap_handle handle, icsmap_statistics *stats);
+
+/*
+ * icsmap_stats_scan does the same as icsmap_stats and also walks the whole
+ * table to fill in the scan_ fields and the cluster histogram. It takes time
+ * proportional to the capacity.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	stats  [OUT]: Where to put the stats
+ *
+ * Returns:
+ *	nothing
+ */
+void
+icsmap_stats_scan(const icsmap_handle handle, icsmap_statistics *stats);
+
+/*
+ * Like icsmap_foreach, but visits keys in the order given by cmp. A NULL cmp
+ * orders keys of 1, 2, 4 or 8 bytes as native unsigned integers, using a radix
+ * sort; any other map needs a cmp. The sorted order is kept until the next
+ * insert or remove, so repeated ordered scans with the same cmp only pay for
+ * the sort once. A multimap key's values are visited together, in the order
+ * they were added.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	cmp    [IN]: How to order keys, or NULL for integer keys
+ *	fn     [IN]: The function to call for each key/value
+ *	data   [IN/OUT]: Passed through to fn
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_INVALID if cmp is NULL and the keys are not
+ *	integers, Appropriate error on failure.
+ */
+ics_status
+icsmap_sorted_iter(const icsmap_handle handle, icsmap_cmp_fn cmp, foreach_fn fn, void *data);
+
+/*
+ * icsmap_sorted_iter limited to the keys from lo to hi, both included, found
+ * by binary search in the sorted order. lo and hi are compared with cmp in the
+ * same form keys are handed to fn, and either may be NULL to leave that end
+ * open.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	cmp    [IN]: How to order keys, or NULL for integer keys
+ *	lo     [IN]: The smallest key to visit, or NULL
+ *	hi     [IN]: The largest key to visit, or NULL
+ *	fn     [IN]: The function to call for each key/value
+ *	data   [IN/OUT]: Passed through to fn
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_INVALID if cmp is NULL and the keys are not
+ *	integers, Appropriate error on failure.
+ */
+ics_status
+icsmap_range(const icsmap_handle handle, icsmap_cmp_fn cmp, const void *lo, const void *hi,
+	foreach_fn fn, void *data);
+
 /*
  * Args:
  *	handle [IN/OUT]: A handle to an icsmap
@@ -179,5 +666,212 @@ icsmap_all(const icsmap_handle handle, void *keys, void *vals);
 void
 icsmap_deinit(icsmap_handle handle);
 
+/*
+ * icsmap_merge adds every entry of src to dst. dst is grown up front to hold
+ * both maps, then src is walked once. Keys only src has are inserted, and for
+ * keys both have combine is called with a pointer to dst's value to update in
+ * place, or src's value simply replaces dst's if combine is NULL. Either way
+ * the key counts as used when dst is in cache mode. When both maps hash keys
+ * the same way, src's stored hashes are reused rather than hashing every key
+ * again. src is left untouched.
+ *
+ * Both maps need the same keysize, valsize, get_key and ICSMAP_OWNED_KEYS, and
+ * neither can have variable length values or multiple values per key.
+ *
+ * Args:
+ *	dst     [IN/OUT]: A handle to the map merged into
+ *	src     [IN]: A handle to the map merged from
+ *	combine [IN]: Resolves keys in both maps, or NULL to take src's value
+ *	ctx     [IN/OUT]: Passed through to combine
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_INVALID if the maps are not compatible,
+ *	Appropriate error on failure.
+ */
+ics_status
+icsmap_merge(icsmap_handle dst, const icsmap_handle src, icsmap_combine_fn combine, void *ctx);
+
+/*
+ * icsmap_merge restricted to the keys of src which fall in the given shard out
+ * of nshards. Keys are split on a hash of their bytes alone, so a key lands in
+ * the same shard whichever map it comes from, see icsmap_shard.
+ *
+ * This is the parallel form of icsmap_merge: with one dst per shard, each
+ * thread merges its shard of every src into its own dst. src is only read, so
+ * any number of threads may merge from the same src at once as long as nothing
+ * writes to it meanwhile; each dst still belongs to a single thread. Expired
+ * entries of src are skipped rather than reclaimed.
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_INVALID if the maps are not compatible or shard
+ *	is not below nshards, Appropriate error on failure.
+ */
+ics_status
+icsmap_merge_shard(icsmap_handle dst, const icsmap_handle src, uint32_t shard, uint32_t nshards,
+	icsmap_combine_fn combine, void *ctx);
+
+/*
+ * Returns:
+ *	the shard out of nshards icsmap_merge_shard puts key in
+ */
+uint32_t
+icsmap_shard(const icsmap_handle handle, const void *key, uint32_t nshards);
+
+/*
+ * icsmap_clone creates a copy of the map with the same configuration and
+ * contents. The table is copied as it is, stored hashes included, so every
+ * entry keeps its slot and no key is hashed or probed for again. Entries are
+ * copied one to one, owned keys go into a single arena chunk, and cache and
+ * ttl ordering carry over. The clone's statistics counters start from zero.
+ *
+ * Args:
+ *	handle [IN]: A handle to an icsmap
+ *	out    [OUT]: A handle to the copy, which the caller must deinit
+ *
+ * Returns:
+ *	ICS_OK if successful, Appropriate error on failure.
+ */
+ics_status
+icsmap_clone(const icsmap_handle handle, icsmap_handle *out);
+
+/*
+ * Set algebra over two sets (maps with a valsize of 0) with the same keysize
+ * and get_key. The result is a newly created set which the caller must deinit.
+ * Each operation walks the smaller operand and probes the larger one.
+ *
+ * Args:
+ *	a   [IN]: A handle to a set
+ *	b   [IN]: A handle to a set
+ *	out [OUT]: A handle to the resulting set
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_INVALID if the operands are not compatible sets,
+ *	Appropriate error on failure.
+ */
+ics_status
+icsmap_union(const icsmap_handle a, const icsmap_handle b, icsmap_handle *out);
+
+// the keys in both a and b
+ics_status
+icsmap_intersect(const icsmap_handle a, const icsmap_handle b, icsmap_handle *out);
+
+// the keys in a which are not in b
+ics_status
+icsmap_difference(const icsmap_handle a, const icsmap_handle b, icsmap_handle *out);
+
+/*
+ * icsmap_snapshot takes a read-only view of the map as it is right now, in
+ * constant time. Nothing is copied up front: the snapshot reads the map's own
+ * table, and the first time the map writes to a chunk of 512 slots after the
+ * snapshot was taken it saves a copy of the chunk for the snapshot. Entries
+ * removed or updated since are left alone until every snapshot which could
+ * see them is released, so writes only pay for the odd chunk copy and an
+ * entry copy per update.
+ *
+ * Reading from a snapshot may happen on another thread while the map is being
+ * written to. Taking and releasing snapshots and writing to the map must still
+ * happen one at a time, the same as any other writes to the map. Every
+ * snapshot must be released before the map is deinit'd. Maps with owned keys,
+ * variable length values or multiple values per key cannot be snapshotted.
+ *
+ * Args:
+ *	handle [IN/OUT]: A handle to an icsmap
+ *	snap   [OUT]: A handle to the new snapshot
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_INVALID if the map cannot be snapshotted,
+ *	Appropriate error on failure.
+ */
+ics_status
+icsmap_snapshot(icsmap_handle handle, icsmap_snapshot_handle *snap);
+
+/*
+ * Snapshot counterpart to icsmap_foreach, visiting every entry the map held
+ * when the snapshot was taken with the values it had then.
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_NO_MEMORY if the map ran out of memory saving a
+ *	copy for the snapshot, in which case entries written since the snapshot
+ *	may have been visited as they are now.
+ */
+ics_status
+icsmap_snapshot_foreach(const icsmap_snapshot_handle snap, foreach_fn fn, void *data);
+
+/*
+ * Returns:
+ *	the number of keys in the map when the snapshot was taken
+ */
+uint32_t
+icsmap_snapshot_count(const icsmap_snapshot_handle snap);
+
+/*
+ * Releases the snapshot along with whatever the map kept around for it.
+ */
+void
+icsmap_snapshot_release(icsmap_snapshot_handle snap);
+
+/*
+ * icsmap_freeze builds a read-only copy of the map using a minimal perfect hash
+ * (CHD: compress, hash and displace). Every key present in the map gets its own
+ * slot in a table of exactly icsmap_count slots, so lookups perform a single
+ * probe and the table has no empty space. The source map is left untouched and
+ * can be deinit'd independently of the frozen map.
+ *
+ * Args:
+ *	handle [IN]: A handle to an icsmap
+ *	frozen [OUT]: A handle to the newly created frozen map
+ *
+ * Returns:
+ *	ICS_OK if successful, Appropriate error on failure.
+ */
+ics_status
+icsmap_freeze(const icsmap_handle handle, icsmap_frozen_handle *frozen);
+
+/*
+ * Frozen counterpart to icsmap_get.
+ *
+ * Args:
+ *	frozen [IN]: A handle to a frozen map
+ *	key    [IN]: A pointer to a key to search for
+ *	out    [OUT]: A pointer to a place in memory with enough storage for a map
+ *	              value
+ *
+ * Returns:
+ *	ICS_OK if successful, ICS_NOT_FOUND if the key was not frozen into the map.
+ */
+ics_status
+icsmap_frozen_get(const icsmap_frozen_handle frozen, const void *key, void *out);
+
+/*
+ * Frozen counterpart to icsmap_contains.
+ *
+ * Returns:
+ *	ICS_EXISTS if the key exists, else ICS_NOT_FOUND
+ */
+ics_status
+icsmap_frozen_contains(const icsmap_frozen_handle frozen, const void *key);
+
+/*
+ * Frozen counterpart to icsmap_foreach. Entries are visited in slot order.
+ */
+void
+icsmap_frozen_foreach(const icsmap_frozen_handle frozen, foreach_fn fn, void *data);
+
+/*
+ * Returns:
+ *	the number of keys in the frozen map
+ */
+uint32_t
+icsmap_frozen_count(const icsmap_frozen_handle frozen);
+
+/*
+ * Frees the frozen map.
+ *
+ * Returns:
+ *	nothing
+ */
+void
+icsmap_frozen_deinit(icsmap_frozen_handle frozen);
+
 #endif  /* ICSMAP */
 
@@ -0,0 +1,556 @@
+#ifndef ICSMAP_HPP
+#define ICSMAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+/*
+ * ics::map is a C++ take on icsmap for callers who would otherwise wrap an
+ * icsmap_handle and memcpy every value in and out of it. It is header only and
+ * uses the same table as icsmap.c: a prime sized array probed linearly, with
+ * tombstones for deleted slots which count towards the load factor. Keys and
+ * values are stored in the slots themselves, built in place with placement
+ * new and moved (not byte copied) when the table is rehashed, so any movable
+ * type works.
+ *
+ * The interface follows std::unordered_map where it can. Lookups take any
+ * type Q when both Hash and Eq declare is_transparent, which lets a map keyed
+ * by std::string be searched with a std::string_view or a const char *:
+ *
+ *	ics::map<std::string, int, ics::string_hash, std::equal_to<>> counts;
+ *	counts["apple"] += 1;
+ *	auto it = counts.find(std::string_view("apple"));
+ *
+ * Iterators and references are invalidated by anything which inserts, since
+ * that may rehash. Erasing only invalidates the erased element.
+ */
+namespace ics {
+
+// a transparent hash for string keys, see the example above
+struct string_hash {
+	using is_transparent = void;
+
+	std::size_t operator()(std::string_view s) const noexcept
+	{
+		return std::hash<std::string_view>{}(s);
+	}
+};
+
+template <class K, class V, class Hash = std::hash<K>, class Eq = std::equal_to<K>>
+class map {
+public:
+	using key_type = K;
+	using mapped_type = V;
+	using value_type = std::pair<const K, V>;
+	using size_type = std::size_t;
+	using hasher = Hash;
+	using key_equal = Eq;
+	using reference = value_type &;
+	using const_reference = const value_type &;
+
+	template <bool Const>
+	class basic_iterator;
+
+private:
+	// size the map is initially created with
+	static constexpr size_type initial_size = 13;
+	// percentage the map needs to be filled to before triggering a resize
+	static constexpr size_type load_factor = 33;
+
+	enum : std::uint8_t { slot_empty = 0, slot_full = 1, slot_deleted = 2 };
+
+	struct slot {
+		std::uint8_t state = slot_empty;
+		// value is what callers see. Moving out of a const key is not
+		// allowed, so rehashing goes through the mutable view of the same
+		// bytes, like most open addressing maps do.
+		union {
+			value_type value;
+			std::pair<K, V> mutable_value;
+		};
+
+		slot() noexcept {}
+		~slot() {}
+	};
+
+	template <class F, class = void>
+	struct transparent : std::false_type {};
+	template <class F>
+	struct transparent<F, std::void_t<typename F::is_transparent>> : std::true_type {};
+
+	// lookups by anything other than K need both functors to be transparent.
+	// H and E stand in for Hash and Eq so this is only checked once a lookup
+	// template is actually picked.
+	template <class Q, class H, class E>
+	using if_heterogeneous = std::enable_if_t<transparent<H>::value && transparent<E>::value &&
+		!std::is_convertible_v<const Q &, basic_iterator<true>>, int>;
+
+public:
+	template <bool Const>
+	class basic_iterator {
+		using owner = std::conditional_t<Const, const map, map>;
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = map::value_type;
+		using difference_type = std::ptrdiff_t;
+		using pointer = std::conditional_t<Const, const value_type *, value_type *>;
+		using reference = std::conditional_t<Const, const value_type &, value_type &>;
+
+		basic_iterator() noexcept = default;
+
+		// iterators convert to const_iterators, not the other way around
+		template <bool C = Const, class = std::enable_if_t<C>>
+		basic_iterator(const basic_iterator<false> &it) noexcept
+			: map_(it.map_), index_(it.index_) {}
+
+		reference operator*() const noexcept { return map_->slots_[index_].value; }
+		pointer operator->() const noexcept { return &map_->slots_[index_].value; }
+
+		basic_iterator &operator++() noexcept
+		{
+			index_ = map_->next_full(index_ + 1);
+			return *this;
+		}
+
+		basic_iterator operator++(int) noexcept
+		{
+			basic_iterator it = *this;
+			++*this;
+			return it;
+		}
+
+		friend bool operator==(const basic_iterator &a, const basic_iterator &b) noexcept
+		{
+			return a.index_ == b.index_;
+		}
+
+		friend bool operator!=(const basic_iterator &a, const basic_iterator &b) noexcept
+		{
+			return a.index_ != b.index_;
+		}
+
+	private:
+		friend class map;
+		template <bool>
+		friend class basic_iterator;
+
+		basic_iterator(owner *m, size_type index) noexcept : map_(m), index_(index) {}
+
+		owner *map_ = nullptr;
+		size_type index_ = 0;
+	};
+
+	using iterator = basic_iterator<false>;
+	using const_iterator = basic_iterator<true>;
+
+	map() : map(initial_size) {}
+
+	explicit map(size_type capacity, const Hash &hash = Hash(), const Eq &eq = Eq())
+		: hash_(hash), eq_(eq)
+	{
+		allocate(capacity < initial_size ? initial_size : capacity);
+	}
+
+	map(std::initializer_list<value_type> init) : map()
+	{
+		for (const value_type &v : init) {
+			insert(v);
+		}
+	}
+
+	map(const map &other) : map(other.capacity_, other.hash_, other.eq_)
+	{
+		for (const value_type &v : other) {
+			emplace_new(home(v.first), v);
+		}
+	}
+
+	map(map &&other) noexcept
+		: hash_(std::move(other.hash_)), eq_(std::move(other.eq_)), slots_(other.slots_),
+		  capacity_(other.capacity_), size_(other.size_), tombstones_(other.tombstones_)
+	{
+		other.slots_ = nullptr;
+		other.capacity_ = other.size_ = other.tombstones_ = 0;
+	}
+
+	map &operator=(const map &other)
+	{
+		if (this != &other) {
+			map copy(other);
+			swap(copy);
+		}
+		return *this;
+	}
+
+	map &operator=(map &&other) noexcept
+	{
+		if (this != &other) {
+			map moved(std::move(other));
+			swap(moved);
+		}
+		return *this;
+	}
+
+	~map()
+	{
+		destroy_all();
+		delete[] slots_;
+	}
+
+	void swap(map &other) noexcept
+	{
+		using std::swap;
+		swap(hash_, other.hash_);
+		swap(eq_, other.eq_);
+		swap(slots_, other.slots_);
+		swap(capacity_, other.capacity_);
+		swap(size_, other.size_);
+		swap(tombstones_, other.tombstones_);
+	}
+
+	iterator begin() noexcept { return iterator(this, next_full(0)); }
+	iterator end() noexcept { return iterator(this, capacity_); }
+	const_iterator begin() const noexcept { return const_iterator(this, next_full(0)); }
+	const_iterator end() const noexcept { return const_iterator(this, capacity_); }
+	const_iterator cbegin() const noexcept { return begin(); }
+	const_iterator cend() const noexcept { return end(); }
+
+	size_type size() const noexcept { return size_; }
+	bool empty() const noexcept { return size_ == 0; }
+	size_type capacity() const noexcept { return capacity_; }
+
+	// builds the value in place from args unless the key is already there
+	template <class... Args>
+	std::pair<iterator, bool> try_emplace(const K &key, Args &&...args)
+	{
+		return emplace_key(key, std::piecewise_construct, std::forward_as_tuple(key),
+			std::forward_as_tuple(std::forward<Args>(args)...));
+	}
+
+	template <class... Args>
+	std::pair<iterator, bool> try_emplace(K &&key, Args &&...args)
+	{
+		return emplace_key(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+			std::forward_as_tuple(std::forward<Args>(args)...));
+	}
+
+	template <class... Args>
+	std::pair<iterator, bool> emplace(Args &&...args)
+	{
+		// the key is needed to probe, so build the pair first to get at it
+		std::pair<K, V> v(std::forward<Args>(args)...);
+		return emplace_key(v.first, std::move(v));
+	}
+
+	std::pair<iterator, bool> insert(const value_type &v)
+	{
+		return emplace_key(v.first, v);
+	}
+
+	std::pair<iterator, bool> insert(value_type &&v)
+	{
+		return emplace_key(v.first, std::move(v));
+	}
+
+	template <class M>
+	std::pair<iterator, bool> insert_or_assign(const K &key, M &&val)
+	{
+		auto res = try_emplace(key, std::forward<M>(val));
+		if (!res.second) {
+			res.first->second = std::forward<M>(val);
+		}
+		return res;
+	}
+
+	template <class M>
+	std::pair<iterator, bool> insert_or_assign(K &&key, M &&val)
+	{
+		auto res = try_emplace(std::move(key), std::forward<M>(val));
+		if (!res.second) {
+			res.first->second = std::forward<M>(val);
+		}
+		return res;
+	}
+
+	V &operator[](const K &key) { return try_emplace(key).first->second; }
+	V &operator[](K &&key) { return try_emplace(std::move(key)).first->second; }
+
+	iterator find(const K &key) { return iterator(this, find_index(key)); }
+	const_iterator find(const K &key) const { return const_iterator(this, find_index(key)); }
+	bool contains(const K &key) const { return find_index(key) != capacity_; }
+	size_type count(const K &key) const { return contains(key) ? 1 : 0; }
+	V &at(const K &key) { return slots_[at_index(key)].value.second; }
+	const V &at(const K &key) const { return slots_[at_index(key)].value.second; }
+	size_type erase(const K &key) { return erase_key(key); }
+
+	template <class Q, class H = Hash, class E = Eq, if_heterogeneous<Q, H, E> = 0>
+	iterator find(const Q &key) { return iterator(this, find_index(key)); }
+
+	template <class Q, class H = Hash, class E = Eq, if_heterogeneous<Q, H, E> = 0>
+	const_iterator find(const Q &key) const { return const_iterator(this, find_index(key)); }
+
+	template <class Q, class H = Hash, class E = Eq, if_heterogeneous<Q, H, E> = 0>
+	bool contains(const Q &key) const { return find_index(key) != capacity_; }
+
+	template <class Q, class H = Hash, class E = Eq, if_heterogeneous<Q, H, E> = 0>
+	size_type count(const Q &key) const { return contains(key) ? 1 : 0; }
+
+	template <class Q, class H = Hash, class E = Eq, if_heterogeneous<Q, H, E> = 0>
+	V &at(const Q &key) { return slots_[at_index(key)].value.second; }
+
+	template <class Q, class H = Hash, class E = Eq, if_heterogeneous<Q, H, E> = 0>
+	const V &at(const Q &key) const { return slots_[at_index(key)].value.second; }
+
+	template <class Q, class H = Hash, class E = Eq, if_heterogeneous<Q, H, E> = 0>
+	size_type erase(const Q &key) { return erase_key(key); }
+
+	// returns the iterator following the erased element
+	iterator erase(const_iterator pos)
+	{
+		erase_at(pos.index_);
+		return iterator(this, next_full(pos.index_ + 1));
+	}
+
+	iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+
+	void clear() noexcept
+	{
+		destroy_all();
+		size_ = tombstones_ = 0;
+	}
+
+	// makes room for count elements without rehashing
+	void reserve(size_type count)
+	{
+		size_type needed = count * 100 / load_factor + 1;
+		if (needed > capacity_) {
+			rehash(next_prime(needed));
+		}
+	}
+
+private:
+	template <class Q>
+	size_type home(const Q &key) const
+	{
+		return static_cast<size_type>(hash_(key)) % capacity_;
+	}
+
+	static constexpr bool is_prime(size_type n) noexcept
+	{
+		if (n < 4) {
+			return n > 1;
+		}
+		if (n % 2 == 0 || n % 3 == 0) {
+			return false;
+		}
+		for (size_type i = 5; i * i <= n; i += 6) {
+			if (n % i == 0 || n % (i + 2) == 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static constexpr size_type next_prime(size_type start) noexcept
+	{
+		size_type n = start + 1;
+		while (!is_prime(n)) {
+			++n;
+		}
+		return n;
+	}
+
+	void allocate(size_type capacity)
+	{
+		slots_ = new slot[capacity];
+		capacity_ = capacity;
+		size_ = tombstones_ = 0;
+	}
+
+	void destroy_all() noexcept
+	{
+		for (size_type i = 0; i < capacity_; ++i) {
+			if (slots_[i].state == slot_full) {
+				slots_[i].value.~value_type();
+			}
+			slots_[i].state = slot_empty;
+		}
+	}
+
+	size_type next_full(size_type i) const noexcept
+	{
+		while (i < capacity_ && slots_[i].state != slot_full) {
+			++i;
+		}
+		return i;
+	}
+
+	// index of the key, or capacity_ if it is not in the map
+	template <class Q>
+	size_type find_index(const Q &key) const
+	{
+		if (capacity_ == 0) {
+			// moved from
+			return 0;
+		}
+		size_type start = home(key);
+		size_type i = start;
+		while (slots_[i].state != slot_empty) {
+			// deleted slots do not end the probe, the key may be further along
+			if (slots_[i].state == slot_full && eq_(slots_[i].value.first, key)) {
+				return i;
+			}
+			i = (i + 1) % capacity_;
+			if (i == start) {
+				break;
+			}
+		}
+		return capacity_;
+	}
+
+	// builds a value in the first free slot of a probe from start, for keys
+	// known not to be in the map yet
+	template <class... Args>
+	size_type emplace_new(size_type start, Args &&...args)
+	{
+		size_type i = construct(slots_, capacity_, start, std::forward<Args>(args)...);
+		if (slots_[i].state == slot_deleted) {
+			tombstones_--;
+		}
+		slots_[i].state = slot_full;
+		size_++;
+		return i;
+	}
+
+	// builds a value in the first slot of slots which is not full, probing
+	// from start. Leaves marking the slot full to the caller.
+	template <class... Args>
+	static size_type construct(slot *slots, size_type capacity, size_type start, Args &&...args)
+	{
+		size_type i = start;
+		while (slots[i].state == slot_full) {
+			i = (i + 1) % capacity;
+		}
+		::new (static_cast<void *>(&slots[i].value)) value_type(std::forward<Args>(args)...);
+		return i;
+	}
+
+	template <class Q>
+	size_type at_index(const Q &key) const
+	{
+		size_type i = find_index(key);
+		if (i == capacity_) {
+			throw std::out_of_range("ics::map::at");
+		}
+		return i;
+	}
+
+	template <class Q>
+	size_type erase_key(const Q &key)
+	{
+		size_type i = find_index(key);
+		if (i == capacity_) {
+			return 0;
+		}
+		erase_at(i);
+		return 1;
+	}
+
+	// inserts a value built from args unless key is already in the map
+	template <class... Args>
+	std::pair<iterator, bool> emplace_key(const K &key, Args &&...args)
+	{
+		if (capacity_ == 0) {
+			allocate(initial_size);
+		}
+		size_type i = find_index(key);
+		if (i != capacity_) {
+			return { iterator(this, i), false };
+		}
+		// tombstones count against the load factor too, otherwise a map with a
+		// lot of churn ends up with no empty slots left to stop a probe
+		if ((size_ + tombstones_ + 1) * 100 / capacity_ > load_factor) {
+			grow();
+		}
+		i = emplace_new(home(key), std::forward<Args>(args)...);
+		return { iterator(this, i), true };
+	}
+
+	void erase_at(size_type i) noexcept
+	{
+		slots_[i].value.~value_type();
+		slots_[i].state = slot_deleted;
+		size_--;
+		tombstones_++;
+	}
+
+	void grow()
+	{
+		// if we got here mostly because of tombstones, clearing them out is
+		// enough and we can rehash into an array of the same size
+		size_type capacity = capacity_;
+		if (size_ * 100 / capacity_ >= load_factor / 2) {
+			capacity = next_prime(capacity_ * 2);
+		}
+		rehash(capacity);
+	}
+
+	// the new array is filled in before the map lets go of the old one, and
+	// every key is hashed before any element is touched. Should the hash or
+	// copying an element throw, the map is left exactly as it was.
+	void rehash(size_type capacity)
+	{
+		std::unique_ptr<size_type[]> homes(new size_type[size_]);
+		size_type i, n = 0;
+		for (i = 0; i < capacity_; ++i) {
+			if (slots_[i].state == slot_full) {
+				homes[n++] = static_cast<size_type>(hash_(slots_[i].value.first)) % capacity;
+			}
+		}
+		std::unique_ptr<slot[]> slots(new slot[capacity]);
+		try {
+			for (i = 0, n = 0; i < capacity_; ++i) {
+				if (slots_[i].state == slot_full) {
+					size_type j = construct(slots.get(), capacity, homes[n++],
+						std::move_if_noexcept(slots_[i].mutable_value));
+					slots[j].state = slot_full;
+				}
+			}
+		} catch (...) {
+			for (i = 0; i < capacity; ++i) {
+				if (slots[i].state == slot_full) {
+					slots[i].value.~value_type();
+				}
+			}
+			throw;
+		}
+		// what is left of the old elements goes along with the old array
+		destroy_all();
+		delete[] slots_;
+		slots_ = slots.release();
+		capacity_ = capacity;
+		tombstones_ = 0;
+	}
+
+	Hash hash_;
+	Eq eq_;
+	slot *slots_ = nullptr;
+	size_type capacity_ = 0;
+	size_type size_ = 0;
+	size_type tombstones_ = 0;
+};
+
+} // namespace ics
+
+#endif // ICSMAP_HPP
@@ -0,0 +1,270 @@
+#ifndef ICSMAP_GEN
+#define ICSMAP_GEN
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "icsmap.h"
+
+/*
+ * Generates a map specialized for one key and value type, entirely in this
+ * header. Where icsmap works out sizes and hashes at runtime, the generated
+ * functions know both types at compile time, so key compares and value copies
+ * become plain assignments and the hash function can be inlined.
+ *
+ * The table is the same as icsmap's: a prime sized array probed linearly,
+ * with tombstones for deleted slots which count towards the load factor. The
+ * difference is that keys and values live in the array itself instead of in
+ * separately allocated entries.
+ *
+ *	ICSMAP_DEFINE(name, key_t, val_t, hash, eq)
+ *
+ * defines the map type name and static inline functions prefixed with name_.
+ * hash(const key_t *) returns a uint32_t and eq(const key_t *, const key_t *)
+ * returns non-zero for equal keys. Either may be a function or a macro.
+ * ICSMAP_HASH_BYTES and ICSMAP_EQ_BYTES work for any key without padding:
+ *
+ *	ICSMAP_DEFINE(int_map, int, double, ICSMAP_HASH_BYTES, ICSMAP_EQ_BYTES)
+ *
+ *	int_map map;
+ *	int_map_init(&map);
+ *	int_map_put(&map, 4, 2.5);
+ *	double *val = int_map_find(&map, 4);
+ *	int_map_deinit(&map);
+ *
+ * A map which has been deinit'd is empty and can be used again; the first put
+ * allocates a new array.
+ */
+
+// size a generated map is initially created with
+#define ICSMAP_GEN_INITIAL_SIZE 13
+
+// percentage the map needs to be filled to before triggering a resize
+#define ICSMAP_GEN_LOAD_FACTOR 33
+
+#define ICSMAP_GEN_EMPTY   0
+#define ICSMAP_GEN_FULL    1
+#define ICSMAP_GEN_DELETED 2
+
+// FNV-1a followed by a final mix so every byte affects the low bits
+static inline uint32_t
+icsmap_gen_hash_bytes(const void *key, uint32_t len)
+{
+	const uint8_t *bytes = key;
+	uint32_t h = 2166136261u;
+	uint32_t i;
+	for (i = 0; i < len; ++i) {
+		h = (h ^ bytes[i]) * 16777619u;
+	}
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return h;
+}
+
+#define ICSMAP_HASH_BYTES(k) icsmap_gen_hash_bytes((k), sizeof(*(k)))
+#define ICSMAP_EQ_BYTES(a, b) (memcmp((a), (b), sizeof(*(a))) == 0)
+
+static inline uint32_t
+icsmap_gen_next_prime(uint32_t start)
+{
+	uint32_t n = start + 1, i;
+	for (;; ++n) {
+		if (n < 4) {
+			return n < 2 ? 2 : n;
+		}
+		if (n % 2 == 0 || n % 3 == 0) {
+			continue;
+		}
+		for (i = 5; i * i <= n; i += 6) {
+			if (n % i == 0 || n % (i + 2) == 0) {
+				break;
+			}
+		}
+		if (i * i > n) {
+			return n;
+		}
+	}
+}
+
+#define ICSMAP_DEFINE(name, key_t, val_t, hash, eq)                            \
+                                                                               \
+typedef struct name##_slot {                                                   \
+	key_t key;                                                                 \
+	val_t val;                                                                 \
+	uint8_t state;      /* ICSMAP_GEN_EMPTY, _FULL or _DELETED */              \
+} name##_slot;                                                                 \
+                                                                               \
+typedef struct name {                                                          \
+	uint32_t size;      /* number of elements in the map */                    \
+	uint32_t capacity;  /* size of the underlying array */                     \
+	uint32_t tombstones;/* number of deleted slots in the underlying array */  \
+	name##_slot *slots; /* underlying array */                                 \
+} name;                                                                        \
+                                                                               \
+static inline ics_status                                                       \
+name##_init(name *map)                                                         \
+{                                                                              \
+	map->size = map->tombstones = 0;                                           \
+	map->capacity = ICSMAP_GEN_INITIAL_SIZE;                                   \
+	map->slots = calloc(map->capacity, sizeof(name##_slot));                   \
+	return map->slots != NULL ? ICS_OK : ICS_NO_MEMORY;                        \
+}                                                                              \
+                                                                               \
+static inline void                                                             \
+name##_deinit(name *map)                                                       \
+{                                                                              \
+	free(map->slots);                                                          \
+	map->slots = NULL;                                                         \
+	map->size = map->capacity = map->tombstones = 0;                           \
+}                                                                              \
+                                                                               \
+/* index of the key, or UINT32_MAX if it is not in the map */                  \
+static inline uint32_t                                                         \
+name##_find_index(const name *map, const key_t *key)                           \
+{                                                                              \
+	if (map->capacity == 0) {                                                  \
+		return UINT32_MAX;                                                     \
+	}                                                                          \
+	uint32_t start = (uint32_t)(hash(key)) % map->capacity;                    \
+	uint32_t i = start;                                                        \
+	while (map->slots[i].state != ICSMAP_GEN_EMPTY) {                          \
+		if (map->slots[i].state == ICSMAP_GEN_FULL &&                          \
+			(eq(&map->slots[i].key, key))) {                                   \
+			return i;                                                          \
+		}                                                                      \
+		i = (i + 1) % map->capacity;                                           \
+		if (i == start) {                                                      \
+			break;                                                             \
+		}                                                                      \
+	}                                                                          \
+	return UINT32_MAX;                                                         \
+}                                                                              \
+                                                                               \
+/* rehashes into a new array, growing it unless tombstones made it full */     \
+static inline ics_status                                                       \
+name##_resize(name *map)                                                       \
+{                                                                              \
+	uint32_t capacity = map->capacity, i;                                      \
+	if ((uint64_t)map->size * 100 / map->capacity >=                           \
+		ICSMAP_GEN_LOAD_FACTOR / 2) {                                          \
+		capacity = icsmap_gen_next_prime(map->capacity * 2);                   \
+	}                                                                          \
+	name##_slot *slots = calloc(capacity, sizeof(name##_slot));                \
+	if (slots == NULL) {                                                       \
+		return ICS_NO_MEMORY;                                                  \
+	}                                                                          \
+	for (i = 0; i < map->capacity; ++i) {                                      \
+		if (map->slots[i].state == ICSMAP_GEN_FULL) {                          \
+			uint32_t j = (uint32_t)(hash(&map->slots[i].key)) % capacity;      \
+			while (slots[j].state != ICSMAP_GEN_EMPTY) {                       \
+				j = (j + 1) % capacity;                                        \
+			}                                                                  \
+			slots[j] = map->slots[i];                                          \
+		}                                                                      \
+	}                                                                          \
+	free(map->slots);                                                          \
+	map->slots = slots;                                                        \
+	map->capacity = capacity;                                                  \
+	map->tombstones = 0;                                                       \
+	return ICS_OK;                                                             \
+}                                                                              \
+                                                                               \
+static inline ics_status                                                       \
+name##_put(name *map, key_t key, val_t val)                                    \
+{                                                                              \
+	if (map->capacity == 0 && name##_init(map) != ICS_OK) {                    \
+		return ICS_NO_MEMORY;                                                  \
+	}                                                                          \
+	if ((uint64_t)(map->size + map->tombstones) * 100 / map->capacity >        \
+		ICSMAP_GEN_LOAD_FACTOR) {                                              \
+		ics_status status = name##_resize(map);                                \
+		if (status != ICS_OK) {                                                \
+			return status;                                                     \
+		}                                                                      \
+	}                                                                          \
+	/* like icsmap's find_hole: reuse the first tombstone, but keep going */   \
+	/* until an empty slot in case the key is further along */                 \
+	uint32_t start = (uint32_t)(hash(&key)) % map->capacity;                   \
+	uint32_t i = start, hole = UINT32_MAX;                                     \
+	while (map->slots[i].state != ICSMAP_GEN_EMPTY) {                          \
+		if (map->slots[i].state == ICSMAP_GEN_DELETED) {                       \
+			hole = hole == UINT32_MAX ? i : hole;                              \
+		} else if (eq(&map->slots[i].key, &key)) {                             \
+			map->slots[i].val = val;                                           \
+			return ICS_OK;                                                     \
+		}                                                                      \
+		i = (i + 1) % map->capacity;                                           \
+		if (i == start) {                                                      \
+			break;                                                             \
+		}                                                                      \
+	}                                                                          \
+	if (hole != UINT32_MAX) {                                                  \
+		map->tombstones--;                                                     \
+		i = hole;                                                              \
+	}                                                                          \
+	map->slots[i].key = key;                                                   \
+	map->slots[i].val = val;                                                   \
+	map->slots[i].state = ICSMAP_GEN_FULL;                                     \
+	map->size++;                                                               \
+	return ICS_OK;                                                             \
+}                                                                              \
+                                                                               \
+/* pointer to the value stored for key, valid until the next put */            \
+static inline val_t *                                                          \
+name##_find(const name *map, key_t key)                                        \
+{                                                                              \
+	uint32_t i = name##_find_index(map, &key);                                 \
+	return i != UINT32_MAX ? &map->slots[i].val : NULL;                        \
+}                                                                              \
+                                                                               \
+static inline ics_status                                                       \
+name##_get(const name *map, key_t key, val_t *out)                             \
+{                                                                              \
+	uint32_t i = name##_find_index(map, &key);                                 \
+	if (i == UINT32_MAX) {                                                     \
+		return ICS_NOT_FOUND;                                                  \
+	}                                                                          \
+	*out = map->slots[i].val;                                                  \
+	return ICS_OK;                                                             \
+}                                                                              \
+                                                                               \
+static inline ics_status                                                       \
+name##_contains(const name *map, key_t key)                                    \
+{                                                                              \
+	return name##_find_index(map, &key) != UINT32_MAX ?                        \
+		ICS_EXISTS : ICS_NOT_FOUND;                                            \
+}                                                                              \
+                                                                               \
+static inline ics_status                                                       \
+name##_remove(name *map, key_t key)                                            \
+{                                                                              \
+	uint32_t i = name##_find_index(map, &key);                                 \
+	if (i == UINT32_MAX) {                                                     \
+		return ICS_NOT_FOUND;                                                  \
+	}                                                                          \
+	map->slots[i].state = ICSMAP_GEN_DELETED;                                  \
+	map->size--;                                                               \
+	map->tombstones++;                                                         \
+	return ICS_OK;                                                             \
+}                                                                              \
+                                                                               \
+static inline uint32_t                                                         \
+name##_count(const name *map)                                                  \
+{                                                                              \
+	return map->size;                                                          \
+}                                                                              \
+                                                                               \
+static inline void                                                             \
+name##_foreach(const name *map,                                                \
+	void (*fn)(const key_t *key, val_t *val, void *data), void *data)          \
+{                                                                              \
+	uint32_t i;                                                                \
+	for (i = 0; i < map->capacity; ++i) {                                      \
+		if (map->slots[i].state == ICSMAP_GEN_FULL) {                          \
+			fn(&map->slots[i].key, &map->slots[i].val, data);                  \
+		}                                                                      \
+	}                                                                          \
+}
+
+#endif // ICSMAP_GEN